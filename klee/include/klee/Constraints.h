@@ -11,8 +11,12 @@
 #define KLEE_CONSTRAINTS_H
 
 #include "klee/Expr.h"
+#include "klee/Internal/ADT/ImmutableMap.h"
+#include "klee/Internal/ADT/ImmutableSet.h"
 #include <llvm/Support/raw_ostream.h>
 
+#include <map>
+
 // FIXME: Currently we use ConstraintManager for two things: to pass
 // sets of constraints around, and to optimize constraints. We should
 // move the first usage into a separate data structure
@@ -27,14 +31,25 @@ public:
   typedef constraints_ty::iterator iterator;
   typedef constraints_ty::const_iterator const_iterator;
 
-  ConstraintManager() {}
+  /// An array byte read by a constraint, or the whole array if the
+  /// constraint reads it at a symbolic index.
+  typedef std::pair<const Array*, unsigned> element_ty;
+
+  ConstraintManager() : indexed(true) {}
 
   // create from constraints with no optimization
   explicit
   ConstraintManager(const std::vector< ref<Expr> > &_constraints) :
-    constraints(_constraints) {}
+    constraints(_constraints), indexed(false) {}
 
-  ConstraintManager(const ConstraintManager &cs) : constraints(cs.constraints) {}
+  ConstraintManager(const ConstraintManager &cs) :
+    constraints(cs.constraints),
+    constraintElements(cs.constraintElements),
+    elementParents(cs.elementParents),
+    componentSizes(cs.componentSizes),
+    partitionConstraints(cs.partitionConstraints),
+    equalities(cs.equalities),
+    indexed(cs.indexed) {}
 
   typedef std::vector< ref<Expr> >::const_iterator constraint_iterator;
 
@@ -45,6 +60,11 @@ public:
   ref<Expr> simplifyExpr(ref<Expr> e) const;
 
   void addConstraint(ref<Expr> e);
+
+  /// Append to result the constraints that transitively share array
+  /// elements with e, in the order in which they were added.
+  void getIndependentConstraints(ref<Expr> e,
+                                 std::vector< ref<Expr> > &result) const;
   
   bool empty() const {
     return constraints.empty();
@@ -74,12 +94,53 @@ public:
   }
 
 private:
+  typedef ImmutableMap<element_ty, element_ty> parents_ty;
+  typedef ImmutableMap<element_ty, unsigned> sizes_ty;
+  typedef ImmutableSet< std::pair<element_ty, unsigned> > attachments_ty;
+  typedef ImmutableMap< ref<Expr>, ref<Expr> > equalities_ty;
+
   std::vector< ref<Expr> > constraints;
 
-  // returns true iff the constraints were modified
-  bool rewriteConstraints(ExprVisitor &visitor);
+  // Independence index: a union-find over the array elements read by
+  // the constraints. Immutable maps make copies on fork cheap.
+  // Rewritten constraints keep their old partition, which is
+  // conservative. The index is built lazily for managers created from
+  // a plain vector of constraints.
+
+  // one element of each constraint, (0, 0) if it reads no array
+  mutable std::vector<element_ty> constraintElements;
+  mutable parents_ty elementParents;
+  // weights of the partitions (elements plus attached constraints),
+  // indexed by their root
+  mutable sizes_ty componentSizes;
+  // (root, position) of each constraint that reads an array
+  mutable attachments_ty partitionConstraints;
+
+  // Replacements used by simplifyExpr: x -> c for each constraint
+  // (Eq c x), and e -> true for any other constraint e. Built with the
+  // independence index.
+  mutable equalities_ty equalities;
+
+  // simplifyExpr results for the current equalities (not copied on fork)
+  mutable std::map< ref<Expr>, ref<Expr> > simplificationCache;
+
+  mutable bool indexed;
+
+  // returns true iff the constraints were modified; only constraints
+  // that may contain target are visited
+  bool rewriteConstraints(ExprVisitor &visitor, ref<Expr> target);
 
   void addConstraintInternal(ref<Expr> e);
+
+  void appendConstraint(ref<Expr> e);
+
+  void buildIndex() const;
+  element_ty indexConstraint(ref<Expr> e) const;
+  void attachConstraint(unsigned position, const element_ty &e) const;
+  void addElement(const element_ty &e) const;
+  element_ty findRoot(element_ty e) const;
+  bool findRoots(ref<Expr> e, std::vector<element_ty> &roots) const;
+  void unite(const element_ty &a, const element_ty &b) const;
 };
 
 }
@@ -122,8 +122,12 @@ namespace klee {
     /// Return an id for the given constant, creating a new one if necessary.
     unsigned getConstantID(llvm::Constant *c, KInstruction* ki);
 
-    /// Update shadow structures for newly added function
-    KFunction* updateModuleWithFunction(llvm::Function *f);
+    /// Update shadow structures for newly added function.
+    /// If optimize is false, the optimization passes are skipped.
+    /// If lower is false, the function is assumed to be lowered already
+    /// (e.g., it was loaded from a cache of processed functions).
+    KFunction* updateModuleWithFunction(llvm::Function *f, bool optimize = true,
+                                        bool lower = true);
 
     /// Remove function from KModule and call removeFromParend on it
     void removeFunction(llvm::Function *f, bool keepDeclaration = false);
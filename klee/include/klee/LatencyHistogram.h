@@ -0,0 +1,45 @@
+//===-- LatencyHistogram.h --------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_LATENCYHISTOGRAM_H
+#define KLEE_LATENCYHISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+
+namespace klee {
+  /// Counts durations in power-of-two buckets. Bucket i holds the
+  /// durations in [2^i, 2^(i+1)) microseconds, bucket 0 also holds
+  /// zero and the last bucket holds everything above.
+  class LatencyHistogram {
+  public:
+    enum { BUCKETS = 24 };
+
+  private:
+    uint64_t counts[BUCKETS];
+
+  public:
+    LatencyHistogram() { clear(); }
+
+    void add(uint64_t usec) {
+      unsigned bucket = 0;
+      while (usec > 1 && bucket < BUCKETS - 1) {
+        usec >>= 1;
+        ++bucket;
+      }
+      ++counts[bucket];
+    }
+
+    uint64_t getCount(unsigned bucket) const { return counts[bucket]; }
+
+    void clear() { memset(counts, 0, sizeof(counts)); }
+  };
+}
+
+#endif
@@ -152,8 +152,23 @@ public:
   }
 };
 
+/// Allocates the concrete stores of object states. Clients may install
+/// one to place object contents in a dedicated memory pool.
+class ConcreteStoreAllocator {
+public:
+  virtual ~ConcreteStoreAllocator() {}
+
+  /// Returns NULL if the allocator does not handle stores of this size.
+  virtual uint8_t *allocate(unsigned size) = 0;
+
+  /// Returns false if the store was not allocated by this allocator.
+  virtual bool release(uint8_t *store, unsigned size) = 0;
+};
+
 class ObjectState {
 private:
+  static ConcreteStoreAllocator *storeAllocator;
+
   // XXX(s2e) for now we keep this first to access from C code
   // (yes, we do need to access if really fast)
   BitArray *concreteMask;
@@ -169,6 +184,12 @@ private:
   //XXX: made it public for fast access
   uint8_t *concreteStore;
 
+  // Copies share the concrete store of the object they were made from
+  // until one of them modifies it. The sharers form a circular list,
+  // an object that does not share its store points to itself.
+  mutable const ObjectState *prevSharer;
+  mutable const ObjectState *nextSharer;
+
   // XXX cleanup name of flushMask (its backwards or something)
   // mutable because may need flushed during read of const
   mutable BitArray *flushMask;
@@ -196,6 +217,12 @@ public:
   ObjectState(const ObjectState &os);
   ~ObjectState();
 
+  /// Set the allocator used for the concrete stores of new object states.
+  /// Stores allocated before remain valid.
+  static void setConcreteStoreAllocator(ConcreteStoreAllocator *allocator) {
+    storeAllocator = allocator;
+  }
+
   inline const MemoryObject *getObject() const { return object; }
 
   void setReadOnly(bool ro) { readOnly = ro; }
@@ -220,6 +247,13 @@ public:
     }
   }
 
+  // fast-path to copy a concrete range, a word of the mask at a time.
+  // Returns false (leaving buf partially filled) if a byte is symbolic.
+  bool readConcrete(unsigned offset, uint8_t *buf, unsigned count) const;
+
+  // fast-path to overwrite a range with concrete bytes
+  void writeConcrete(unsigned offset, const uint8_t *buf, unsigned count);
+
   // return bytes written.
   void write(unsigned offset, ref<Expr> value);
   void write(ref<Expr> offset, ref<Expr> value);
@@ -230,6 +264,9 @@ public:
   void write64(unsigned offset, uint64_t value);
 
   bool isAllConcrete() const;
+  bool isAllConcrete(unsigned offset, unsigned count) const {
+    return !concreteMask || concreteMask->isRangeSet(offset, count);
+  }
 
   inline bool isConcrete(unsigned offset, Expr::Width width) const {
     if (!concreteMask)
@@ -247,6 +284,19 @@ public:
   uint8_t *getConcreteStore(bool allowSymolic = false);
 
 private:
+  static uint8_t *allocateConcreteStore(unsigned size);
+  static void releaseConcreteStore(uint8_t *store, unsigned size);
+
+  bool isConcreteStoreShared() const { return nextSharer != this; }
+
+  // Must be called before modifying concreteStore
+  void prepareConcreteStoreWrite() {
+    if (isConcreteStoreShared())
+      unshareConcreteStore();
+  }
+
+  void unshareConcreteStore();
+
   const UpdateList &getUpdates() const;
 
   void makeConcrete();
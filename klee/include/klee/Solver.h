@@ -157,7 +157,10 @@ namespace klee {
     ///
     /// \param useForkedSTP - Whether STP should be run in a separate process
     /// (required for using timeouts).
-    STPSolver(bool useForkedSTP);
+    /// \param portfolioSize - When greater than one, race that many
+    /// differently configured STP processes on each query and use the
+    /// first answer (implies forking).
+    STPSolver(bool useForkedSTP, unsigned portfolioSize = 0);
 
     
     
@@ -187,6 +190,16 @@ namespace klee {
   /// \param s - The underlying solver to use.
   Solver *createCachingSolver(Solver *s);
 
+  /// createPersistentCachingSolver - Create a solver which will cache the
+  /// validity of queries in a memory-mapped file. The file can be shared by
+  /// several processes and is reused across runs.
+  ///
+  /// \param s - The underlying solver to use.
+  /// \param path - The cache file, created if it does not exist.
+  /// \param capacity - The number of entries of a newly created file.
+  Solver *createPersistentCachingSolver(Solver *s, std::string path,
+                                        uint64_t capacity);
+
   /// createCexCachingSolver - Create a counterexample caching solver. This is a
   /// more sophisticated cache which records counterexamples for a constraint
   /// set and uses subset/superset relations among constraints to try and
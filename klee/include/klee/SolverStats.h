@@ -11,11 +11,14 @@
 #define KLEE_SOLVERSTATS_H
 
 #include "klee/Statistic.h"
+#include "klee/LatencyHistogram.h"
 
 namespace klee {
 namespace stats {
 
   extern Statistic cexCacheTime;
+  extern Statistic persistentCacheHits;
+  extern Statistic persistentCacheMisses;
   extern Statistic queries;
   extern Statistic queriesInvalid;
   extern Statistic queriesValid;
@@ -26,6 +29,8 @@ namespace stats {
   extern Statistic queryCounterexamples;
   extern Statistic queryTime;
 
+  extern LatencyHistogram solverTimeHistogram;
+
 }
 }
 
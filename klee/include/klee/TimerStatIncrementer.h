@@ -11,6 +11,7 @@
 #define KLEE_TIMERSTATINCREMENTER_H
 
 #include "klee/Statistics.h"
+#include "klee/LatencyHistogram.h"
 #include "klee/Internal/Support/Timer.h"
 
 namespace klee {
@@ -18,11 +19,17 @@ namespace klee {
   private:
     WallTimer timer;
     Statistic &statistic;
+    LatencyHistogram *histogram;
 
   public:
-    TimerStatIncrementer(Statistic &_statistic) : statistic(_statistic) {}
+    TimerStatIncrementer(Statistic &_statistic,
+                         LatencyHistogram *_histogram = 0)
+      : statistic(_statistic), histogram(_histogram) {}
     ~TimerStatIncrementer() {
-      statistic += timer.check(); 
+      uint64_t delta = timer.check();
+      statistic += delta;
+      if (histogram)
+        histogram->add(delta);
     };
 
     uint64_t check() { return timer.check(); }
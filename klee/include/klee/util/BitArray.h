@@ -38,6 +38,40 @@ public:
   inline void unset(unsigned idx) { bits[idx/32] &= ~(1<<(idx&0x1F)); }
   inline void set(unsigned idx, bool value) { if (value) set(idx); else unset(idx); }
 
+  // true iff the count bits starting at idx are all set
+  bool isRangeSet(unsigned idx, unsigned count) const {
+    if (!count)
+      return true;
+    unsigned first = idx/32, last = (idx+count-1)/32;
+    uint32_t headMask = ~0u << (idx&0x1F);
+    uint32_t tailMask = ~0u >> (31 - ((idx+count-1)&0x1F));
+    if (first == last)
+      return (bits[first] & (headMask & tailMask)) == (headMask & tailMask);
+    if ((bits[first] & headMask) != headMask)
+      return false;
+    for (unsigned i = first + 1; i < last; ++i)
+      if (bits[i] != 0xffffffff)
+        return false;
+    return (bits[last] & tailMask) == tailMask;
+  }
+
+  // set the count bits starting at idx
+  void setRange(unsigned idx, unsigned count) {
+    if (!count)
+      return;
+    unsigned first = idx/32, last = (idx+count-1)/32;
+    uint32_t headMask = ~0u << (idx&0x1F);
+    uint32_t tailMask = ~0u >> (31 - ((idx+count-1)&0x1F));
+    if (first == last) {
+      bits[first] |= headMask & tailMask;
+      return;
+    }
+    bits[first] |= headMask;
+    for (unsigned i = first + 1; i < last; ++i)
+      bits[i] = 0xffffffff;
+    bits[last] |= tailMask;
+  }
+
   bool isAllZeros(unsigned size) {
     for(unsigned i = 0; i < size/32; ++i)
       if(bits[i] != 0)
@@ -179,6 +179,17 @@ namespace {
            cl::init(true),
 	   cl::desc("Use validity caching"));
 
+  cl::opt<std::string>
+  PersistentCacheFile("persistent-cache-file",
+           cl::desc("Cache query validity in this file, shared by all"
+                    " instances and reused across runs (default=off)"),
+           cl::init(""));
+
+  cl::opt<unsigned>
+  PersistentCacheEntries("persistent-cache-entries",
+           cl::desc("Number of entries of a newly created persistent cache file"),
+           cl::init(1 << 22));
+
   cl::opt<bool>
   OnlyReplaySeeds("only-replay-seeds", 
                   cl::desc("Discard states that do not have a seed."));
@@ -255,6 +266,11 @@ namespace {
   UseForkedSTP("use-forked-stp", 
                  cl::desc("Run STP in forked process"),  cl::init(false));
 
+  cl::opt<unsigned>
+  STPPortfolio("stp-portfolio",
+               cl::desc("Race this many differently configured STP processes on each query (0=off)"),
+               cl::init(0));
+
   /*
   cl::opt<bool>
   IgnoreAlwaysConcrete("ignore-always-concrete",
@@ -308,6 +324,10 @@ Solver *constructSolverChain(STPSolver *stpSolver,
   if (UseCexCache)
     solver = createCexCachingSolver(solver);
 
+  if (!PersistentCacheFile.empty())
+    solver = createPersistentCachingSolver(solver, PersistentCacheFile,
+                                           PersistentCacheEntries);
+
   if (UseCache)
     solver = createCachingSolver(solver);
 
@@ -330,7 +350,7 @@ void Executor::initializeSolver()
         delete this->solver;
     }
 
-    STPSolver *stpSolver = new STPSolver(UseForkedSTP);
+    STPSolver *stpSolver = new STPSolver(UseForkedSTP, STPPortfolio);
     Solver *solver =
       constructSolverChain(stpSolver,
                            interpreterHandler->getOutputFilename("queries.qlog"),
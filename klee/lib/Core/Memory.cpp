@@ -89,12 +89,30 @@ void MemoryObject::getAllocInfo(std::string &result) const {
 
 /***/
 
+ConcreteStoreAllocator *ObjectState::storeAllocator = 0;
+
+uint8_t *ObjectState::allocateConcreteStore(unsigned size) {
+  if (storeAllocator) {
+    if (uint8_t *store = storeAllocator->allocate(size))
+      return store;
+  }
+  return new uint8_t[size];
+}
+
+void ObjectState::releaseConcreteStore(uint8_t *store, unsigned size) {
+  if (storeAllocator && storeAllocator->release(store, size))
+    return;
+  delete[] store;
+}
+
 ObjectState::ObjectState(const MemoryObject *mo)
   : concreteMask(0),
     copyOnWriteOwner(0),
     refCount(0),
     object(mo),
-    concreteStore(new uint8_t[mo->size]),
+    concreteStore(allocateConcreteStore(mo->size)),
+    prevSharer(this),
+    nextSharer(this),
     flushMask(0),
     knownSymbolics(0),
     updates(0, 0),
@@ -115,7 +133,9 @@ ObjectState::ObjectState(const MemoryObject *mo, const Array *array)
     copyOnWriteOwner(0),
     refCount(0),
     object(mo),
-    concreteStore(new uint8_t[mo->size]),
+    concreteStore(allocateConcreteStore(mo->size)),
+    prevSharer(this),
+    nextSharer(this),
     flushMask(0),
     knownSymbolics(0),
     updates(array, 0),
@@ -130,7 +150,9 @@ ObjectState::ObjectState(const ObjectState &os)
     copyOnWriteOwner(0),
     refCount(0),
     object(os.object),
-    concreteStore(new uint8_t[os.size]),
+    concreteStore(os.concreteStore),
+    prevSharer(&os),
+    nextSharer(os.nextSharer),
     flushMask(os.flushMask ? new BitArray(*os.flushMask, os.size) : 0),
     knownSymbolics(0),
     updates(os.updates),
@@ -145,14 +167,33 @@ ObjectState::ObjectState(const ObjectState &os)
       knownSymbolics[i] = os.knownSymbolics[i];
   }
 
-  memcpy(concreteStore, os.concreteStore, size*sizeof(*concreteStore));
+  // The bytes are copied when one of the sharers first modifies them
+  nextSharer->prevSharer = this;
+  os.nextSharer = this;
 }
 
 ObjectState::~ObjectState() {
   if (concreteMask) delete concreteMask;
   if (flushMask) delete flushMask;
   if (knownSymbolics) delete[] knownSymbolics;
-  delete[] concreteStore;
+
+  if (isConcreteStoreShared()) {
+    prevSharer->nextSharer = nextSharer;
+    nextSharer->prevSharer = prevSharer;
+  } else {
+    releaseConcreteStore(concreteStore, size);
+  }
+}
+
+void ObjectState::unshareConcreteStore() {
+  uint8_t *store = allocateConcreteStore(size);
+  memcpy(store, concreteStore, size);
+
+  prevSharer->nextSharer = nextSharer;
+  nextSharer->prevSharer = prevSharer;
+  prevSharer = nextSharer = this;
+
+  concreteStore = store;
 }
 
 /***/
@@ -236,11 +277,13 @@ void ObjectState::makeSymbolic() {
 
 void ObjectState::initializeToZero() {
   makeConcrete();
+  prepareConcreteStoreWrite();
   memset(concreteStore, 0, size);
 }
 
 void ObjectState::initializeToRandom() {  
   makeConcrete();
+  prepareConcreteStoreWrite();
   for (unsigned i=0; i<size; i++) {
     // randomly selected by 256 sided die
     concreteStore[i] = 0xAB;
@@ -331,6 +374,8 @@ uint8_t *ObjectState::getConcreteStore(bool allowSymbolic)
     if (!allowSymbolic && !isAllConcrete()) {
         return NULL;
     }
+    // The caller may write through the returned pointer
+    prepareConcreteStoreWrite();
     return concreteStore;
 }
 
@@ -403,7 +448,10 @@ ref<Expr> ObjectState::read8(ref<Expr> offset) const {
 void ObjectState::write8(unsigned offset, uint8_t value) {
   //assert(read_only == false && "writing to read-only object!");
   if(!object->isSharedConcrete) {
-    concreteStore[offset] = value;
+    if (concreteStore[offset] != value) {
+      prepareConcreteStoreWrite();
+      concreteStore[offset] = value;
+    }
     setKnownSymbolic(offset, 0);
 
     markByteConcrete(offset);
@@ -413,6 +461,42 @@ void ObjectState::write8(unsigned offset, uint8_t value) {
   }
 }
 
+bool ObjectState::readConcrete(unsigned offset, uint8_t *buf,
+                               unsigned count) const {
+  if (object->isSharedConcrete) {
+    memcpy(buf, ((uint8_t*) object->address) + offset, count);
+    return true;
+  }
+
+  if (!isAllConcrete(offset, count))
+    return false;
+
+  memcpy(buf, concreteStore + offset, count);
+  return true;
+}
+
+void ObjectState::writeConcrete(unsigned offset, const uint8_t *buf,
+                                unsigned count) {
+  if (object->isSharedConcrete) {
+    memcpy(((uint8_t*) object->address) + offset, buf, count);
+    return;
+  }
+
+  if (!isConcreteStoreShared() ||
+      memcmp(concreteStore + offset, buf, count) != 0) {
+    prepareConcreteStoreWrite();
+    memcpy(concreteStore + offset, buf, count);
+  }
+  if (knownSymbolics) {
+    for (unsigned i = 0; i < count; ++i)
+      setKnownSymbolic(offset + i, 0);
+  }
+  if (concreteMask)
+    concreteMask->setRange(offset, count);
+  if (flushMask)
+    flushMask->setRange(offset, count);
+}
+
 void ObjectState::write8(unsigned offset, ref<Expr> value) {
   // can happen when ExtractExpr special cases
   if (ConstantExpr *CE = dyn_cast<ConstantExpr>(value)) {
@@ -15,6 +15,7 @@
 #include "klee/Statistics.h"
 
 #include "klee/CoreStats.h"
+#include "klee/SolverStats.h"
 
 #include "llvm/Support/Process.h"
 
@@ -43,6 +44,7 @@ bool TimingSolver::evaluate(const ExecutionState& state, ref<Expr> expr,
   sys::Process::GetTimeUsage(delta,user,sys);
   delta -= now;
   stats::solverTime += delta.usec();
+  stats::solverTimeHistogram.add(delta.usec());
   state.queryCost += delta.usec()/1000000.;
 
   return success;
@@ -67,6 +69,7 @@ bool TimingSolver::mustBeTrue(const ExecutionState& state, ref<Expr> expr,
   sys::Process::GetTimeUsage(delta,user,sys);
   delta -= now;
   stats::solverTime += delta.usec();
+  stats::solverTimeHistogram.add(delta.usec());
   state.queryCost += delta.usec()/1000000.;
 
   return success;
@@ -115,6 +118,7 @@ bool TimingSolver::getValue(const ExecutionState& state, ref<Expr> expr,
   sys::Process::GetTimeUsage(delta,user,sys);
   delta -= now;
   stats::solverTime += delta.usec();
+  stats::solverTimeHistogram.add(delta.usec());
   state.queryCost += delta.usec()/1000000.;
 
   return success;
@@ -139,6 +143,7 @@ TimingSolver::getInitialValues(const ExecutionState& state,
   sys::Process::GetTimeUsage(delta,user,sys);
   delta -= now;
   stats::solverTime += delta.usec();
+  stats::solverTimeHistogram.add(delta.usec());
   state.queryCost += delta.usec()/1000000.;
   
   return success;
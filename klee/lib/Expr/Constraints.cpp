@@ -10,10 +10,13 @@
 #include "klee/Constraints.h"
 
 #include "klee/util/ExprPPrinter.h"
+#include "klee/util/ExprUtil.h"
 #include "klee/util/ExprVisitor.h"
 
+#include <algorithm>
 #include <iostream>
 #include <map>
+#include <set>
 
 using namespace klee;
 
@@ -43,17 +46,18 @@ public:
 
 class ExprReplaceVisitor2 : public ExprVisitor {
 private:
-  const std::map< ref<Expr>, ref<Expr> > &replacements;
+  typedef ImmutableMap< ref<Expr>, ref<Expr> > replacements_ty;
+  const replacements_ty &replacements;
 
 public:
-  ExprReplaceVisitor2(const std::map< ref<Expr>, ref<Expr> > &_replacements) 
+  ExprReplaceVisitor2(const replacements_ty &_replacements)
     : ExprVisitor(true),
       replacements(_replacements) {}
 
   Action visitExprPost(const Expr &e) {
-    std::map< ref<Expr>, ref<Expr> >::const_iterator it =
-      replacements.find(ref<Expr>(const_cast<Expr*>(&e)));
-    if (it!=replacements.end()) {
+    const replacements_ty::value_type *it =
+      replacements.lookup(ref<Expr>(const_cast<Expr*>(&e)));
+    if (it) {
       return Action::changeTo(it->second);
     } else {
       return Action::doChildren();
@@ -61,21 +65,259 @@ public:
   }
 };
 
-bool ConstraintManager::rewriteConstraints(ExprVisitor &visitor) {
+// The replacement that constraint e allows in simplifyExpr
+static std::pair< ref<Expr>, ref<Expr> > getEquality(ref<Expr> e) {
+  if (const EqExpr *ee = dyn_cast<EqExpr>(e)) {
+    if (isa<ConstantExpr>(ee->left))
+      return std::make_pair(ee->right, ee->left);
+  }
+  return std::make_pair(e, ConstantExpr::alloc(1, Expr::Bool));
+}
+
+static const unsigned WholeObject = ~0u;
+
+static const size_t MaxSimplificationCacheSize = 4096;
+
+// Collect the array elements read by e. A read at a symbolic index
+// depends on the whole array.
+static void findElements(ref<Expr> e,
+                         std::vector<ConstraintManager::element_ty> &result) {
+  std::vector< ref<ReadExpr> > reads;
+  findReads(e, /* visitUpdates= */ true, reads);
+  for (unsigned i = 0; i != reads.size(); ++i) {
+    ReadExpr *re = reads[i].get();
+    const Array *array = re->updates.root;
+
+    // Reads of a constant array don't alias.
+    if (array->isConstantArray() && !re->updates.head)
+      continue;
+
+    if (ConstantExpr *CE = dyn_cast<ConstantExpr>(re->index)) {
+      result.push_back(std::make_pair(array,
+                                      (unsigned) CE->getZExtValue(32)));
+    } else {
+      result.push_back(std::make_pair(array, WholeObject));
+    }
+  }
+}
+
+ConstraintManager::element_ty
+ConstraintManager::findRoot(element_ty e) const {
+  for (;;) {
+    const parents_ty::value_type *p = elementParents.lookup(e);
+    assert(p && "element is not indexed");
+    if (p->second == e)
+      return e;
+    e = p->second;
+  }
+}
+
+void ConstraintManager::unite(const element_ty &a, const element_ty &b) const {
+  element_ty ra = findRoot(a), rb = findRoot(b);
+  if (ra == rb)
+    return;
+
+  unsigned sa = componentSizes.lookup(ra)->second;
+  unsigned sb = componentSizes.lookup(rb)->second;
+  if (sa < sb)
+    std::swap(ra, rb);
+
+  elementParents = elementParents.replace(std::make_pair(rb, ra));
+  componentSizes = componentSizes.remove(rb).replace(std::make_pair(ra, sa + sb));
+
+  // The constraints of the lighter partition move to the new root
+  std::vector<unsigned> positions;
+  for (attachments_ty::iterator
+         it = partitionConstraints.lower_bound(std::make_pair(rb, 0u)),
+         ie = partitionConstraints.end(); it != ie && it->first == rb; ++it)
+    positions.push_back(it->second);
+  for (unsigned i = 0; i < positions.size(); ++i)
+    partitionConstraints = partitionConstraints
+      .remove(std::make_pair(rb, positions[i]))
+      .insert(std::make_pair(ra, positions[i]));
+}
+
+void ConstraintManager::addElement(const element_ty &e) const {
+  if (elementParents.count(e))
+    return;
+
+  elementParents = elementParents.insert(std::make_pair(e, e));
+  componentSizes = componentSizes.insert(std::make_pair(e, 1u));
+
+  element_ty whole(e.first, WholeObject);
+  if (e.second != WholeObject) {
+    if (elementParents.count(whole))
+      unite(e, whole);
+    return;
+  }
+
+  // The whole array depends on all the bytes read so far. Bytes
+  // read later are attached to it by the code above.
+  std::vector<element_ty> bytes;
+  for (parents_ty::iterator it =
+         elementParents.lower_bound(std::make_pair(e.first, 0u));
+       it != elementParents.end() && it->first.first == e.first &&
+         it->first.second != WholeObject; ++it) {
+    bytes.push_back(it->first);
+  }
+  for (unsigned i = 0; i < bytes.size(); ++i)
+    unite(e, bytes[i]);
+}
+
+ConstraintManager::element_ty
+ConstraintManager::indexConstraint(ref<Expr> e) const {
+  std::vector<element_ty> elements;
+  findElements(e, elements);
+  if (elements.empty())
+    return element_ty(0, 0);
+
+  for (unsigned i = 0; i < elements.size(); ++i) {
+    addElement(elements[i]);
+    if (i)
+      unite(elements[0], elements[i]);
+  }
+  return elements[0];
+}
+
+// Records that the constraint at the given position belongs to the
+// partition of e
+void ConstraintManager::attachConstraint(unsigned position,
+                                         const element_ty &e) const {
+  if (!e.first)
+    return;
+
+  element_ty root = findRoot(e);
+  partitionConstraints =
+    partitionConstraints.insert(std::make_pair(root, position));
+  unsigned size = componentSizes.lookup(root)->second;
+  componentSizes = componentSizes.replace(std::make_pair(root, size + 1));
+}
+
+void ConstraintManager::buildIndex() const {
+  if (indexed)
+    return;
+
+  constraintElements.clear();
+  elementParents = parents_ty();
+  componentSizes = sizes_ty();
+  partitionConstraints = attachments_ty();
+  equalities = equalities_ty();
+  simplificationCache.clear();
+  for (constraints_ty::const_iterator it = constraints.begin(),
+         ie = constraints.end(); it != ie; ++it) {
+    element_ty e = indexConstraint(*it);
+    attachConstraint(constraintElements.size(), e);
+    constraintElements.push_back(e);
+    equalities = equalities.insert(getEquality(*it));
+  }
+  indexed = true;
+}
+
+void ConstraintManager::appendConstraint(ref<Expr> e) {
+  constraints.push_back(e);
+  if (indexed) {
+    element_ty elt = indexConstraint(e);
+    attachConstraint(constraintElements.size(), elt);
+    constraintElements.push_back(elt);
+    equalities = equalities.insert(getEquality(e));
+    simplificationCache.clear();
+  }
+}
+
+// Returns false if e does not read any symbolic array
+bool ConstraintManager::findRoots(ref<Expr> e,
+                                  std::vector<element_ty> &roots) const {
+  std::vector<element_ty> elements;
+  findElements(e, elements);
+
+  for (unsigned i = 0; i < elements.size(); ++i) {
+    const element_ty &elt = elements[i];
+    element_ty whole(elt.first, WholeObject);
+    if (elementParents.count(elt)) {
+      roots.push_back(findRoot(elt));
+    } else if (elementParents.count(whole)) {
+      roots.push_back(findRoot(whole));
+    } else if (elt.second == WholeObject) {
+      // Not read as a whole by any constraint, depends on every byte
+      for (parents_ty::iterator it =
+             elementParents.lower_bound(std::make_pair(elt.first, 0u));
+           it != elementParents.end() && it->first.first == elt.first; ++it)
+        roots.push_back(findRoot(it->first));
+    }
+  }
+
+  return !elements.empty();
+}
+
+void ConstraintManager::getIndependentConstraints(ref<Expr> e,
+                                   std::vector< ref<Expr> > &result) const {
+  buildIndex();
+
+  std::vector<element_ty> rootList;
+  findRoots(e, rootList);
+  if (rootList.empty())
+    return;
+
+  std::set<element_ty> roots(rootList.begin(), rootList.end());
+
+  std::vector<unsigned> positions;
+  for (std::set<element_ty>::iterator it = roots.begin(), ie = roots.end();
+       it != ie; ++it) {
+    for (attachments_ty::iterator
+           ai = partitionConstraints.lower_bound(std::make_pair(*it, 0u)),
+           ae = partitionConstraints.end(); ai != ae && ai->first == *it; ++ai)
+      positions.push_back(ai->second);
+  }
+
+  std::sort(positions.begin(), positions.end());
+  for (unsigned i = 0; i < positions.size(); ++i)
+    result.push_back(constraints[positions[i]]);
+}
+
+// Constraints that contain target must read some of its elements, so
+// only the partitions of these elements need to be visited.
+bool ConstraintManager::rewriteConstraints(ExprVisitor &visitor,
+                                           ref<Expr> target) {
   ConstraintManager::constraints_ty old;
+  std::vector<element_ty> oldElements;
+  std::vector<element_ty> targetElements;
+  bool visitAll = !indexed || !findRoots(target, targetElements);
   bool changed = false;
 
   constraints.swap(old);
-  for (ConstraintManager::constraints_ty::iterator 
-         it = old.begin(), ie = old.end(); it != ie; ++it) {
-    ref<Expr> &ce = *it;
-    ref<Expr> e = visitor.visit(ce);
+  constraintElements.swap(oldElements);
+  // Positions change, the constraints are attached again below
+  partitionConstraints = attachments_ty();
+  for (unsigned i = 0; i < old.size(); ++i) {
+    ref<Expr> &ce = old[i];
+
+    // Partitions may be merged while rewriting, compare the roots
+    bool mayContain = visitAll;
+    if (!mayContain && oldElements[i].first) {
+      element_ty root = findRoot(oldElements[i]);
+      for (unsigned j = 0; j < targetElements.size() && !mayContain; ++j)
+        mayContain = findRoot(targetElements[j]) == root;
+    }
+
+    ref<Expr> e = mayContain ? visitor.visit(ce) : ce;
 
     if (e!=ce) {
+      if (indexed) {
+        // ce no longer is a constraint
+        std::pair< ref<Expr>, ref<Expr> > eq = getEquality(ce);
+        const equalities_ty::value_type *v = equalities.lookup(eq.first);
+        if (v && v->second == eq.second)
+          equalities = equalities.remove(eq.first);
+        simplificationCache.clear();
+      }
       addConstraintInternal(e); // enable further reductions
       changed = true;
     } else {
       constraints.push_back(ce);
+      if (indexed) {
+        attachConstraint(constraintElements.size(), oldElements[i]);
+        constraintElements.push_back(oldElements[i]);
+      }
     }
   }
 
@@ -90,25 +332,20 @@ ref<Expr> ConstraintManager::simplifyExpr(ref<Expr> e) const {
   if (isa<ConstantExpr>(e))
     return e;
 
-  std::map< ref<Expr>, ref<Expr> > equalities;
-  
-  for (ConstraintManager::constraints_ty::const_iterator 
-         it = constraints.begin(), ie = constraints.end(); it != ie; ++it) {
-    if (const EqExpr *ee = dyn_cast<EqExpr>(*it)) {
-      if (isa<ConstantExpr>(ee->left)) {
-        equalities.insert(std::make_pair(ee->right,
-                                         ee->left));
-      } else {
-        equalities.insert(std::make_pair(*it,
-                                         ConstantExpr::alloc(1, Expr::Bool)));
-      }
-    } else {
-      equalities.insert(std::make_pair(*it,
-                                       ConstantExpr::alloc(1, Expr::Bool)));
-    }
-  }
+  buildIndex();
+  if (equalities.empty())
+    return e;
+
+  std::map< ref<Expr>, ref<Expr> >::iterator it = simplificationCache.find(e);
+  if (it != simplificationCache.end())
+    return it->second;
+
+  ref<Expr> result = ExprReplaceVisitor2(equalities).visit(e);
 
-  return ExprReplaceVisitor2(equalities).visit(e);
+  if (simplificationCache.size() >= MaxSimplificationCacheSize)
+    simplificationCache.clear();
+  simplificationCache.insert(std::make_pair(e, result));
+  return result;
 }
 
 void ConstraintManager::addConstraintInternal(ref<Expr> e) {
@@ -138,14 +375,14 @@ void ConstraintManager::addConstraintInternal(ref<Expr> e) {
     BinaryExpr *be = cast<BinaryExpr>(e);
     if (isa<ConstantExpr>(be->left)) {
       ExprReplaceVisitor visitor(be->right, be->left);
-      rewriteConstraints(visitor);
+      rewriteConstraints(visitor, be->right);
     }
-    constraints.push_back(e);
+    appendConstraint(e);
     break;
   }
     
   default:
-    constraints.push_back(e);
+    appendConstraint(e);
     break;
   }
 }
@@ -547,7 +547,8 @@ void KModule::prepare(const Interpreter::ModuleOptions &opts,
   }
 }
 
-KFunction* KModule::updateModuleWithFunction(llvm::Function *f)
+KFunction* KModule::updateModuleWithFunction(llvm::Function *f, bool optimize,
+                                             bool lower)
 {
     assert(functionMap.find(f) == functionMap.end());
 
@@ -556,10 +557,14 @@ KFunction* KModule::updateModuleWithFunction(llvm::Function *f)
     //IntrinsicCleanerPass ip(*targetData, false);
     //ip.runOnFunction(*f);
 
-    p->fpmOptimize.run(*f);
+    if (optimize) {
+        p->fpmOptimize.run(*f);
+    }
 
-    p->fpm3.run(*f);
-    p->fpm4.run(*f);
+    if (lower) {
+        p->fpm3.run(*f);
+        p->fpm4.run(*f);
+    }
 
     KFunction *kf = new KFunction(f, this);
 
@@ -0,0 +1,492 @@
+//===-- PersistentCachingSolver.cpp ---------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Validity cache stored in a memory-mapped file. The file can be shared by
+// several processes at the same time (e.g., forked S2E instances) and is
+// kept across runs.
+//
+// Queries are identified by a 128-bit hash of their canonical form. The
+// hash only depends on the structure of the expressions and on the names of
+// the arrays, which makes it stable across runs. The constraints are hashed
+// independently of their order.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Solver.h"
+
+#include "klee/Constraints.h"
+#include "klee/Expr.h"
+#include "klee/IncompleteSolver.h"
+#include "klee/SolverImpl.h"
+#include "klee/SolverStats.h"
+#include "klee/util/ExprHashMap.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace klee;
+using namespace llvm;
+
+namespace {
+
+struct QueryHash {
+  uint64_t h1, h2;
+
+  QueryHash() : h1(0), h2(0) {}
+  QueryHash(uint64_t _h1, uint64_t _h2) : h1(_h1), h2(_h2) {}
+
+  bool operator<(const QueryHash &b) const {
+    return h1 < b.h1 || (h1 == b.h1 && h2 < b.h2);
+  }
+};
+
+/// Computes stable 128-bit hashes of expressions. Unlike Expr::hash(),
+/// the result is wide enough to be used as the only key of a cache entry.
+class ExprHasher {
+  static const unsigned MAX_CACHED_EXPRESSIONS = 1 << 20;
+
+  ExprHashMap<QueryHash> cache;
+
+  static void mix(QueryHash &h, uint64_t value) {
+    h.h1 = finalize((h.h1 ^ value) * 0x9E3779B97F4A7C15ULL);
+    h.h2 = finalize((h.h2 + value) * 0xC2B2AE3D27D4EB4FULL);
+  }
+
+  static void mix(QueryHash &h, const QueryHash &value) {
+    mix(h, value.h1);
+    mix(h, value.h2);
+  }
+
+  static uint64_t finalize(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+  }
+
+  void hashUpdates(QueryHash &h, const UpdateList &ul) {
+    const Array *root = ul.root;
+    for (unsigned i = 0; i < root->name.size(); ++i)
+      mix(h, (uint8_t) root->name[i]);
+    mix(h, root->size);
+
+    for (unsigned i = 0; i < root->constantValues.size(); ++i)
+      mix(h, hash(root->constantValues[i]));
+
+    for (const UpdateNode *un = ul.head; un; un = un->next) {
+      mix(h, hash(un->index));
+      mix(h, hash(un->value));
+    }
+  }
+
+public:
+  QueryHash hash(const ref<Expr> &e) {
+    ExprHashMap<QueryHash>::iterator it = cache.find(e);
+    if (it != cache.end())
+      return it->second;
+
+    QueryHash h(e->getKind(), ~(uint64_t) e->getKind());
+    mix(h, e->getWidth());
+
+    if (const ConstantExpr *ce = dyn_cast<ConstantExpr>(e)) {
+      const APInt &value = ce->getAPValue();
+      for (unsigned i = 0; i < value.getNumWords(); ++i)
+        mix(h, value.getRawData()[i]);
+    } else {
+      if (const ExtractExpr *ee = dyn_cast<ExtractExpr>(e))
+        mix(h, ee->offset);
+      else if (const ReadExpr *re = dyn_cast<ReadExpr>(e))
+        hashUpdates(h, re->updates);
+
+      for (unsigned i = 0; i < e->getNumKids(); ++i)
+        mix(h, hash(e->getKid(i)));
+    }
+
+    if (cache.size() >= MAX_CACHED_EXPRESSIONS)
+      cache.clear();
+    cache.insert(std::make_pair(e, h));
+    return h;
+  }
+
+  QueryHash hash(const ConstraintManager &constraints) {
+    std::vector<QueryHash> hashes;
+    hashes.reserve(constraints.size());
+    for (ConstraintManager::constraint_iterator it = constraints.begin();
+         it != constraints.end(); ++it)
+      hashes.push_back(hash(*it));
+
+    std::sort(hashes.begin(), hashes.end());
+
+    QueryHash h(hashes.size(), 0);
+    for (unsigned i = 0; i < hashes.size(); ++i)
+      mix(h, hashes[i]);
+    return h;
+  }
+
+  QueryHash hash(const ConstraintManager &constraints, const QueryHash &expr) {
+    QueryHash h = hash(constraints);
+    mix(h, expr);
+    return h;
+  }
+};
+
+/// Layout of the cache file. The header is followed by an open-addressing
+/// hash table of CacheFileEntry.
+struct CacheFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t capacity;
+};
+
+/// An entry is owned by the process that set h1 from 0 with a
+/// compare-and-swap. Its result is published together with h2 with a
+/// single 64-bit store: the low bits of the second word hold the biased
+/// result, so that 0 means that the entry is not complete yet.
+struct CacheFileEntry {
+  uint64_t h1;
+  uint64_t h2AndResult;
+};
+
+}
+
+class PersistentCachingSolver : public SolverImpl {
+private:
+  static const char MAGIC[8];
+  static const uint32_t VERSION = 1;
+  static const unsigned MAX_PROBES = 16;
+  static const uint64_t RESULT_MASK = 7;
+
+  // Maps PartialValidity values (-2..2) to non-zero values
+  static const int RESULT_BIAS = 3;
+
+  Solver *solver;
+  ExprHasher hasher;
+
+  int fd;
+  void *mapping;
+  size_t mappingSize;
+  CacheFileEntry *entries;
+  uint64_t capacity;
+
+  /// True if the stored result is MustBeTrue, MustBeFalse or TrueOrFalse,
+  /// i.e., cannot be refined by a later query.
+  static bool isCompleteResult(uint64_t h2AndResult) {
+    int result = (int) (h2AndResult & RESULT_MASK) - RESULT_BIAS;
+    return result >= -1 && result <= 1;
+  }
+
+  bool openCache(const std::string &path, uint64_t requestedCapacity);
+
+  QueryHash getQueryHash(const Query &query, bool &negationUsed);
+
+  void cacheInsert(const Query& query,
+                   IncompleteSolver::PartialValidity result);
+
+  bool cacheLookup(const Query& query,
+                   IncompleteSolver::PartialValidity &result);
+
+public:
+  PersistentCachingSolver(Solver *s, const std::string &path,
+                          uint64_t capacity);
+  ~PersistentCachingSolver();
+
+  bool computeValidity(const Query&, Solver::Validity &result);
+  bool computeTruth(const Query&, bool &isValid);
+  bool computeValue(const Query& query, ref<Expr> &result) {
+    return solver->impl->computeValue(query, result);
+  }
+  bool computeInitialValues(const Query& query,
+                            const std::vector<const Array*> &objects,
+                            std::vector< std::vector<unsigned char> > &values,
+                            bool &hasSolution) {
+    return solver->impl->computeInitialValues(query, objects, values,
+                                              hasSolution);
+  }
+};
+
+const char PersistentCachingSolver::MAGIC[8] = { 'K', 'L', 'E', 'E', 'Q', 'C', 'H', 'E' };
+
+PersistentCachingSolver::PersistentCachingSolver(Solver *s,
+                                                 const std::string &path,
+                                                 uint64_t _capacity)
+  : solver(s), fd(-1), mapping(NULL), mappingSize(0),
+    entries(NULL), capacity(0) {
+  if (!openCache(path, _capacity)) {
+    llvm::errs() << "KLEE: WARNING: could not open persistent solver cache "
+                 << path << ": " << strerror(errno) << "\n";
+  }
+}
+
+PersistentCachingSolver::~PersistentCachingSolver() {
+  if (mapping)
+    munmap(mapping, mappingSize);
+  if (fd >= 0)
+    close(fd);
+  delete solver;
+}
+
+bool PersistentCachingSolver::openCache(const std::string &path,
+                                        uint64_t requestedCapacity) {
+  fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+    return false;
+
+  // Serialize the initialization of the file between instances
+  if (flock(fd, LOCK_EX) < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    flock(fd, LOCK_UN);
+    return false;
+  }
+
+  CacheFileHeader header;
+  if (st.st_size == 0) {
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.reserved = 0;
+    header.capacity = requestedCapacity;
+
+    off_t size = sizeof(header) + requestedCapacity * sizeof(CacheFileEntry);
+    if (ftruncate(fd, size) < 0 ||
+        pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+      flock(fd, LOCK_UN);
+      return false;
+    }
+  } else if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+             memcmp(header.magic, MAGIC, sizeof(MAGIC)) ||
+             header.version != VERSION || header.capacity == 0 ||
+             st.st_size < (off_t) (sizeof(header) +
+                                   header.capacity * sizeof(CacheFileEntry))) {
+    flock(fd, LOCK_UN);
+    errno = EINVAL;
+    return false;
+  }
+
+  flock(fd, LOCK_UN);
+
+  mappingSize = sizeof(header) + header.capacity * sizeof(CacheFileEntry);
+  mapping = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED) {
+    mapping = NULL;
+    return false;
+  }
+
+  entries = (CacheFileEntry*) ((uint8_t*) mapping + sizeof(header));
+  capacity = header.capacity;
+  return true;
+}
+
+/** @returns the hash of the canonical version of the given query.  The
+    reference negationUsed is set to true if the original query was
+    negated in the canonicalization process. */
+QueryHash PersistentCachingSolver::getQueryHash(const Query &query,
+                                                bool &negationUsed) {
+  QueryHash original = hasher.hash(query.expr);
+  QueryHash negated = hasher.hash(Expr::createIsZero(query.expr));
+
+  negationUsed = negated < original;
+  QueryHash h = hasher.hash(query.constraints,
+                            negationUsed ? negated : original);
+
+  // 0 marks free entries
+  if (!h.h1)
+    h.h1 = 1;
+  return h;
+}
+
+/** @returns true on a cache hit, false of a cache miss.  Reference
+    value result only valid on a cache hit. */
+bool PersistentCachingSolver::cacheLookup(const Query& query,
+                                          IncompleteSolver::PartialValidity &result) {
+  if (!entries)
+    return false;
+
+  bool negationUsed;
+  QueryHash h = getQueryHash(query, negationUsed);
+
+  for (unsigned i = 0; i < MAX_PROBES; ++i) {
+    volatile CacheFileEntry *entry = &entries[(h.h1 + i) % capacity];
+    uint64_t h1 = entry->h1;
+    if (!h1)
+      return false;
+    if (h1 != h.h1)
+      continue;
+
+    uint64_t h2AndResult = entry->h2AndResult;
+    if (!h2AndResult || (h2AndResult & ~RESULT_MASK) != (h.h2 & ~RESULT_MASK))
+      continue;
+
+    IncompleteSolver::PartialValidity cachedResult =
+      (IncompleteSolver::PartialValidity) ((int) (h2AndResult & RESULT_MASK) - RESULT_BIAS);
+    result = (negationUsed ?
+              IncompleteSolver::negatePartialValidity(cachedResult) :
+              cachedResult);
+    return true;
+  }
+
+  return false;
+}
+
+/// Inserts the given query, result pair into the cache. The result is
+/// dropped if all the probed entries belong to other queries.
+void PersistentCachingSolver::cacheInsert(const Query& query,
+                                          IncompleteSolver::PartialValidity result) {
+  if (!entries)
+    return;
+
+  bool negationUsed;
+  QueryHash h = getQueryHash(query, negationUsed);
+
+  IncompleteSolver::PartialValidity cachedResult =
+    (negationUsed ? IncompleteSolver::negatePartialValidity(result) : result);
+  uint64_t h2AndResult = (h.h2 & ~RESULT_MASK) | (uint64_t) (cachedResult + RESULT_BIAS);
+
+  for (unsigned i = 0; i < MAX_PROBES; ++i) {
+    CacheFileEntry *entry = &entries[(h.h1 + i) % capacity];
+    uint64_t h1 = __sync_val_compare_and_swap(&entry->h1, 0, h.h1);
+    if (h1 && h1 != h.h1)
+      continue;
+
+    uint64_t old = entry->h2AndResult;
+    if (h1 && old && (old & ~RESULT_MASK) != (h.h2 & ~RESULT_MASK))
+      continue;
+
+    // Another process may concurrently store a less precise result for
+    // the same query (e.g., MayBeTrue after True). Never replace a
+    // complete result, and retry if the entry changed under us.
+    for (;;) {
+      if (old && (old & ~RESULT_MASK) == (h.h2 & ~RESULT_MASK) &&
+          isCompleteResult(old))
+        return;
+      uint64_t prev = __sync_val_compare_and_swap(&entry->h2AndResult,
+                                                  old, h2AndResult);
+      if (prev == old)
+        return;
+      old = prev;
+      if (old && (old & ~RESULT_MASK) != (h.h2 & ~RESULT_MASK))
+        return;
+    }
+  }
+}
+
+bool PersistentCachingSolver::computeValidity(const Query& query,
+                                              Solver::Validity &result) {
+  IncompleteSolver::PartialValidity cachedResult;
+  bool tmp, cacheHit = cacheLookup(query, cachedResult);
+
+  if (cacheHit) {
+    switch(cachedResult) {
+    case IncompleteSolver::MustBeTrue:
+      ++stats::persistentCacheHits;
+      result = Solver::True;
+      return true;
+    case IncompleteSolver::MustBeFalse:
+      ++stats::persistentCacheHits;
+      result = Solver::False;
+      return true;
+    case IncompleteSolver::TrueOrFalse:
+      ++stats::persistentCacheHits;
+      result = Solver::Unknown;
+      return true;
+    case IncompleteSolver::MayBeTrue: {
+      if (!solver->impl->computeTruth(query, tmp))
+        return false;
+      cachedResult = tmp ? IncompleteSolver::MustBeTrue :
+                           IncompleteSolver::TrueOrFalse;
+      cacheInsert(query, cachedResult);
+      result = tmp ? Solver::True : Solver::Unknown;
+      return true;
+    }
+    case IncompleteSolver::MayBeFalse: {
+      if (!solver->impl->computeTruth(query.negateExpr(), tmp))
+        return false;
+      cachedResult = tmp ? IncompleteSolver::MustBeFalse :
+                           IncompleteSolver::TrueOrFalse;
+      cacheInsert(query, cachedResult);
+      result = tmp ? Solver::False : Solver::Unknown;
+      return true;
+    }
+    default: assert(0 && "unreachable");
+    }
+  }
+
+  ++stats::persistentCacheMisses;
+
+  if (!solver->impl->computeValidity(query, result))
+    return false;
+
+  switch (result) {
+  case Solver::True:
+    cachedResult = IncompleteSolver::MustBeTrue; break;
+  case Solver::False:
+    cachedResult = IncompleteSolver::MustBeFalse; break;
+  default:
+    cachedResult = IncompleteSolver::TrueOrFalse; break;
+  }
+
+  cacheInsert(query, cachedResult);
+  return true;
+}
+
+bool PersistentCachingSolver::computeTruth(const Query& query,
+                                           bool &isValid) {
+  IncompleteSolver::PartialValidity cachedResult;
+  bool cacheHit = cacheLookup(query, cachedResult);
+
+  // a cached result of MayBeTrue forces us to check whether
+  // a False assignment exists.
+  if (cacheHit && cachedResult != IncompleteSolver::MayBeTrue) {
+    ++stats::persistentCacheHits;
+    isValid = (cachedResult == IncompleteSolver::MustBeTrue);
+    return true;
+  }
+
+  ++stats::persistentCacheMisses;
+
+  // cache miss: query solver
+  if (!solver->impl->computeTruth(query, isValid))
+    return false;
+
+  if (isValid) {
+    cachedResult = IncompleteSolver::MustBeTrue;
+  } else if (cacheHit) {
+    // We know a true assignment exists, and query isn't valid, so
+    // must be TrueOrFalse.
+    assert(cachedResult == IncompleteSolver::MayBeTrue);
+    cachedResult = IncompleteSolver::TrueOrFalse;
+  } else {
+    cachedResult = IncompleteSolver::MayBeFalse;
+  }
+
+  cacheInsert(query, cachedResult);
+  return true;
+}
+
+///
+
+Solver *klee::createPersistentCachingSolver(Solver *_solver,
+                                            std::string path,
+                                            uint64_t capacity) {
+  return new Solver(new PersistentCachingSolver(_solver, path, capacity));
+}
@@ -46,6 +46,12 @@ namespace {
   llvm::cl::opt<bool>
   ReinstantiateSolver("reinstantiate-solver",
                       llvm::cl::init(false));
+
+  llvm::cl::opt<bool>
+  IncrementalSTP("stp-incremental",
+                 llvm::cl::desc("Keep the path constraints asserted in STP "
+                                "between queries and only assert the new ones"),
+                 llvm::cl::init(false));
 }
 
 /***/
@@ -509,11 +515,23 @@ private:
   STPBuilder *builder;
   double timeout;
   bool useForkedSTP;
+  unsigned portfolioSize;
+
+  /// Constraints currently asserted in vc (incremental mode only), and the
+  /// index in assertedConstraints at which each pushed scope ends.
+  std::vector< ref<Expr> > assertedConstraints;
+  std::vector<unsigned> assertedScopes;
 
   void reinstantiate();
 
+  /// Assert the constraints of a query in a new solver scope.
+  /// popConstraints() must be called when the query is done.
+  void pushConstraints(const ConstraintManager &constraints);
+  void popConstraints();
+
 public:
-  STPSolverImpl(STPSolver *_solver, bool _useForkedSTP);
+  STPSolverImpl(STPSolver *_solver, bool _useForkedSTP,
+                unsigned _portfolioSize);
   ~STPSolverImpl();
 
   char *getConstraintLog(const Query&);
@@ -531,17 +549,29 @@ static unsigned char *shared_memory_ptr;
 static const unsigned shared_memory_size = 1<<20;
 static int shared_memory_id;
 
+/// Number of distinct STP configurations raced by the portfolio mode.
+/// Larger portfolios are capped to this count, since extra members
+/// would only duplicate the work of others.
+#ifdef HAVE_EXT_STP
+static const unsigned portfolio_configurations = 6;
+#else
+static const unsigned portfolio_configurations = 3;
+#endif
+
 static void stp_error_handler(const char* err_msg) {
   fprintf(stderr, "error: STP Error: %s\n", err_msg);
   exit(-1);
 }
 
-STPSolverImpl::STPSolverImpl(STPSolver *_solver, bool _useForkedSTP)
+STPSolverImpl::STPSolverImpl(STPSolver *_solver, bool _useForkedSTP,
+                             unsigned _portfolioSize)
   : solver(_solver),
     vc(vc_createValidityChecker()),
     builder(new STPBuilder(vc)),
     timeout(0.0),
-    useForkedSTP(_useForkedSTP)
+    useForkedSTP(_useForkedSTP),
+    portfolioSize(_portfolioSize > 1 ?
+                  std::min(_portfolioSize, portfolio_configurations) : 0)
 {
   assert(vc && "unable to create validity checker");
   assert(builder && "unable to create STPBuilder");
@@ -552,11 +582,14 @@ STPSolverImpl::STPSolverImpl(STPSolver *_solver, bool _useForkedSTP)
 
   vc_registerErrorHandler(::stp_error_handler);
 
-  if (useForkedSTP) {
+  if (useForkedSTP || portfolioSize) {
 #ifdef __MINGW32__
     assert(false && "Cannot use forked stp solver on Windows");
 #else
-    shared_memory_id = shmget(IPC_PRIVATE, shared_memory_size, IPC_CREAT | 0700);
+    // The portfolio mode gives each member its own counterexample area
+    unsigned slots = portfolioSize ? portfolioSize : 1;
+    shared_memory_id = shmget(IPC_PRIVATE, shared_memory_size * slots,
+                              IPC_CREAT | 0700);
     assert(shared_memory_id>=0 && "shmget failed");
     shared_memory_ptr = (unsigned char*) shmat(shared_memory_id, NULL, 0);
     assert(shared_memory_ptr!=(void*)-1 && "shmat failed");
@@ -586,13 +619,64 @@ void STPSolverImpl::reinstantiate()
         #endif
 
         vc_registerErrorHandler(::stp_error_handler);
+
+        assertedConstraints.clear();
+        assertedScopes.clear();
+    }
+}
+
+void STPSolverImpl::pushConstraints(const ConstraintManager &constraints)
+{
+    if (!IncrementalSTP) {
+        vc_push(vc);
+        for (ConstraintManager::const_iterator it = constraints.begin(),
+             ie = constraints.end(); it != ie; ++it)
+            vc_assertFormula(vc, builder->construct(*it));
+        return;
+    }
+
+    // Consecutive queries usually come from the same path and share most
+    // of their constraints. Keep the longest common prefix asserted.
+    unsigned common = 0;
+    ConstraintManager::const_iterator it = constraints.begin(),
+                                      ie = constraints.end();
+    while (common < assertedConstraints.size() && it != ie &&
+           assertedConstraints[common] == *it) {
+        ++common;
+        ++it;
+    }
+
+    // Scopes can only be popped as a whole
+    while (!assertedScopes.empty() && assertedScopes.back() > common) {
+        vc_pop(vc);
+        assertedScopes.pop_back();
     }
+
+    unsigned kept = assertedScopes.empty() ? 0 : assertedScopes.back();
+    assertedConstraints.resize(kept);
+
+    if (kept < constraints.size()) {
+        vc_push(vc);
+        for (it = constraints.begin() + kept; it != ie; ++it) {
+            vc_assertFormula(vc, builder->construct(*it));
+            assertedConstraints.push_back(*it);
+        }
+        assertedScopes.push_back(assertedConstraints.size());
+    }
+
+    // Scope for the query itself
+    vc_push(vc);
+}
+
+void STPSolverImpl::popConstraints()
+{
+    vc_pop(vc);
 }
 
 /***/
 
-STPSolver::STPSolver(bool useForkedSTP)
-  : Solver(new STPSolverImpl(this, useForkedSTP))
+STPSolver::STPSolver(bool useForkedSTP, unsigned portfolioSize)
+  : Solver(new STPSolverImpl(this, useForkedSTP, portfolioSize))
 {
 }
 
@@ -607,10 +691,7 @@ void STPSolver::setTimeout(double timeout) {
 /***/
 
 char *STPSolverImpl::getConstraintLog(const Query &query) {
-  vc_push(vc);
-  for (std::vector< ref<Expr> >::const_iterator it = query.constraints.begin(),
-         ie = query.constraints.end(); it != ie; ++it)
-    vc_assertFormula(vc, builder->construct(*it));
+  pushConstraints(query.constraints);
   assert(query.expr == ConstantExpr::alloc(0, Expr::Bool) &&
          "Unexpected expression in query!");
 
@@ -618,7 +699,7 @@ char *STPSolverImpl::getConstraintLog(const Query &query) {
   unsigned long length;
   vc_printQueryStateToBuffer(vc, builder->getFalse(),
                              &buffer, &length, false);
-  vc_pop(vc);
+  popConstraints();
 
   return buffer;
 }
@@ -817,6 +898,168 @@ static bool runAndGetCexForked(::VC vc,
   }
 #endif
 }
+
+/// Tune the (forked copy of the) validity checker of a portfolio member.
+/// The configurations differ in the SAT solver backend and in the
+/// word-level preprocessing, which is where STP running times diverge
+/// the most on our queries.
+static void configurePortfolioMember(::VC vc, unsigned index) {
+  assert(index < portfolio_configurations);
+  switch (index) {
+  default:
+  case 0: /* Default settings */ break;
+#ifdef HAVE_EXT_STP
+  case 1: vc_setInterfaceFlags(vc, SMS, 0); break;
+  case 2: vc_setFlags(vc, 'w', 0); break;
+  case 3: vc_setInterfaceFlags(vc, CMS2, 0); break;
+  case 4: vc_setInterfaceFlags(vc, MS, 0); vc_setFlags(vc, 'r', 0); break;
+  case 5: vc_setInterfaceFlags(vc, SMS, 0); vc_setFlags(vc, 'a', 0); break;
+#else
+  case 1: vc_setFlags(vc, 'w', 0); break;
+  case 2: vc_setFlags(vc, 'a', 0); break;
+#endif
+  }
+}
+
+/// Races portfolioSize differently configured copies of STP on the same
+/// query and takes the answer of the first one that finishes. STP is not
+/// thread-safe, so each member is a forked copy of the validity checker
+/// (which already contains the asserted constraints). Members report
+/// completion through a pipe, which lets us wait only for our own children.
+static bool runAndGetCexPortfolio(::VC vc,
+                                  STPBuilder *builder,
+                                  ::VCExpr q,
+                                  const std::vector<const Array*> &objects,
+                                  std::vector< std::vector<unsigned char> >
+                                    &values,
+                                  bool &hasSolution,
+                                  double timeout,
+                                  unsigned portfolioSize) {
+#ifdef __MINGW32__
+  assert(false && "Cannot run runAndGetCexPortfolio on Windows");
+  return false;
+#else
+
+  unsigned sum = 0;
+  for (std::vector<const Array*>::const_iterator
+         it = objects.begin(), ie = objects.end(); it != ie; ++it)
+    sum += (*it)->size;
+  assert(sum<shared_memory_size && "not enough shared memory for counterexample");
+
+  int fds[2];
+  if (pipe(fds) < 0) {
+    perror("pipe()");
+    return false;
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+
+  sigset_t sig_mask, sig_mask_old;
+  sigfillset(&sig_mask);
+  sigemptyset(&sig_mask_old);
+  sigprocmask(SIG_SETMASK, &sig_mask, &sig_mask_old);
+
+  std::vector<pid_t> pids;
+  for (unsigned i = 0; i < portfolioSize; ++i) {
+    pid_t pid = fork();
+    if (pid == -1) {
+      fprintf(stderr, "error: fork failed (for STP portfolio member %u)\n", i);
+      break;
+    }
+
+    if (pid == 0) {
+      close(fds[0]);
+      sigprocmask(SIG_SETMASK, &sig_mask_old, NULL);
+      if (timeout) {
+        ::alarm(0); /* Turn off alarm so we can safely set signal handler */
+        ::signal(SIGALRM, stpTimeoutHandler);
+        ::alarm(std::max(1, (int)timeout));
+      }
+
+      configurePortfolioMember(vc, i);
+
+      unsigned char *pos = shared_memory_ptr + i * shared_memory_size;
+      int res = vc_query(vc, q);
+      if (res < 0)
+        _exit(res);
+
+      if (!res) {
+        for (std::vector<const Array*>::const_iterator
+               it = objects.begin(), ie = objects.end(); it != ie; ++it) {
+          const Array *array = *it;
+          for (unsigned offset = 0; offset < array->size; offset++) {
+            ExprHandle counter =
+              vc_getCounterExample(vc, builder->getInitialRead(array, offset));
+            *pos++ = getBVUnsigned(counter);
+          }
+        }
+      }
+
+      uint32_t answer = (i << 1) | (res ? 1 : 0);
+      ssize_t written;
+      do {
+        written = write(fds[1], &answer, sizeof(answer));
+      } while (written < 0 && errno == EINTR);
+      _exit(res);
+    }
+
+    pids.push_back(pid);
+  }
+
+  // Only the children hold the write end now: reading EOF means that all of
+  // them exited without an answer (timeout or STP failure).
+  close(fds[1]);
+
+  uint32_t answer;
+  ssize_t got;
+  do {
+    got = read(fds[0], &answer, sizeof(answer));
+  } while (got < 0 && errno == EINTR);
+  close(fds[0]);
+
+  for (unsigned i = 0; i < pids.size(); ++i) {
+    kill(pids[i], SIGKILL);
+  }
+
+  for (unsigned i = 0; i < pids.size(); ++i) {
+    pid_t res;
+    do {
+      res = waitpid(pids[i], NULL, 0);
+    } while (res < 0 && errno == EINTR);
+  }
+
+  sigprocmask(SIG_SETMASK, &sig_mask_old, NULL);
+
+  if (got != sizeof(answer)) {
+    if (pids.empty()) {
+      fprintf(stderr, "error: could not start any STP portfolio member\n");
+    } else {
+      fprintf(stderr, "error: STP portfolio failed or timed out\n");
+    }
+    return false;
+  }
+
+  unsigned winner = answer >> 1;
+  hasSolution = !(answer & 1);
+
+  if (hasSolution) {
+    unsigned char *pos = shared_memory_ptr + winner * shared_memory_size;
+    values = std::vector< std::vector<unsigned char> >(objects.size());
+    unsigned i=0;
+    for (std::vector<const Array*>::const_iterator
+           it = objects.begin(), ie = objects.end(); it != ie; ++it) {
+      const Array *array = *it;
+      std::vector<unsigned char> &data = values[i++];
+      data.insert(data.begin(), pos, pos + array->size);
+      pos += array->size;
+    }
+  }
+
+  return true;
+#endif
+}
+
 static bool __stp_printstate = true;
 extern llvm::raw_ostream *g_solverLog;
 
@@ -831,11 +1074,7 @@ STPSolverImpl::computeInitialValues(const Query &query,
 
   reinstantiate();
 
-  vc_push(vc);
-
-  for (ConstraintManager::const_iterator it = query.constraints.begin(),
-         ie = query.constraints.end(); it != ie; ++it)
-    vc_assertFormula(vc, builder->construct(*it));
+  pushConstraints(query.constraints);
 
   ++stats::queries;
   ++stats::queryCounterexamples;
@@ -856,7 +1095,10 @@ STPSolverImpl::computeInitialValues(const Query &query,
   }
 
   bool success;
-  if (useForkedSTP) {
+  if (portfolioSize) {
+    success = runAndGetCexPortfolio(vc, builder, stp_e, objects, values,
+                                    hasSolution, timeout, portfolioSize);
+  } else if (useForkedSTP) {
     success = runAndGetCexForked(vc, builder, stp_e, objects, values,
                                  hasSolution, timeout);
   } else {
@@ -866,7 +1108,7 @@ STPSolverImpl::computeInitialValues(const Query &query,
     } catch(std::exception &) {
         klee::klee_warning("STP solver threw an exception");
         exit(-1);
-        vc_pop(vc);
+        popConstraints();
         reinstantiate();
         success = false;
         return success;
@@ -880,7 +1122,7 @@ STPSolverImpl::computeInitialValues(const Query &query,
       ++stats::queriesValid;
   }
 
-  vc_pop(vc);
+  popConstraints();
 
 
   return success;
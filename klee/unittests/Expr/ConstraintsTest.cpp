@@ -0,0 +1,286 @@
+//===-- ConstraintsTest.cpp -----------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "klee/Constraints.h"
+#include "klee/Expr.h"
+#include "klee/util/ExprUtil.h"
+
+using namespace klee;
+
+namespace {
+
+const unsigned ArraySize = 8;
+
+// The array elements read by an expression, as computed by the
+// independence fixpoint that ConstraintManager replaced
+class ElementSet {
+  std::map<const Array*, std::set<unsigned> > bytes;
+  std::set<const Array*> wholeObjects;
+
+public:
+  explicit ElementSet(ref<Expr> e) {
+    std::vector< ref<ReadExpr> > reads;
+    findReads(e, /* visitUpdates= */ true, reads);
+    for (unsigned i = 0; i != reads.size(); ++i) {
+      ReadExpr *re = reads[i].get();
+      const Array *array = re->updates.root;
+      if (array->isConstantArray() && !re->updates.head)
+        continue;
+      if (wholeObjects.count(array))
+        continue;
+      if (ConstantExpr *CE = dyn_cast<ConstantExpr>(re->index)) {
+        bytes[array].insert((unsigned) CE->getZExtValue(32));
+      } else {
+        bytes.erase(array);
+        wholeObjects.insert(array);
+      }
+    }
+  }
+
+  bool intersects(const ElementSet &b) const {
+    for (std::set<const Array*>::const_iterator it = wholeObjects.begin(),
+           ie = wholeObjects.end(); it != ie; ++it)
+      if (b.wholeObjects.count(*it) || b.bytes.count(*it))
+        return true;
+    for (std::map<const Array*, std::set<unsigned> >::const_iterator
+           it = bytes.begin(), ie = bytes.end(); it != ie; ++it) {
+      if (b.wholeObjects.count(it->first))
+        return true;
+      std::map<const Array*, std::set<unsigned> >::const_iterator it2 =
+        b.bytes.find(it->first);
+      if (it2 == b.bytes.end())
+        continue;
+      for (std::set<unsigned>::const_iterator bi = it->second.begin(),
+             be = it->second.end(); bi != be; ++bi)
+        if (it2->second.count(*bi))
+          return true;
+    }
+    return false;
+  }
+
+  // returns true iff the set is changed by the addition
+  bool add(const ElementSet &b) {
+    bool modified = false;
+    for (std::set<const Array*>::const_iterator it = b.wholeObjects.begin(),
+           ie = b.wholeObjects.end(); it != ie; ++it) {
+      if (wholeObjects.insert(*it).second)
+        modified = true;
+      bytes.erase(*it);
+    }
+    for (std::map<const Array*, std::set<unsigned> >::const_iterator
+           it = b.bytes.begin(), ie = b.bytes.end(); it != ie; ++it) {
+      if (wholeObjects.count(it->first))
+        continue;
+      std::set<unsigned> &dst = bytes[it->first];
+      size_t size = dst.size();
+      dst.insert(it->second.begin(), it->second.end());
+      if (dst.size() != size)
+        modified = true;
+    }
+    return modified;
+  }
+};
+
+void getIndependentConstraintsFixpoint(const ConstraintManager &cm,
+                                       ref<Expr> e,
+                                       std::vector< ref<Expr> > &result) {
+  ElementSet closure(e);
+  std::vector< std::pair<ref<Expr>, ElementSet> > worklist;
+  for (ConstraintManager::const_iterator it = cm.begin(), ie = cm.end();
+       it != ie; ++it)
+    worklist.push_back(std::make_pair(*it, ElementSet(*it)));
+
+  bool done;
+  do {
+    done = true;
+    std::vector< std::pair<ref<Expr>, ElementSet> > newWorklist;
+    for (unsigned i = 0; i < worklist.size(); ++i) {
+      if (worklist[i].second.intersects(closure)) {
+        if (closure.add(worklist[i].second))
+          done = false;
+        result.push_back(worklist[i].first);
+      } else {
+        newWorklist.push_back(worklist[i]);
+      }
+    }
+    worklist.swap(newWorklist);
+  } while (!done);
+}
+
+// Deterministic generator, so that failures can be reproduced
+class Random {
+  uint64_t state;
+
+public:
+  explicit Random(uint64_t seed) : state(seed) {}
+
+  unsigned next(unsigned bound) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned) (state >> 33) % bound;
+  }
+};
+
+ref<Expr> readByte(const Array *array, unsigned index) {
+  return ReadExpr::create(UpdateList(array, 0),
+                          ConstantExpr::alloc(index, Expr::Int32));
+}
+
+class ConstraintGenerator {
+  Random rng;
+  std::vector<const Array*> arrays;
+
+  ref<Expr> randomRead() {
+    const Array *array = arrays[rng.next(arrays.size())];
+    // Reads at a symbolic index depend on the whole array
+    if (rng.next(8) == 0) {
+      const Array *indexArray = arrays[rng.next(arrays.size())];
+      ref<Expr> index = ZExtExpr::create(readByte(indexArray,
+                                                  rng.next(ArraySize)),
+                                         Expr::Int32);
+      return ReadExpr::create(UpdateList(array, 0), index);
+    }
+    return readByte(array, rng.next(ArraySize));
+  }
+
+public:
+  ConstraintGenerator(uint64_t seed, unsigned arrayCount) : rng(seed) {
+    for (unsigned i = 0; i < arrayCount; ++i) {
+      char name[16];
+      snprintf(name, sizeof(name), "arr%u", i);
+      arrays.push_back(new Array(name, ArraySize));
+    }
+  }
+
+  // Always true once all its reads are concrete, so that rewriting it
+  // with equalities cannot produce a false constraint
+  ref<Expr> randomConstraint() {
+    ref<Expr> sum = randomRead();
+    for (unsigned i = rng.next(3); i > 0; --i)
+      sum = AddExpr::create(sum, randomRead());
+    return UleExpr::create(ZExtExpr::create(sum, Expr::Int16),
+                           ConstantExpr::alloc(300, Expr::Int16));
+  }
+
+  ref<Expr> randomEquality() {
+    const Array *array = arrays[rng.next(arrays.size())];
+    return EqExpr::create(ConstantExpr::alloc(rng.next(256), Expr::Int8),
+                          readByte(array, rng.next(ArraySize)));
+  }
+
+  bool chance(unsigned n) {
+    return rng.next(n) == 0;
+  }
+};
+
+// Checks that result lists constraints of cm in their original order
+bool isOrderedSubset(const ConstraintManager &cm,
+                     const std::vector< ref<Expr> > &result) {
+  ConstraintManager::const_iterator it = cm.begin(), ie = cm.end();
+  for (unsigned i = 0; i < result.size(); ++i) {
+    while (it != ie && *it != result[i])
+      ++it;
+    if (it == ie)
+      return false;
+    ++it;
+  }
+  return true;
+}
+
+void checkRandomConstraintSets(bool rewrites) {
+  for (unsigned seed = 1; seed <= 50; ++seed) {
+    ConstraintGenerator gen(seed, 1 + seed % 6);
+    ConstraintManager cm;
+
+    for (unsigned i = 0; i < 60; ++i) {
+      ref<Expr> e = rewrites && gen.chance(4) ? gen.randomEquality()
+                                              : gen.randomConstraint();
+      if (isa<ConstantExpr>(cm.simplifyExpr(e)))
+        continue;
+      cm.addConstraint(e);
+
+      // Adding to a copy must not affect the original
+      ConstraintManager copy(cm);
+      copy.addConstraint(gen.randomConstraint());
+
+      ref<Expr> query = gen.randomConstraint();
+      std::vector< ref<Expr> > actual, expected;
+      cm.getIndependentConstraints(query, actual);
+      getIndependentConstraintsFixpoint(cm, query, expected);
+
+      ASSERT_TRUE(isOrderedSubset(cm, actual)) << "seed " << seed;
+      std::sort(actual.begin(), actual.end());
+      std::sort(expected.begin(), expected.end());
+      if (rewrites) {
+        // Rewritten constraints keep their partition
+        ASSERT_TRUE(std::includes(actual.begin(), actual.end(),
+                                  expected.begin(), expected.end()))
+          << "seed " << seed;
+      } else {
+        ASSERT_EQ(expected, actual) << "seed " << seed;
+      }
+    }
+  }
+}
+
+TEST(ConstraintsTest, IndependenceMatchesFixpoint) {
+  checkRandomConstraintSets(false);
+}
+
+TEST(ConstraintsTest, IndependenceWithRewrites) {
+  checkRandomConstraintSets(true);
+}
+
+TEST(ConstraintsTest, WholeArrayReads) {
+  Array *a = new Array("wa", ArraySize);
+  Array *b = new Array("wb", ArraySize);
+  ref<Expr> c300 = ConstantExpr::alloc(300, Expr::Int16);
+
+  // a[b[0]] reads the whole of a
+  ref<Expr> symbolicRead =
+    ReadExpr::create(UpdateList(a, 0),
+                     ZExtExpr::create(readByte(b, 0), Expr::Int32));
+  ref<Expr> c1 = UleExpr::create(ZExtExpr::create(symbolicRead, Expr::Int16),
+                                 c300);
+  ref<Expr> c2 = UleExpr::create(ZExtExpr::create(readByte(a, 3), Expr::Int16),
+                                 c300);
+  ref<Expr> c3 = UleExpr::create(ZExtExpr::create(readByte(b, 1), Expr::Int16),
+                                 c300);
+
+  ConstraintManager cm;
+  cm.addConstraint(c2);
+  cm.addConstraint(c3);
+  cm.addConstraint(c1);
+
+  std::vector< ref<Expr> > result;
+  cm.getIndependentConstraints(readByte(a, 5), result);
+  ASSERT_EQ(2U, result.size());
+  EXPECT_EQ(c2, result[0]);
+  EXPECT_EQ(c1, result[1]);
+
+  result.clear();
+  cm.getIndependentConstraints(readByte(b, 1), result);
+  ASSERT_EQ(1U, result.size());
+  EXPECT_EQ(c3, result[0]);
+
+  // A query that reads the whole of b depends on all of its bytes
+  result.clear();
+  cm.getIndependentConstraints(
+    ReadExpr::create(UpdateList(b, 0),
+                     ZExtExpr::create(readByte(a, 7), Expr::Int32)), result);
+  EXPECT_EQ(3U, result.size());
+}
+
+}
@@ -8,11 +8,17 @@
 //===----------------------------------------------------------------------===//
 
 #include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "gtest/gtest.h"
 
 #include "klee/Constraints.h"
 #include "klee/Expr.h"
 #include "klee/Solver.h"
+#include "klee/SolverImpl.h"
 #include "llvm/ADT/StringExtras.h"
 
 using namespace klee;
@@ -163,4 +169,168 @@ TEST(SolverTest, Evaluation) {
   delete solver;
 }
 
+// Answers every query with a fixed validity and counts the queries that
+// reach it. If concurrent is set, it is queried first, as if another
+// process stored a result in the meantime.
+class ScriptedSolver : public SolverImpl {
+public:
+  Solver::Validity answer;
+  Solver *concurrent;
+  unsigned queries;
+
+  ScriptedSolver(Solver::Validity _answer)
+    : answer(_answer), concurrent(0), queries(0) {}
+
+  bool computeValidity(const Query& query, Solver::Validity &result) {
+    ++queries;
+    result = answer;
+    return true;
+  }
+
+  bool computeTruth(const Query& query, bool &isValid) {
+    ++queries;
+    if (concurrent) {
+      Solver::Validity result;
+      concurrent->evaluate(query, result);
+    }
+    isValid = answer == Solver::True;
+    return true;
+  }
+
+  bool computeValue(const Query& query, ref<Expr> &result) {
+    return false;
+  }
+
+  bool computeInitialValues(const Query& query,
+                            const std::vector<const Array*> &objects,
+                            std::vector< std::vector<unsigned char> > &values,
+                            bool &hasSolution) {
+    return false;
+  }
+};
+
+class PersistentCacheTest : public ::testing::Test {
+protected:
+  std::string path;
+  ConstraintManager constraints;
+  ref<Expr> expr;
+
+  void SetUp() {
+    char name[] = "/tmp/klee-solver-cache-XXXXXX";
+    int fd = mkstemp(name);
+    ASSERT_LE(0, fd);
+    close(fd);
+    path = name;
+
+    Array *array = new Array("pcache", 1);
+    expr = EqExpr::create(Expr::createTempRead(array, Expr::Int8),
+                          ConstantExpr::create(42, Expr::Int8));
+  }
+
+  void TearDown() {
+    unlink(path.c_str());
+  }
+
+  Solver *createSolver(ScriptedSolver *scripted, uint64_t capacity = 64) {
+    return createPersistentCachingSolver(new Solver(scripted), path, capacity);
+  }
+
+  off_t getFileSize() {
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0)
+      return -1;
+    return st.st_size;
+  }
+
+  // The file must be ignored: every query goes to the underlying solver
+  // and the file is left as is.
+  void checkRejected() {
+    off_t size = getFileSize();
+    ScriptedSolver *scripted = new ScriptedSolver(Solver::False);
+    Solver *solver = createSolver(scripted);
+
+    for (unsigned i = 0; i < 2; ++i) {
+      Solver::Validity result;
+      ASSERT_TRUE(solver->evaluate(Query(constraints, expr), result));
+      EXPECT_EQ(Solver::False, result);
+    }
+    EXPECT_EQ(2U, scripted->queries);
+
+    delete solver;
+    EXPECT_EQ(size, getFileSize());
+  }
+};
+
+TEST_F(PersistentCacheTest, ReloadAcrossInstances) {
+  ScriptedSolver *first = new ScriptedSolver(Solver::True);
+  Solver *solver = createSolver(first);
+  Solver::Validity result;
+  ASSERT_TRUE(solver->evaluate(Query(constraints, expr), result));
+  EXPECT_EQ(Solver::True, result);
+  EXPECT_EQ(1U, first->queries);
+  delete solver;
+
+  // A contradicting answer shows whether the second instance asked
+  ScriptedSolver *second = new ScriptedSolver(Solver::False);
+  solver = createSolver(second);
+  ASSERT_TRUE(solver->evaluate(Query(constraints, expr), result));
+  EXPECT_EQ(Solver::True, result);
+
+  // The negated query maps to the same entry
+  bool isTrue;
+  ASSERT_TRUE(solver->mustBeTrue(Query(constraints,
+                                       Expr::createIsZero(expr)), isTrue));
+  EXPECT_FALSE(isTrue);
+  EXPECT_EQ(0U, second->queries);
+  delete solver;
+}
+
+TEST_F(PersistentCacheTest, CompleteResultNotReplacedByPartial) {
+  ScriptedSolver *complete = new ScriptedSolver(Solver::False);
+  Solver *completeSolver = createSolver(complete);
+
+  // The second instance misses, then the first one stores False before
+  // the second one stores the less precise MayBeFalse.
+  ScriptedSolver *partial = new ScriptedSolver(Solver::False);
+  partial->concurrent = completeSolver;
+  Solver *partialSolver = createSolver(partial);
+  bool isTrue;
+  ASSERT_TRUE(partialSolver->mustBeTrue(Query(constraints, expr), isTrue));
+  EXPECT_FALSE(isTrue);
+  EXPECT_EQ(1U, complete->queries);
+  EXPECT_EQ(1U, partial->queries);
+  delete partialSolver;
+  delete completeSolver;
+
+  ScriptedSolver *scripted = new ScriptedSolver(Solver::Unknown);
+  Solver *solver = createSolver(scripted);
+  Solver::Validity result;
+  ASSERT_TRUE(solver->evaluate(Query(constraints, expr), result));
+  EXPECT_EQ(Solver::False, result);
+  EXPECT_EQ(0U, scripted->queries);
+  delete solver;
+}
+
+TEST_F(PersistentCacheTest, RejectTruncatedFile) {
+  ScriptedSolver *scripted = new ScriptedSolver(Solver::True);
+  delete createSolver(scripted);
+
+  off_t size = getFileSize();
+  ASSERT_LT(0, size);
+  ASSERT_EQ(0, truncate(path.c_str(), size / 2));
+  checkRejected();
+}
+
+TEST_F(PersistentCacheTest, RejectCorruptFile) {
+  ScriptedSolver *scripted = new ScriptedSolver(Solver::True);
+  delete createSolver(scripted);
+
+  FILE *f = fopen(path.c_str(), "r+");
+  ASSERT_TRUE(f != NULL);
+  const char garbage[] = "garbage!";
+  ASSERT_EQ(1U, fwrite(garbage, sizeof(garbage) - 1, 1, f));
+  fclose(f);
+  checkRejected();
+}
+
 }
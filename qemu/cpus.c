@@ -754,6 +754,15 @@ static void qemu_tcg_wait_io_event(void)
         /* Start accounting real time to the virtual clock if the CPUs
           are idle.  */
         qemu_clock_warp(vm_clock);
+#ifdef CONFIG_S2E
+        /* Use idle time to generate LLVM code for hot TBs, one TB
+           at a time to let the I/O thread wake us up in between */
+        if (s2e_translate_speculative_tb(g_s2e)) {
+            qemu_mutex_unlock(&qemu_global_mutex);
+            qemu_mutex_lock(&qemu_global_mutex);
+            continue;
+        }
+#endif
         qemu_cond_wait(tcg_halt_cond, &qemu_global_mutex);
     }
 
@@ -101,6 +101,7 @@ void restore_state_to_opc(CPUArchState *env, struct TranslationBlock *tb,
 
 #ifdef CONFIG_S2E
 int cpu_gen_llvm(CPUArchState *env, TranslationBlock *tb);
+int cpu_gen_llvm_speculative(CPUArchState *env, TranslationBlock *tb);
 #endif
 
 
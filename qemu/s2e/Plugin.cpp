@@ -47,6 +47,8 @@ using namespace std;
 
 CompiledPlugin::CompiledPlugins* CompiledPlugin::s_compiledPlugins = NULL;
 
+unsigned Plugin::s_PluginStateSlots = 0;
+
 void Plugin::initialize()
 {
 }
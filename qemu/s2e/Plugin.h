@@ -53,13 +53,17 @@ class S2EExecutionState;
 class Plugin : public sigc::trackable{
 private:
     S2E* m_s2e;
+
+    /** Index of the plugin state in the per-state storage */
+    unsigned m_PluginStateSlot;
+    static unsigned s_PluginStateSlots;
 protected:
     mutable PluginState *m_CachedPluginState;
     mutable S2EExecutionState *m_CachedPluginS2EState;
 
 public:
-    Plugin(S2E* s2e) : m_s2e(s2e),m_CachedPluginState(NULL),
-        m_CachedPluginS2EState(NULL) {}
+    Plugin(S2E* s2e) : m_s2e(s2e), m_PluginStateSlot(s_PluginStateSlots++),
+        m_CachedPluginState(NULL), m_CachedPluginS2EState(NULL) {}
 
     virtual ~Plugin() {}
 
@@ -79,6 +83,8 @@ public:
 
     PluginState *getPluginState(S2EExecutionState *s, PluginState* (*f)(Plugin *, S2EExecutionState *)) const;
 
+    unsigned getPluginStateSlot() const { return m_PluginStateSlot; }
+
     void refresh() {
         m_CachedPluginS2EState = NULL;
         m_CachedPluginState = NULL;
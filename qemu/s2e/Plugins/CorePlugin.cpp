@@ -107,6 +107,37 @@ void s2e_tcg_execution_handler(void* signal, uint64_t pc)
     }
 }
 
+#ifdef S2E_USE_FAST_SIGNALS
+/* Specialized handlers for signals with one or two subscribers.
+   The generated code passes the functors directly, which avoids
+   walking the functor array of the signal on every execution. */
+void s2e_tcg_execution_handler1(void* functor, uint64_t pc)
+{
+    try {
+        ExecutionSignal::func_t f = (ExecutionSignal::func_t) functor;
+        if (g_s2e_enable_signals) {
+            (*f)(g_s2e_state, pc);
+        }
+    } catch(s2e::CpuExitException&) {
+        s2e_longjmp(env->jmp_env, 1);
+    }
+}
+
+void s2e_tcg_execution_handler2(void* functor1, void* functor2, uint64_t pc)
+{
+    try {
+        ExecutionSignal::func_t f1 = (ExecutionSignal::func_t) functor1;
+        ExecutionSignal::func_t f2 = (ExecutionSignal::func_t) functor2;
+        if (g_s2e_enable_signals) {
+            (*f1)(g_s2e_state, pc);
+            (*f2)(g_s2e_state, pc);
+        }
+    } catch(s2e::CpuExitException&) {
+        s2e_longjmp(env->jmp_env, 1);
+    }
+}
+#endif
+
 void s2e_tcg_custom_instruction_handler(uint64_t arg)
 {
     assert(!g_s2e->getCorePlugin()->onCustomInstruction.empty() &&
@@ -159,23 +190,49 @@ static void s2e_tcg_instrument_code(S2E*, ExecutionSignal* signal, uint64_t pc,
     }
 
     // XXX: here we rely on CPUState being the first tcg global temp
-    TCGArg args[2];
-    args[0] = GET_TCGV_PTR(t0);
-    args[1] = GET_TCGV_I64(t1);
+    TCGArg args[3];
+    void *handler = (void*) s2e_tcg_execution_handler;
+    unsigned nptrs = 1;
+    tcg_target_ulong ptrs[2] = { (tcg_target_ulong) signal, 0 };
+
+#ifdef S2E_USE_FAST_SIGNALS
+    /* The signals of a translation block live as long as the block and
+       nobody disconnects from them, so the functors can be baked into
+       the helper call when there are only one or two of them. */
+    ExecutionSignal::func_t funcs[2];
+    unsigned count = signal->getFunctors(funcs, 2);
+    if (count == 1) {
+        handler = (void*) s2e_tcg_execution_handler1;
+        ptrs[0] = (tcg_target_ulong) funcs[0];
+    } else if (count == 2) {
+        handler = (void*) s2e_tcg_execution_handler2;
+        ptrs[0] = (tcg_target_ulong) funcs[0];
+        ptrs[1] = (tcg_target_ulong) funcs[1];
+        nptrs = 2;
+    }
+#endif
 
+    TCGv_ptr t2 = tcg_temp_new_ptr();
+    TCGv_ptr tptrs[2] = { t0, t2 };
+
+    int sizemask = 0;
+    for (unsigned i = 0; i < nptrs; ++i) {
 #if TCG_TARGET_REG_BITS == 64
-    const int sizemask = 4 | 2;
-    tcg_gen_movi_i64(TCGV_PTR_TO_NAT(t0), (tcg_target_ulong) signal);
+        tcg_gen_movi_i64(TCGV_PTR_TO_NAT(tptrs[i]), ptrs[i]);
+        sizemask |= 1 << (i + 1) * 2;
 #else
-    const int sizemask = 4;
-    tcg_gen_movi_i32(TCGV_PTR_TO_NAT(t0), (tcg_target_ulong) signal);
+        tcg_gen_movi_i32(TCGV_PTR_TO_NAT(tptrs[i]), ptrs[i]);
 #endif
+        args[i] = GET_TCGV_PTR(tptrs[i]);
+    }
+    args[nptrs] = GET_TCGV_I64(t1);
+    sizemask |= 1 << (nptrs + 1) * 2;
 
     tcg_gen_movi_i64(t1, pc);
 
-    tcg_gen_helperN((void*) s2e_tcg_execution_handler,
-                0, sizemask, TCG_CALL_DUMMY_ARG, 2, args);
+    tcg_gen_helperN(handler, 0, sizemask, TCG_CALL_DUMMY_ARG, nptrs + 1, args);
 
+    tcg_temp_free_ptr(t2);
     tcg_temp_free_i64(t1);
     tcg_temp_free_ptr(t0);
 }
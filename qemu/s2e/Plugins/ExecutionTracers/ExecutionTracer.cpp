@@ -43,6 +43,13 @@
 
 #include <iostream>
 
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
 namespace s2e {
 namespace plugins {
 
@@ -50,6 +57,29 @@ S2E_DEFINE_PLUGIN(ExecutionTracer, "ExecutionTracer plugin", "",);
 
 void ExecutionTracer::initialize()
 {
+    ConfigFile *cfg = s2e()->getConfig();
+
+    m_useMmap = cfg->getBool(getConfigKey() + ".useMemoryMappedFile", false);
+    m_segmentSize = cfg->getInt(getConfigKey() + ".segmentSize", 16) * 1024 * 1024;
+    m_timestampInterval = cfg->getInt(getConfigKey() + ".timestampInterval", 1);
+    m_compress = cfg->getBool(getConfigKey() + ".compress", false);
+    m_chunkSize = cfg->getInt(getConfigKey() + ".chunkSize", 1024) * 1024;
+
+    if (m_compress && m_useMmap) {
+        s2e()->getWarningsStream() << "ExecutionTracer: useMemoryMappedFile is ignored "
+                                   << "for compressed traces" << '\n';
+        m_useMmap = false;
+    }
+
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (m_segmentSize < (uint64_t) pageSize * 2) {
+        m_segmentSize = pageSize * 2;
+    }
+    if (!m_timestampInterval) {
+        m_timestampInterval = 1;
+    }
+    m_timestampCounter = 0;
+
     createNewTraceFile(false);
 
     s2e()->getCorePlugin()->onStateFork.connect(
@@ -66,34 +96,232 @@ void ExecutionTracer::initialize()
 
 ExecutionTracer::~ExecutionTracer()
 {
-    if (m_LogFile) {
-        fclose(m_LogFile);
-    }
+    closeTraceFile();
 }
 
 void ExecutionTracer::createNewTraceFile(bool append)
 {
-
     if (append) {
         assert(m_fileName.size() > 0);
-        m_LogFile = fopen(m_fileName.c_str(), "a");
-    }else {
+    } else {
         m_fileName = s2e()->getOutputFilename("ExecutionTracer.dat");
-        m_LogFile = fopen(m_fileName.c_str(), "wb");
     }
 
-    if (!m_LogFile) {
-        s2e()->getWarningsStream() << "Could not create ExecutionTracer.dat" << '\n';
-        exit(-1);
+    if (m_useMmap) {
+        m_fd = open(m_fileName.c_str(), O_RDWR | O_CREAT | (append ? 0 : O_TRUNC), 0644);
+        struct stat st;
+        if (m_fd < 0 || fstat(m_fd, &st) < 0) {
+            s2e()->getWarningsStream() << "Could not create ExecutionTracer.dat" << '\n';
+            exit(-1);
+        }
+        mapSegment(st.st_size);
+    } else if (m_compress) {
+        m_LogFile = fopen(m_fileName.c_str(), append ? "r+b" : "w+b");
+        if (!m_LogFile) {
+            s2e()->getWarningsStream() << "Could not create ExecutionTracer.dat" << '\n';
+            exit(-1);
+        }
+
+        m_chunk.clear();
+        m_chunkIndex.clear();
+
+        if (append) {
+            if (!loadChunkIndex()) {
+                s2e()->getWarningsStream() << "Could not read the index of ExecutionTracer.dat" << '\n';
+                exit(-1);
+            }
+        } else {
+            ExecutionTraceFileHeader hdr;
+            hdr.magic = EXECTRACE_COMPRESSED_MAGIC;
+            hdr.indexOffset = 0;
+            hdr.chunkCount = 0;
+            if (fwrite(&hdr, sizeof(hdr), 1, m_LogFile) != 1) {
+                s2e()->getWarningsStream() << "Could not write ExecutionTracer.dat" << '\n';
+                exit(-1);
+            }
+        }
+    } else {
+        m_LogFile = fopen(m_fileName.c_str(), append ? "a" : "wb");
+        if (!m_LogFile) {
+            s2e()->getWarningsStream() << "Could not create ExecutionTracer.dat" << '\n';
+            exit(-1);
+        }
     }
+
     m_CurrentIndex = 0;
 }
 
-void ExecutionTracer::onTimer()
+void ExecutionTracer::closeTraceFile()
 {
+    if (m_fd >= 0) {
+        /* Drop the unused part of the last segment */
+        uint64_t end = m_segmentOffset + m_segmentUsed;
+        unmapSegment();
+        if (ftruncate(m_fd, end) < 0) {
+            s2e()->getWarningsStream() << "Could not truncate ExecutionTracer.dat" << '\n';
+        }
+        close(m_fd);
+        m_fd = -1;
+    }
+
     if (m_LogFile) {
-        fflush(m_LogFile);
+        if (m_compress) {
+            writeChunkIndex();
+        }
+        fclose(m_LogFile);
+        m_LogFile = NULL;
+    }
+}
+
+/** Read back the index of a compressed trace that is reopened for appending.
+    New chunks overwrite the old index, which is written again on close. */
+bool ExecutionTracer::loadChunkIndex()
+{
+    ExecutionTraceFileHeader hdr;
+    if (fseeko(m_LogFile, 0, SEEK_SET) < 0 ||
+        fread(&hdr, sizeof(hdr), 1, m_LogFile) != 1) {
+        return false;
+    }
+
+    if (hdr.magic != EXECTRACE_COMPRESSED_MAGIC || !hdr.indexOffset) {
+        return false;
+    }
+
+    m_chunkIndex.resize(hdr.chunkCount);
+    if (hdr.chunkCount) {
+        if (fseeko(m_LogFile, hdr.indexOffset, SEEK_SET) < 0 ||
+            fread(&m_chunkIndex[0], sizeof(ExecutionTraceChunkIndexEntry),
+                  hdr.chunkCount, m_LogFile) != hdr.chunkCount) {
+            return false;
+        }
+    }
+
+    /* Mark the trace as open until the index is written again */
+    hdr.indexOffset = 0;
+    hdr.chunkCount = 0;
+    if (fseeko(m_LogFile, 0, SEEK_SET) < 0 ||
+        fwrite(&hdr, sizeof(hdr), 1, m_LogFile) != 1) {
+        return false;
+    }
+
+    off_t end = m_chunkIndex.empty() ? sizeof(hdr) :
+                m_chunkIndex.back().offset + m_chunkIndex.back().chunk.compressedSize;
+    fflush(m_LogFile);
+    if (ftruncate(fileno(m_LogFile), end) < 0) {
+        return false;
+    }
+
+    return fseeko(m_LogFile, end, SEEK_SET) == 0;
+}
+
+void ExecutionTracer::flushChunk()
+{
+    if (m_chunk.empty()) {
+        return;
+    }
+
+    uLongf compressedSize = compressBound(m_chunk.size());
+    m_compressedChunk.resize(compressedSize);
+    if (compress2(&m_compressedChunk[0], &compressedSize,
+                  &m_chunk[0], m_chunk.size(), Z_BEST_SPEED) != Z_OK) {
+        s2e()->getWarningsStream() << "Could not compress ExecutionTracer.dat chunk" << '\n';
+        exit(-1);
+    }
+
+    ExecutionTraceChunkIndexEntry entry;
+    entry.chunk = m_chunkInfo;
+    entry.chunk.firstItem = 0;
+    if (!m_chunkIndex.empty()) {
+        const ExecutionTraceChunk &last = m_chunkIndex.back().chunk;
+        entry.chunk.firstItem = last.firstItem + last.itemCount;
+    }
+    entry.chunk.compressedSize = compressedSize;
+    entry.chunk.uncompressedSize = m_chunk.size();
+    entry.offset = ftello(m_LogFile) + sizeof(ExecutionTraceChunk);
+
+    if (fwrite(&entry.chunk, sizeof(entry.chunk), 1, m_LogFile) != 1 ||
+        fwrite(&m_compressedChunk[0], compressedSize, 1, m_LogFile) != 1) {
+        //at this point the log is corrupted.
+        assert(false);
+    }
+
+    m_chunkIndex.push_back(entry);
+    m_chunk.clear();
+}
+
+void ExecutionTracer::writeChunkIndex()
+{
+    flushChunk();
+
+    ExecutionTraceFileHeader hdr;
+    hdr.magic = EXECTRACE_COMPRESSED_MAGIC;
+    hdr.indexOffset = ftello(m_LogFile);
+    hdr.chunkCount = m_chunkIndex.size();
+
+    if (!m_chunkIndex.empty()) {
+        if (fwrite(&m_chunkIndex[0], sizeof(ExecutionTraceChunkIndexEntry),
+                   m_chunkIndex.size(), m_LogFile) != m_chunkIndex.size()) {
+            s2e()->getWarningsStream() << "Could not write the index of ExecutionTracer.dat" << '\n';
+            return;
+        }
+    }
+
+    if (fseeko(m_LogFile, 0, SEEK_SET) < 0 ||
+        fwrite(&hdr, sizeof(hdr), 1, m_LogFile) != 1) {
+        s2e()->getWarningsStream() << "Could not write the index of ExecutionTracer.dat" << '\n';
+    }
+}
+
+/** Map a segment of the trace file that starts at the page containing
+    fileEnd. The file is extended so that the whole segment is backed. */
+void ExecutionTracer::mapSegment(uint64_t fileEnd)
+{
+    uint64_t pageSize = sysconf(_SC_PAGESIZE);
+    m_segmentOffset = fileEnd & ~(pageSize - 1);
+    m_segmentUsed = fileEnd - m_segmentOffset;
+
+    if (ftruncate(m_fd, m_segmentOffset + m_segmentSize) < 0) {
+        s2e()->getWarningsStream() << "Could not extend ExecutionTracer.dat" << '\n';
+        exit(-1);
+    }
+
+    void *segment = mmap(NULL, m_segmentSize, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, m_fd, m_segmentOffset);
+    if (segment == MAP_FAILED) {
+        s2e()->getWarningsStream() << "Could not map ExecutionTracer.dat" << '\n';
+        exit(-1);
     }
+
+    m_segment = static_cast<uint8_t*>(segment);
+}
+
+void ExecutionTracer::unmapSegment()
+{
+    if (m_segment) {
+        munmap(m_segment, m_segmentSize);
+        m_segment = NULL;
+    }
+}
+
+uint64_t ExecutionTracer::getTimestamp()
+{
+    if (m_timestampCounter == 0) {
+        m_timestamp = llvm::sys::TimeValue::now().usec();
+    }
+
+    if (++m_timestampCounter == m_timestampInterval) {
+        m_timestampCounter = 0;
+    }
+
+    return m_timestamp;
+}
+
+void ExecutionTracer::onTimer()
+{
+    flush();
+
+    /* Keep timestamps accurate when few items are written */
+    m_timestampCounter = 0;
 }
 
 uint32_t ExecutionTracer::writeData(
@@ -102,14 +330,71 @@ uint32_t ExecutionTracer::writeData(
 {
     ExecutionTraceItemHeader item;
 
-    assert(m_LogFile);
+    assert(m_LogFile || m_segment);
 
-    item.timeStamp = llvm::sys::TimeValue::now().usec();
+    item.timeStamp = getTimestamp();
     item.size = size;
     item.type = type;
     item.stateId = state->getID();
     item.pid = state->getPid();
 
+    if (m_useMmap) {
+        uint64_t itemSize = sizeof(item) + size;
+        if (m_segmentUsed + itemSize > m_segmentSize) {
+            uint64_t end = m_segmentOffset + m_segmentUsed;
+            uint64_t pageSize = sysconf(_SC_PAGESIZE);
+            unmapSegment();
+            while (itemSize + pageSize > m_segmentSize) {
+                m_segmentSize *= 2;
+            }
+            mapSegment(end);
+        }
+
+        memcpy(m_segment + m_segmentUsed, &item, sizeof(item));
+        if (size) {
+            memcpy(m_segment + m_segmentUsed + sizeof(item), data, size);
+        }
+        m_segmentUsed += itemSize;
+
+        return ++m_CurrentIndex;
+    }
+
+    if (m_compress) {
+        unsigned itemSize = sizeof(item) + size;
+
+        /* Forks get a chunk of their own: readers only need to inflate
+           these chunks to rebuild the execution tree. */
+        if (!m_chunk.empty() && (m_chunkInfo.stateId != item.stateId ||
+                                 type == TRACE_FORK ||
+                                 m_chunk.size() + itemSize > m_chunkSize)) {
+            flushChunk();
+        }
+
+        if (m_chunk.empty()) {
+            m_chunkInfo.firstTimeStamp = item.timeStamp;
+            m_chunkInfo.itemCount = 0;
+            m_chunkInfo.stateId = item.stateId;
+            m_chunkInfo.typeMask = 0;
+        }
+
+        const uint8_t *bytes = reinterpret_cast<const uint8_t*>(&item);
+        m_chunk.insert(m_chunk.end(), bytes, bytes + sizeof(item));
+        if (size) {
+            bytes = static_cast<const uint8_t*>(data);
+            m_chunk.insert(m_chunk.end(), bytes, bytes + size);
+        }
+
+        m_chunkInfo.lastTimeStamp = item.timeStamp;
+        m_chunkInfo.typeMask |= 1 << type;
+        ++m_chunkInfo.itemCount;
+
+        if (type == TRACE_FORK) {
+            flushChunk();
+        }
+
+        return ++m_CurrentIndex;
+    }
+
     if (fwrite(&item, sizeof(item), 1, m_LogFile) != 1) {
         return 0;
     }
@@ -127,15 +412,22 @@ uint32_t ExecutionTracer::writeData(
 void ExecutionTracer::flush()
 {
     if (m_LogFile) {
+        if (m_compress) {
+            flushChunk();
+        }
         fflush(m_LogFile);
     }
+
+    /* Let the kernel write back the dirty pages in the background */
+    if (m_segment) {
+        msync(m_segment, m_segmentSize, MS_ASYNC);
+    }
 }
 
 void ExecutionTracer::onProcessFork(bool preFork, bool isChild, unsigned parentProcId)
 {
     if (preFork) {
-        fclose(m_LogFile);
-        m_LogFile = NULL;
+        closeTraceFile();
     }else {
         if (isChild) {
             createNewTraceFile(false);
@@ -67,12 +67,43 @@ class ExecutionTracer : public Plugin
     OSMonitor *m_Monitor;
     ExecTracerModules m_Modules;
 
+    /* Memory-mapped output: items are appended to a mapped segment
+       of the trace file. A new segment is mapped when it is full. */
+    bool m_useMmap;
+    int m_fd;
+    uint64_t m_segmentSize;
+    uint64_t m_segmentOffset;
+    uint64_t m_segmentUsed;
+    uint8_t *m_segment;
+
+    /* Compressed output: items are buffered in m_chunk, which is
+       deflated when it is full or when another state writes an item. */
+    bool m_compress;
+    unsigned m_chunkSize;
+    std::vector<uint8_t> m_chunk;
+    std::vector<uint8_t> m_compressedChunk;
+    ExecutionTraceChunk m_chunkInfo;
+    std::vector<ExecutionTraceChunkIndexEntry> m_chunkIndex;
+
+    /* Timestamps are refreshed every m_timestampInterval items */
+    unsigned m_timestampInterval;
+    unsigned m_timestampCounter;
+    uint64_t m_timestamp;
+
     uint16_t getCompressedId(const ModuleDescriptor *desc);
 
     void onTimer();
     void createNewTraceFile(bool append);
+    void closeTraceFile();
+    void mapSegment(uint64_t fileEnd);
+    void unmapSegment();
+    bool loadChunkIndex();
+    void flushChunk();
+    void writeChunkIndex();
+    uint64_t getTimestamp();
 public:
-    ExecutionTracer(S2E* s2e): Plugin(s2e) {}
+    ExecutionTracer(S2E* s2e): Plugin(s2e), m_LogFile(NULL),
+        m_useMmap(false), m_fd(-1), m_segment(NULL), m_compress(false) {}
     ~ExecutionTracer();
     void initialize();
 
@@ -86,6 +86,42 @@ struct ExecutionTraceItemHeader{
     //uint8_t  payload[];
 }__attribute__((packed));
 
+/**
+ *  Compressed traces start with this header instead of a trace item.
+ *  The items are grouped in chunks that belong to a single state.
+ *  Each chunk is deflated separately and preceded by its descriptor.
+ *  The descriptors of all the chunks are repeated in an index at the
+ *  end of the file, so that readers can find the chunks of a state
+ *  without reading the rest of the trace.
+ */
+#define EXECTRACE_COMPRESSED_MAGIC 0x3130435254453253ULL /* "S2ETRC01" */
+
+struct ExecutionTraceFileHeader {
+    uint64_t magic;
+    //Offset of the chunk index, 0 if the trace was not closed properly
+    uint64_t indexOffset;
+    uint32_t chunkCount;
+}__attribute__((packed));
+
+struct ExecutionTraceChunk {
+    uint64_t firstTimeStamp;
+    uint64_t lastTimeStamp;
+    //Index of the first item of the chunk in the trace file
+    uint32_t firstItem;
+    uint32_t itemCount;
+    uint32_t stateId;
+    //Bit i is set if the chunk contains items of type i
+    uint32_t typeMask;
+    uint32_t compressedSize;
+    uint32_t uncompressedSize;
+}__attribute__((packed));
+
+struct ExecutionTraceChunkIndexEntry {
+    ExecutionTraceChunk chunk;
+    //Offset of the compressed data in the trace file
+    uint64_t offset;
+}__attribute__((packed));
+
 struct ExecutionTraceModuleLoad {
     char name[32];
     uint64_t loadBase;
@@ -47,6 +47,7 @@
 
 #include <iostream>
 #include <sstream>
+#include <string.h>
 
 namespace s2e {
 namespace plugins {
@@ -116,6 +117,33 @@ namespace {
             << "    type = " << r.type << "\n";
         return out;
     }
+
+    //Region type pattern that is parsed once and then matched
+    //against many region types without building temporary strings.
+    class RegionTypePattern {
+        const std::string &m_pattern;
+        size_t m_prefixLength;
+        bool m_wildcard;
+
+    public:
+        RegionTypePattern(const std::string &pattern): m_pattern(pattern) {
+            m_wildcard = pattern.size() > 0 && pattern[pattern.size() - 1] == '*';
+            m_prefixLength = m_wildcard ? pattern.size() - 1 : pattern.size();
+        }
+
+        bool match(const std::string &type) const {
+            if (m_pattern.size() == 0)
+                return true;
+
+            if (type.size() == 0)
+                return m_pattern.size() == 1 && m_wildcard;
+
+            if (!m_wildcard)
+                return m_pattern.compare(type) == 0;
+
+            return type.compare(0, m_prefixLength, m_pattern, 0, m_prefixLength) == 0;
+        }
+    };
 } // namespace
 
 class MemoryCheckerState: public PluginState
@@ -124,8 +152,23 @@ public:
     MemoryMap m_memoryMap;
     ResourceHandleMap m_resourceMap;
 
+    /* Software TLB of regions that recently passed the checks. Only
+       successful checks are cached, so granting memory never makes an
+       entry stale. Revoking memory invalidates the entries of the region. */
+    struct CachedRegion {
+        uint64_t start;
+        uint64_t end;
+        uint8_t perms;
+    };
+
+    static const unsigned CACHE_BITS = 6;
+    static const unsigned CACHE_PAGE_BITS = 12;
+    CachedRegion m_cache[1 << CACHE_BITS];
+
 public:
-    MemoryCheckerState() {}
+    MemoryCheckerState() {
+        flushCache();
+    }
     ~MemoryCheckerState() {}
 
     MemoryCheckerState *clone() const { return new MemoryCheckerState(*this); }
@@ -148,6 +191,36 @@ public:
     void setResourceMap(const ResourceHandleMap& resourceMap) {
         m_resourceMap = resourceMap;
     }
+
+    static unsigned getCacheIndex(uint64_t address) {
+        return (address >> CACHE_PAGE_BITS) & ((1 << CACHE_BITS) - 1);
+    }
+
+    bool isCached(uint64_t start, uint64_t size, uint8_t perms) const {
+        const CachedRegion &entry = m_cache[getCacheIndex(start)];
+        return start >= entry.start && start < entry.end &&
+               start + size <= entry.end && (perms & entry.perms) == perms;
+    }
+
+    void cacheRegion(uint64_t address, const MemoryRange &range, uint8_t perms) {
+        CachedRegion &entry = m_cache[getCacheIndex(address)];
+        entry.start = range.start;
+        entry.end = range.start + range.size;
+        entry.perms = perms;
+    }
+
+    void invalidateCache(const MemoryRange &range) {
+        for (unsigned i = 0; i < (1 << CACHE_BITS); ++i) {
+            CachedRegion &entry = m_cache[i];
+            if (entry.start < range.start + range.size && range.start < entry.end) {
+                entry.start = entry.end = 0;
+            }
+        }
+    }
+
+    void flushCache() {
+        memset(m_cache, 0, sizeof(m_cache));
+    }
 };
 
 void MemoryChecker::initialize()
@@ -290,27 +363,7 @@ void MemoryChecker::onDataMemoryAccess(S2EExecutionState *state,
 
 bool MemoryChecker::matchRegionType(const std::string &pattern, const std::string &type)
 {
-    if(pattern.size() == 0)
-        return true;
-
-    if(type.size() == 0)
-        return pattern[0] == '*' && pattern[1] == 0;
-
-    size_t len = pattern.size();
-
-    if(len == 0) // corner case
-        return type[0] == 0;
-
-    if(pattern[len-1] != '*')
-        return pattern.compare(type) == 0;
-
-    std::string typePrefix = type.substr(0, len-1);
-    std::string patternPrefix = pattern.substr(0, len-1);
-
-//    s2e()->getDebugStream() << "matchRegionType typePrefix=" << typePrefix
-//            << " patternPrefix=" << patternPrefix << std::endl;
-
-    return typePrefix.compare(patternPrefix) == 0;
+    return RegionTypePattern(pattern).match(type);
 }
 
 void MemoryChecker::grantMemoryForModuleSections(
@@ -585,6 +638,7 @@ bool MemoryChecker::revokeMemory(S2EExecutionState *state,
 
         //we can not just delete it since it can be used by other states!
         //delete const_cast<MemoryRegion*>(res->second);
+        plgState->invalidateCache(res->first);
         plgState->setMemoryMap(memoryMap.remove(region->range));
     } while(false);
 
@@ -612,24 +666,25 @@ bool MemoryChecker::revokeMemory(S2EExecutionState *state,
             << "pattern = '" << regionTypePattern << "', "
             << "regionID = " << hexval(regionID) << ")" << '\n';
 
-    bool ret = true;
-    bool changed = true;
-    while(changed) {
-        changed = false;
-        for(MemoryMap::iterator it = memoryMap.begin(), ie = memoryMap.end();
-                                                        it != ie; ++it) {
-            if(it->second->type.size()>0
-                  && matchRegionType(regionTypePattern, it->second->type)
-                  && (regionID == uint64_t(-1) || it->second->id == regionID)) {
-                ret &= revokeMemory(state,
-                             it->first.start, it->first.size,
-                             it->second->perms, it->second->type, it->second->id);
-                changed = true;
-                memoryMap = plgState->getMemoryMap();
-                break;
-            }
+    //Collect the matching regions first: revoking them changes the map
+    RegionTypePattern pattern(regionTypePattern);
+    std::vector<const MemoryRegion*> regions;
+    for(MemoryMap::iterator it = memoryMap.begin(), ie = memoryMap.end();
+                                                    it != ie; ++it) {
+        if(it->second->type.size()>0
+              && pattern.match(it->second->type)
+              && (regionID == uint64_t(-1) || it->second->id == regionID)) {
+            regions.push_back(it->second);
         }
     }
+
+    bool ret = true;
+    foreach2(it, regions.begin(), regions.end()) {
+        const MemoryRegion *r = *it;
+        ret &= revokeMemory(state,
+                     r->range.start, r->range.size,
+                     r->perms, r->type, r->id);
+    }
     return ret;
 }
 
@@ -770,6 +825,10 @@ bool MemoryChecker::checkMemoryAccess(S2EExecutionState *state,
             break;
         }
 
+        if (plgState->isCached(start, size, perms)) {
+            break;
+        }
+
         MemoryRange range = {start, size};
         const MemoryMap::value_type *res = memoryMap.lookup_previous(range);
 
@@ -804,6 +863,8 @@ bool MemoryChecker::checkMemoryAccess(S2EExecutionState *state,
             hasError = true;
             break;
         }
+
+        plgState->cacheRegion(start, res->first, res->second->perms);
     } while(false);
 
     return !hasError;
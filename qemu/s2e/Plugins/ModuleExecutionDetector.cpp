@@ -544,49 +544,192 @@ void ModuleExecutionDetector::dumpMemory(S2EExecutionState *state,
 /*****************************************************************************/
 /*****************************************************************************/
 
-ModuleTransitionState::ModuleTransitionState()
+/* Granularity of the page index of the module maps */
+static const unsigned ModuleMapPageBits = 12;
+
+/* Only the first and last pages of larger modules are indexed */
+static const uint64_t ModuleMapMaxIndexedPages = 16384;
+
+ModuleTransitionState::ModuleMap::ModuleMap():
+    refCount(1), unindexed(0)
 {
-    m_PreviousModule = NULL;
-    m_CachedModule = NULL;
+
 }
 
-ModuleTransitionState::~ModuleTransitionState()
+ModuleTransitionState::ModuleMap::ModuleMap(const ModuleMap &other):
+    refCount(1), descriptors(other.descriptors), pages(other.pages),
+    unindexed(other.unindexed)
 {
-    foreach2(it, m_Descriptors.begin(), m_Descriptors.end()) {
-        delete *it;
+    foreach2(it, descriptors.begin(), descriptors.end()) {
+        ++(*it)->refCount;
     }
+}
 
-    foreach2(it, m_NotTrackedDescriptors.begin(), m_NotTrackedDescriptors.end()) {
-        delete *it;
+ModuleTransitionState::ModuleMap::~ModuleMap()
+{
+    foreach2(it, descriptors.begin(), descriptors.end()) {
+        if (--(*it)->refCount == 0) {
+            delete *it;
+        }
     }
 }
 
-ModuleTransitionState* ModuleTransitionState::clone() const
+const ModuleDescriptor *ModuleTransitionState::ModuleMap::lookup(uint64_t pid, uint64_t pc) const
+{
+    PageIndex::const_iterator it = pages.find(std::make_pair(pid, pc >> ModuleMapPageBits));
+    if (it != pages.end()) {
+        if ((*it).second) {
+            //The module may cover only a part of the page
+            const ModuleDescriptor &md = (*it).second->descriptor;
+            return pc - md.LoadBase < md.Size ? &md : NULL;
+        }
+    } else if (!unindexed) {
+        return NULL;
+    }
+
+    //The page is shared by several modules or is inside a large module
+    ModuleDescriptor d;
+    d.Pid = pid;
+    d.LoadBase = pc;
+    d.Size = 1;
+
+    SharedDescriptor *sd = find(d);
+    return sd ? &sd->descriptor : NULL;
+}
+
+ModuleTransitionState::SharedDescriptor *
+ModuleTransitionState::ModuleMap::find(const ModuleDescriptor &desc) const
+{
+    SharedDescriptor key(desc);
+    DescriptorSet::const_iterator it = descriptors.find(&key);
+    return it != descriptors.end() ? *it : NULL;
+}
+
+void ModuleTransitionState::ModuleMap::insert(const ModuleDescriptor &desc)
+{
+    SharedDescriptor *sd = new SharedDescriptor(desc);
+    if (!descriptors.insert(sd).second) {
+        //The module overlaps an existing one
+        delete sd;
+        return;
+    }
+
+    sd->refCount = 1;
+    indexPages(sd, true);
+}
+
+void ModuleTransitionState::ModuleMap::erase(SharedDescriptor *sd)
 {
-    ModuleTransitionState *ret = new ModuleTransitionState();
+    DescriptorSet::iterator it = descriptors.find(sd);
+    assert(it != descriptors.end() && *it == sd);
+    descriptors.erase(it);
+
+    indexPages(sd, false);
 
-    foreach2(it, m_Descriptors.begin(), m_Descriptors.end()) {
-        ret->m_Descriptors.insert(new ModuleDescriptor(**it));
+    if (--sd->refCount == 0) {
+        delete sd;
     }
+}
 
-    foreach2(it, m_NotTrackedDescriptors.begin(), m_NotTrackedDescriptors.end()) {
-        assert(*it != m_CachedModule && *it != m_PreviousModule);
-        ret->m_NotTrackedDescriptors.insert(new ModuleDescriptor(**it));
+/** Update the index entries of the pages of a module that was just
+    added to or removed from the descriptor set. */
+void ModuleTransitionState::ModuleMap::indexPages(const SharedDescriptor *sd, bool insert)
+{
+    const ModuleDescriptor &desc = sd->descriptor;
+    if (!desc.Size) {
+        return;
     }
 
-    if (m_CachedModule) {
-        DescriptorSet::iterator it = ret->m_Descriptors.find(m_CachedModule);
-        assert(it != ret->m_Descriptors.end());
-        ret->m_CachedModule = *it;
+    uint64_t first = desc.LoadBase >> ModuleMapPageBits;
+    uint64_t last = (desc.LoadBase + desc.Size - 1) >> ModuleMapPageBits;
+
+    //The first and last pages may be shared with other modules
+    indexPage(desc.Pid, first);
+    if (last != first) {
+        indexPage(desc.Pid, last);
     }
 
-    if (m_PreviousModule) {
-        DescriptorSet::iterator it = ret->m_Descriptors.find(m_PreviousModule);
-        assert(it != ret->m_Descriptors.end());
-        ret->m_PreviousModule = *it;
+    if (last - first + 1 > ModuleMapMaxIndexedPages) {
+        insert ? ++unindexed : --unindexed;
+        return;
     }
 
-    return ret;
+    for (uint64_t page = first + 1; page < last; ++page) {
+        if (insert) {
+            pages[std::make_pair(desc.Pid, page)] = sd;
+        } else {
+            pages.erase(std::make_pair(desc.Pid, page));
+        }
+    }
+}
+
+void ModuleTransitionState::ModuleMap::indexPage(uint64_t pid, uint64_t page)
+{
+    ModuleDescriptor d;
+    d.Pid = pid;
+    d.LoadBase = page << ModuleMapPageBits;
+    d.Size = 1 << ModuleMapPageBits;
+
+    SharedDescriptor key(d);
+    std::pair<DescriptorSet::const_iterator, DescriptorSet::const_iterator> range =
+            descriptors.equal_range(&key);
+
+    std::pair<uint64_t, uint64_t> entry = std::make_pair(pid, page);
+
+    if (range.first == range.second) {
+        pages.erase(entry);
+    } else if (++range.first == range.second) {
+        pages[entry] = *--range.first;
+    } else {
+        pages[entry] = NULL;
+    }
+}
+
+ModuleTransitionState::ModuleMap *ModuleTransitionState::getWriteable(ModuleMap *&map)
+{
+    if (map->refCount > 1) {
+        --map->refCount;
+        map = new ModuleMap(*map);
+    }
+    return map;
+}
+
+void ModuleTransitionState::release(ModuleMap *map)
+{
+    if (--map->refCount == 0) {
+        delete map;
+    }
+}
+
+ModuleTransitionState::ModuleTransitionState()
+{
+    m_PreviousModule = NULL;
+    m_CachedModule = NULL;
+    m_Descriptors = new ModuleMap();
+    m_NotTrackedDescriptors = new ModuleMap();
+}
+
+ModuleTransitionState::ModuleTransitionState(const ModuleTransitionState &other):
+    PluginState()
+{
+    m_PreviousModule = other.m_PreviousModule;
+    m_CachedModule = other.m_CachedModule;
+    m_Descriptors = other.m_Descriptors;
+    m_NotTrackedDescriptors = other.m_NotTrackedDescriptors;
+    ++m_Descriptors->refCount;
+    ++m_NotTrackedDescriptors->refCount;
+}
+
+ModuleTransitionState::~ModuleTransitionState()
+{
+    release(m_Descriptors);
+    release(m_NotTrackedDescriptors);
+}
+
+ModuleTransitionState* ModuleTransitionState::clone() const
+{
+    //The module maps and the descriptors are shared until the next module load or unload
+    return new ModuleTransitionState(*this);
 }
 
 PluginState* ModuleTransitionState::factory(Plugin *p, S2EExecutionState *state)
@@ -611,25 +754,14 @@ const ModuleDescriptor *ModuleTransitionState::getDescriptor(uint64_t pid, uint6
         }
     }
 
-    ModuleDescriptor d;
-    d.Pid = pid;
-    d.LoadBase = pc;
-    d.Size = 1;
-    DescriptorSet::iterator it = m_Descriptors.find(&d);
-    if (it != m_Descriptors.end()) {
-        m_CachedModule = *it;
-        return *it;
+    const ModuleDescriptor *md = m_Descriptors->lookup(pid, pc);
+    m_CachedModule = md;
+    if (md) {
+        return md;
     }
 
-    m_CachedModule = NULL;
-
     if (!tracked) {
-        it = m_NotTrackedDescriptors.find(&d);
-        if (it != m_NotTrackedDescriptors.end()) {
-            //XXX: implement proper caching
-            assert(*it != m_CachedModule && *it != m_PreviousModule);
-            return *it;
-        }
+        return m_NotTrackedDescriptors->lookup(pid, pc);
     }
 
     return NULL;
@@ -638,10 +770,10 @@ const ModuleDescriptor *ModuleTransitionState::getDescriptor(uint64_t pid, uint6
 bool ModuleTransitionState::loadDescriptor(const ModuleDescriptor &desc, bool track)
 {
     if (track) {
-        m_Descriptors.insert(new ModuleDescriptor(desc));
+        getWriteable(m_Descriptors)->insert(desc);
     }else {
-        if (m_NotTrackedDescriptors.find(&desc) == m_NotTrackedDescriptors.end()) {
-            m_NotTrackedDescriptors.insert(new ModuleDescriptor(desc));
+        if (!m_NotTrackedDescriptors->find(desc)) {
+            getWriteable(m_NotTrackedDescriptors)->insert(desc);
         }
         else {
             return false;
@@ -657,95 +789,65 @@ void ModuleTransitionState::unloadDescriptor(const ModuleDescriptor &desc)
     d.Pid = desc.Pid;
     d.Size = desc.Size;
 
-    DescriptorSet::iterator it = m_Descriptors.find(&d);
-    if (it != m_Descriptors.end()) {
-        if (m_CachedModule == *it) {
+    SharedDescriptor *sd = m_Descriptors->find(d);
+    if (sd) {
+        if (m_CachedModule == &sd->descriptor) {
             m_CachedModule = NULL;
         }
 
-        if (m_PreviousModule == *it) {
+        if (m_PreviousModule == &sd->descriptor) {
             m_PreviousModule = NULL;
         }
 
-        const ModuleDescriptor *md = *it;
-        size_t s = m_Descriptors.erase(*it);
-        assert(s == 1);
-        delete md;
+        getWriteable(m_Descriptors)->erase(sd);
     }
 
-    it = m_NotTrackedDescriptors.find(&d);
-    if (it != m_NotTrackedDescriptors.end()) {
-        assert(*it != m_CachedModule && *it != m_PreviousModule);
-        const ModuleDescriptor *md = *it;
-        size_t s = m_NotTrackedDescriptors.erase(*it);
-        assert(s == 1);
-        delete md;
+    sd = m_NotTrackedDescriptors->find(d);
+    if (sd) {
+        getWriteable(m_NotTrackedDescriptors)->erase(sd);
     }
 }
 
 void ModuleTransitionState::unloadDescriptorsWithPid(uint64_t pid)
 {
-    DescriptorSet::iterator it, it1;
-
-    for (it = m_Descriptors.begin(); it != m_Descriptors.end(); ) {
-        if ((*it)->Pid != pid) {
-            ++it;
-        }else {
-            it1 = it;
-            ++it1;
+    ModuleMap **maps[] = {&m_Descriptors, &m_NotTrackedDescriptors};
 
-            if (m_CachedModule == *it) {
-                m_CachedModule = NULL;
-            }
-
-            if (m_PreviousModule == *it) {
-                m_PreviousModule = NULL;
+    for (unsigned i = 0; i < sizeof(maps) / sizeof(maps[0]); ++i) {
+        std::vector<SharedDescriptor*> unloaded;
+        foreach2(it, (*maps[i])->descriptors.begin(), (*maps[i])->descriptors.end()) {
+            if ((*it)->descriptor.Pid == pid) {
+                unloaded.push_back(*it);
             }
-
-            const ModuleDescriptor *md = *it;
-            m_Descriptors.erase(*it);
-            delete md;
-
-            it = it1;
         }
-    }
 
-    //XXX: avoid copy/paste
-    for (it = m_NotTrackedDescriptors.begin(); it != m_NotTrackedDescriptors.end(); ) {
-        if ((*it)->Pid != pid) {
-            ++it;
-        }else {
-            it1 = it;
-            ++it1;
+        if (unloaded.empty()) {
+            continue;
+        }
 
-            if (m_CachedModule == *it) {
+        ModuleMap *map = getWriteable(*maps[i]);
+        foreach2(it, unloaded.begin(), unloaded.end()) {
+            if (m_CachedModule == &(*it)->descriptor) {
                 m_CachedModule = NULL;
             }
 
-            if (m_PreviousModule == *it) {
+            if (m_PreviousModule == &(*it)->descriptor) {
                 m_PreviousModule = NULL;
             }
 
-            const ModuleDescriptor *md = *it;
-            m_NotTrackedDescriptors.erase(*it);
-            delete md;
-
-            it = it1;
+            map->erase(*it);
         }
     }
 }
 
 bool ModuleTransitionState::exists(const ModuleDescriptor *desc, bool tracked) const
 {
-    bool ret;
-    ret = m_Descriptors.find(desc) != m_Descriptors.end();
-    if (ret) {
-        return ret;
+    if (m_Descriptors->find(*desc)) {
+        return true;
     }
 
     if (tracked) {
         return false;
     }
 
-    return m_NotTrackedDescriptors.find(desc) != m_NotTrackedDescriptors.end();
+    return m_NotTrackedDescriptors->find(*desc) != NULL;
 }
@@ -43,6 +43,8 @@
 #include <s2e/Plugins/CorePlugin.h>
 #include <s2e/Plugins/OSMonitor.h>
 
+#include <llvm/ADT/DenseMap.h>
+
 #include <inttypes.h>
 #include "OSMonitor.h"
 
@@ -228,13 +230,59 @@ public:
 class ModuleTransitionState:public PluginState
 {
 private:
-    typedef std::set<const ModuleDescriptor*, ModuleDescriptor::ModuleByLoadBase> DescriptorSet;
+    /** Descriptors do not change once loaded. They are shared by the
+        module maps of all the states that forked after the load. */
+    struct SharedDescriptor {
+        unsigned refCount;
+        ModuleDescriptor descriptor;
+
+        SharedDescriptor(const ModuleDescriptor &desc):
+            refCount(0), descriptor(desc) {}
+    };
+
+    struct SharedDescriptorByLoadBase {
+        bool operator()(const SharedDescriptor *d1, const SharedDescriptor *d2) const {
+            return ModuleDescriptor::ModuleByLoadBase()(d1->descriptor, d2->descriptor);
+        }
+    };
+
+    typedef std::set<SharedDescriptor*, SharedDescriptorByLoadBase> DescriptorSet;
+
+    /** Maps (pid, page) to the only module that overlaps the page,
+        or to NULL if several modules overlap it. */
+    typedef llvm::DenseMap<std::pair<uint64_t, uint64_t>, const SharedDescriptor*> PageIndex;
+
+    /** Set of modules with a page index. Forked states share the
+        same map until one of them loads or unloads a module. */
+    struct ModuleMap {
+        unsigned refCount;
+        DescriptorSet descriptors;
+        PageIndex pages;
+        /* Number of modules that are too large to index all their pages */
+        unsigned unindexed;
+
+        ModuleMap();
+        ModuleMap(const ModuleMap &other);
+        ~ModuleMap();
+
+        const ModuleDescriptor *lookup(uint64_t pid, uint64_t pc) const;
+        SharedDescriptor *find(const ModuleDescriptor &desc) const;
+        void insert(const ModuleDescriptor &desc);
+        void erase(SharedDescriptor *desc);
+        void indexPages(const SharedDescriptor *sd, bool insert);
+        void indexPage(uint64_t pid, uint64_t page);
+    };
 
     const ModuleDescriptor *m_PreviousModule;
     mutable const ModuleDescriptor *m_CachedModule;
 
-    DescriptorSet m_Descriptors;
-    DescriptorSet m_NotTrackedDescriptors;
+    ModuleMap *m_Descriptors;
+    ModuleMap *m_NotTrackedDescriptors;
+
+    static ModuleMap *getWriteable(ModuleMap *&map);
+    static void release(ModuleMap *map);
+
+    ModuleTransitionState(const ModuleTransitionState &other);
 
     const ModuleDescriptor *getDescriptor(uint64_t pid, uint64_t pc, bool tracked=true) const;
     bool loadDescriptor(const ModuleDescriptor &desc, bool track);
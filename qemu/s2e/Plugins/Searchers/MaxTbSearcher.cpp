@@ -58,6 +58,56 @@ using namespace llvm;
 S2E_DEFINE_PLUGIN(MaxTbSearcher, "Prioritizes states that are about to execute unexplored translation blocks",
                   "MaxTbSearcher", "ModuleExecutionDetector");
 
+static const unsigned NOT_QUEUED = (unsigned) -1;
+
+MaxTbSearcher::TbCounters::TbCounters(uint64_t moduleSize):
+    m_pages((moduleSize + PAGE_SIZE - 1) >> PAGE_BITS, (uint64_t*) NULL)
+{
+
+}
+
+MaxTbSearcher::TbCounters::~TbCounters()
+{
+    foreach2(it, m_pages.begin(), m_pages.end()) {
+        delete [] *it;
+    }
+}
+
+uint64_t &MaxTbSearcher::TbCounters::operator[](uint64_t pc)
+{
+    uint64_t page = pc >> PAGE_BITS;
+    if (page >= m_pages.size()) {
+        return m_outside[pc];
+    }
+
+    if (!m_pages[page]) {
+        m_pages[page] = new uint64_t[PAGE_SIZE];
+        memset(m_pages[page], 0, PAGE_SIZE * sizeof(uint64_t));
+    }
+    return m_pages[page][pc & (PAGE_SIZE - 1)];
+}
+
+uint64_t MaxTbSearcher::TbCounters::get(uint64_t pc) const
+{
+    uint64_t page = pc >> PAGE_BITS;
+    if (page >= m_pages.size()) {
+        std::map<uint64_t, uint64_t>::const_iterator it = m_outside.find(pc);
+        return it == m_outside.end() ? 0 : (*it).second;
+    }
+
+    if (!m_pages[page]) {
+        return 0;
+    }
+    return m_pages[page][pc & (PAGE_SIZE - 1)];
+}
+
+MaxTbSearcher::~MaxTbSearcher()
+{
+    foreach2(it, m_coveredTbs.begin(), m_coveredTbs.end()) {
+        delete (*it).second;
+    }
+}
+
 void MaxTbSearcher::initialize()
 {
 
@@ -65,9 +115,6 @@ void MaxTbSearcher::initialize()
     m_searcherInited = false;
     m_parentSearcher = NULL;
 
-    m_sorter.p = this;
-    m_states = StateSet(m_sorter);
-
     //XXX: Take care of module load/unload
     m_moduleExecutionDetector->onModuleTranslateBlockEnd.connect(
             sigc::mem_fun(*this, &MaxTbSearcher::onModuleTranslateBlockEnd)
@@ -97,12 +144,112 @@ bool MaxTbSearcher::isExplored(S2EExecutionState *s, uint64_t absTargetPc)
     TbsByModule::iterator it = m_coveredTbs.find(*md);
     if (it == m_coveredTbs.end()) {
         return false;
-    }else {
-        if ((*it).second.find(targetPc) == (*it).second.end()) {
-            return false;
+    }
+    return (*it).second->get(targetPc) != 0;
+}
+
+MaxTbSearcher::TbCounters &MaxTbSearcher::getCoveredTbs(const ModuleDescriptor &md)
+{
+    TbCounters *&counters = m_coveredTbs[md];
+    if (!counters) {
+        counters = new TbCounters(md.Size);
+    }
+    return *counters;
+}
+
+/**
+ *  The priority queue is a binary heap stored in m_queue. Each queued
+ *  state remembers its position in its plugin state, which allows
+ *  updating its metric or removing it in logarithmic time.
+ */
+void MaxTbSearcher::setQueueEntry(unsigned index, const QueueEntry &entry)
+{
+    m_queue[index] = entry;
+    entry.plgState->m_queueIndex = index;
+}
+
+void MaxTbSearcher::siftUp(unsigned index)
+{
+    QueueEntry entry = m_queue[index];
+    while (index > 0) {
+        unsigned parent = (index - 1) / 2;
+        if (!(entry < m_queue[parent])) {
+            break;
         }
+        setQueueEntry(index, m_queue[parent]);
+        index = parent;
+    }
+    setQueueEntry(index, entry);
+}
+
+void MaxTbSearcher::siftDown(unsigned index)
+{
+    QueueEntry entry = m_queue[index];
+    unsigned size = m_queue.size();
+    while (true) {
+        unsigned child = 2 * index + 1;
+        if (child >= size) {
+            break;
+        }
+        if (child + 1 < size && m_queue[child + 1] < m_queue[child]) {
+            ++child;
+        }
+        if (!(m_queue[child] < entry)) {
+            break;
+        }
+        setQueueEntry(index, m_queue[child]);
+        index = child;
+    }
+    setQueueEntry(index, entry);
+}
+
+//Inserts the state or moves it according to its new metric
+void MaxTbSearcher::queueState(S2EExecutionState *es, MaxTbSearcherState *plgState)
+{
+    if (plgState->m_queueIndex == NOT_QUEUED) {
+        QueueEntry entry;
+        entry.metric = plgState->m_metric;
+        entry.stateId = es->getID();
+        entry.state = es;
+        entry.plgState = plgState;
+
+        m_queue.push_back(entry);
+        siftUp(m_queue.size() - 1);
+        return;
+    }
+
+    unsigned index = plgState->m_queueIndex;
+    uint64_t oldMetric = m_queue[index].metric;
+    m_queue[index].metric = plgState->m_metric;
+
+    if (plgState->m_metric < oldMetric) {
+        siftUp(index);
+    } else {
+        siftDown(index);
+    }
+}
+
+void MaxTbSearcher::dequeueState(MaxTbSearcherState *plgState)
+{
+    unsigned index = plgState->m_queueIndex;
+    if (index == NOT_QUEUED) {
+        return;
+    }
+
+    plgState->m_queueIndex = NOT_QUEUED;
+
+    QueueEntry last = m_queue.back();
+    m_queue.pop_back();
+    if (index == m_queue.size()) {
+        return;
+    }
+
+    setQueueEntry(index, last);
+    if (index > 0 && last < m_queue[(index - 1) / 2]) {
+        siftUp(index);
+    } else {
+        siftDown(index);
     }
-    return true;
 }
 
 #if 0
@@ -227,52 +374,21 @@ void MaxTbSearcher::onTraceTb(S2EExecutionState* state, uint64_t pc)
     uint64_t tbVa = curModule->ToRelative(state->getTb()->pc);
 
     if (!md) {
-        m_states.erase(state);
-        m_coveredTbs[*curModule][tbVa]++;
         DECLARE_PLUGINSTATE(MaxTbSearcherState, state);
-        plgState->m_metric = m_coveredTbs[*curModule][tbVa];
+        plgState->m_metric = ++getCoveredTbs(*curModule)[tbVa];
         plgState->m_metric *= state->queryCost < 1 ? 1 : state->queryCost;
-        m_states.insert(state);
+        queueState(state, plgState);
         return;
     }
 
     uint64_t newPc = md->ToRelative(state->getPc());
 
-
-    TbMap &tbm = m_coveredTbs[*md];
-    TbMap::iterator NewTbIt = tbm.find(newPc);
-    TbMap::iterator CurTbIt = tbm.find(tbVa);
-
-    unsigned CurTbFreq = 0;
-    //unsigned NewTbFreq = 0;
-
-    bool NextTbIsNew = NewTbIt == tbm.end();
-    bool CurTbIsNew = CurTbIt == tbm.end();
-
-    m_states.erase(state);
-
-    /**
-     * Update the frequency of the current and next
-     * translation blocks
-     */
-    if (CurTbIsNew) {
-      tbm[tbVa] = 1;
-      CurTbFreq = 1;
-    }else {
-      CurTbFreq = (*CurTbIt).second + 1;
-      (*CurTbIt).second++;
-    }
-
-    if (NextTbIsNew && md) {
-      tbm[newPc] = 0;
-    }
-
-    if (NextTbIsNew) {
-      tbm[newPc] = 0;
-    }
+    //Update the frequency of the current translation block
+    TbCounters &tbc = getCoveredTbs(*md);
+    ++tbc[tbVa];
 
     DECLARE_PLUGINSTATE(MaxTbSearcherState, state);
-    plgState->m_metric = tbm[newPc];
+    plgState->m_metric = tbc.get(newPc);
 
 #if 1
     s2e()->getDebugStream() << "Metric for " << hexval(newPc+md->NativeBase) << " = " << plgState->m_metric
@@ -281,14 +397,12 @@ void MaxTbSearcher::onTraceTb(S2EExecutionState* state, uint64_t pc)
 
     plgState->m_metric *= state->queryCost < 1 ? 1 : state->queryCost;
 
-    m_states.insert(state);
+    queueState(state, plgState);
 }
 
 klee::ExecutionState& MaxTbSearcher::selectState()
 {
     //If there are no prioritized states, revert to the parent searcher
-    StateSet::iterator it;
-
 #if 0
     uint64_t absNextPc = 0;
     while((it = m_states.begin()) != m_states.end()) {
@@ -307,13 +421,11 @@ klee::ExecutionState& MaxTbSearcher::selectState()
     }while(absNextPc);
 #endif
 
-    if (m_states.size() > 0) {
-        S2EExecutionState *es = dynamic_cast<S2EExecutionState*>(*m_states.begin());
-        DECLARE_PLUGINSTATE(MaxTbSearcherState, es);
-        if (plgState->m_metric < 2) {
-            return *es;
+    if (!m_queue.empty()) {
+        const QueueEntry &top = m_queue[0];
+        if (top.metric < 2) {
+            return *top.state;
         }
-
     }
 
     return m_parentSearcher->selectState();
@@ -339,13 +451,13 @@ bool MaxTbSearcher::updatePc(S2EExecutionState *es)
     DECLARE_PLUGINSTATE(MaxTbSearcherState, es);
 
     //If not covered, add the forked state to the wait list
-    plgState->m_metric = m_coveredTbs[*md][md->ToRelative(absNextPc)];
+    plgState->m_metric = getCoveredTbs(*md).get(md->ToRelative(absNextPc));
 #if 1
     s2e()->getDebugStream() << "MaxTBSearcher updatePc Metric for " << hexval(md->ToNativeBase(absNextPc)) << " = " << plgState->m_metric
             << '\n';
 #endif
 
-    m_states.insert(es);
+    queueState(es, plgState);
     return true;
 }
 
@@ -357,7 +469,8 @@ void MaxTbSearcher::update(klee::ExecutionState *current,
 
     foreach2(it, removedStates.begin(), removedStates.end()) {
         S2EExecutionState *es = dynamic_cast<S2EExecutionState*>(*it);
-        m_states.erase(es);
+        DECLARE_PLUGINSTATE(MaxTbSearcherState, es);
+        dequeueState(plgState);
     }
 
     foreach2(it, addedStates.begin(), addedStates.end()) {
@@ -368,7 +481,7 @@ void MaxTbSearcher::update(klee::ExecutionState *current,
 
 bool MaxTbSearcher::empty()
 {
-    if (!m_states.empty()) {
+    if (!m_queue.empty()) {
         return false;
     }
 
@@ -378,12 +491,14 @@ bool MaxTbSearcher::empty()
 
 MaxTbSearcherState::MaxTbSearcherState()
 {
-
+    m_metric = 0;
+    m_queueIndex = NOT_QUEUED;
 }
 
 MaxTbSearcherState::MaxTbSearcherState(S2EExecutionState *s, Plugin *p)
 {
     m_metric = 0;
+    m_queueIndex = NOT_QUEUED;
     m_plugin = static_cast<MaxTbSearcher*>(p);
     m_state = s;
 }
@@ -394,7 +509,11 @@ MaxTbSearcherState::~MaxTbSearcherState()
 
 PluginState *MaxTbSearcherState::clone() const
 {
-    return new MaxTbSearcherState(*this);
+    MaxTbSearcherState *ret = new MaxTbSearcherState(*this);
+
+    //The forked state is queued separately by update()
+    ret->m_queueIndex = NOT_QUEUED;
+    return ret;
 }
 
 PluginState *MaxTbSearcherState::factory(Plugin *p, S2EExecutionState *s)
@@ -43,6 +43,7 @@
 
 #include <klee/Searcher.h>
 
+#include <map>
 #include <vector>
 
 namespace s2e {
@@ -54,6 +55,10 @@ class MaxTbSearcherState: public PluginState
 {
 private:
     uint64_t m_metric;
+
+    //Position of the state in the priority queue of MaxTbSearcher
+    unsigned m_queueIndex;
+
     MaxTbSearcher *m_plugin;
     S2EExecutionState *m_state;
 public:
@@ -72,31 +77,35 @@ class MaxTbSearcher : public Plugin, public klee::Searcher
 {
     S2E_PLUGIN
 public:
-    struct MaxTbSorter{
-        Plugin *p;
+    /**
+     *  Maps the module-relative address of a translation block to the
+     *  number of times it was executed. Counters are stored in arrays
+     *  allocated one page of the module image at a time.
+     */
+    class TbCounters {
+    public:
+        TbCounters(uint64_t moduleSize);
+        ~TbCounters();
 
-        MaxTbSorter() {
-            p = NULL;
-        }
+        uint64_t &operator[](uint64_t pc);
+        uint64_t get(uint64_t pc) const;
 
-        bool operator()(const S2EExecutionState *s1, const S2EExecutionState *s2) const{
-            const MaxTbSearcherState *p1 = static_cast<MaxTbSearcherState*>(p->getPluginState(const_cast<S2EExecutionState*>(s1), &MaxTbSearcherState::factory));
-            const MaxTbSearcherState *p2 = static_cast<MaxTbSearcherState*>(p->getPluginState(const_cast<S2EExecutionState*>(s2), &MaxTbSearcherState::factory));
+    private:
+        enum { PAGE_BITS = 12, PAGE_SIZE = 1 << PAGE_BITS };
 
-            if (p1->m_metric == p2->m_metric) {
-                return p1 < p2;
-            }
-            return p1->m_metric < p2->m_metric;
-        }
-    };
+        std::vector<uint64_t*> m_pages;
+
+        //Blocks that lie outside of the module image
+        std::map<uint64_t, uint64_t> m_outside;
 
-    typedef std::set<S2EExecutionState*, MaxTbSorter> StateSet;
+        TbCounters(const TbCounters&);
+        void operator=(const TbCounters&);
+    };
 
-    //Maps a translation block address to the number of times it was executed
-    typedef std::map<uint64_t, uint64_t> TbMap;
-    typedef std::map<ModuleDescriptor, TbMap, ModuleDescriptor::ModuleByName > TbsByModule;
+    typedef std::map<ModuleDescriptor, TbCounters*, ModuleDescriptor::ModuleByName > TbsByModule;
 
     MaxTbSearcher(S2E* s2e): Plugin(s2e) {}
+    virtual ~MaxTbSearcher();
     void initialize();
 
     virtual klee::ExecutionState& selectState();
@@ -114,9 +123,30 @@ private:
     klee::Searcher *m_parentSearcher;
     TbsByModule m_coveredTbs;
 
-    MaxTbSorter m_sorter;
-    StateSet m_states;
+    struct QueueEntry {
+        uint64_t metric;
+        int stateId;
+        S2EExecutionState *state;
+        MaxTbSearcherState *plgState;
+
+        bool operator<(const QueueEntry &e) const {
+            if (metric == e.metric) {
+                return stateId < e.stateId;
+            }
+            return metric < e.metric;
+        }
+    };
+
+    //Binary heap of the prioritized states, the lowest metric first
+    std::vector<QueueEntry> m_queue;
+
+    TbCounters &getCoveredTbs(const ModuleDescriptor &md);
 
+    void queueState(S2EExecutionState *es, MaxTbSearcherState *plgState);
+    void dequeueState(MaxTbSearcherState *plgState);
+    void setQueueEntry(unsigned index, const QueueEntry &entry);
+    void siftUp(unsigned index);
+    void siftDown(unsigned index);
 
     void addTb(S2EExecutionState *s, uint64_t absTargetPc);
     bool isExplored(S2EExecutionState *s, uint64_t absTargetPc);
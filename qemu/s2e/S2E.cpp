@@ -52,6 +52,8 @@ extern CPUArchState *env;
 #include <s2e/Utils.h>
 #include <s2e/S2EExecutor.h>
 #include <s2e/S2EExecutionState.h>
+#include <s2e/Slab.h>
+#include <s2e/SwapStore.h>
 
 #include <s2e/s2e_qemu.h>
 #include <llvm/Support/FileSystem.h>
@@ -183,6 +185,13 @@ void print_stacktrace(void)
 }
 #endif //CONFIG_WIN32
 
+namespace {
+    llvm::cl::opt<bool>
+    UseSlabAllocator("use-slab-allocator",
+            llvm::cl::desc("Allocate small objects from per-thread size-class caches"),
+            llvm::cl::init(false));
+}
+
 namespace s2e {
 
 using namespace std;
@@ -265,8 +274,9 @@ S2E::S2E(int argc, char** argv, TCGLLVMContext *tcgLLVMContext,
     initPlugins();
 
     /* Init the custom memory allocator */
-    //void slab_init();
-    //slab_init();
+    if (UseSlabAllocator) {
+        slab_init();
+    }
 }
 
 void S2E::writeBitCodeToFile()
@@ -293,6 +303,7 @@ S2E::~S2E()
     assert(shared->processIds[m_currentProcessId] == m_currentProcessIndex);
     shared->processIds[m_currentProcessId] = (unsigned) -1;
     shared->processPids[m_currentProcessId] = (unsigned) -1;
+    shared->stateCounts[m_currentProcessId] = 0;
     --shared->currentProcessCount;
 
     m_sync.release();
@@ -300,6 +311,12 @@ S2E::~S2E()
     delete m_pluginsFactory;
     writeBitCodeToFile();
 
+    if (UseSlabAllocator) {
+        std::stringstream ss;
+        slab_print_stats(ss);
+        getDebugStream() << ss.str();
+    }
+
     // KModule wants to delete the llvm::Module in destroyer.
     // llvm::ModuleProvider wants to delete it too. We have to arbitrate.
     //XXX: llvm 3.0. How does it work?
@@ -629,7 +646,7 @@ void S2E::refreshPlugins()
     }
 }
 
-int S2E::fork()
+int S2E::fork(SwapStore *swapStore)
 {
 #ifdef CONFIG_WIN32
     return -1;
@@ -638,6 +655,9 @@ int S2E::fork()
     S2EShared *shared = m_sync.acquire();
     if (shared->currentProcessCount == m_maxProcesses) {
         m_sync.release();
+        if (swapStore) {
+            swapStore->completeFork(false);
+        }
         return -1;
     }
 
@@ -657,9 +677,18 @@ int S2E::fork()
 
         --shared->currentProcessCount;
         m_sync.release();
+        if (swapStore) {
+            swapStore->completeFork(false);
+        }
         return -1;
     }
 
+    if (swapStore) {
+        //The swap file is still shared with the parent, which keeps it.
+        //The child moves to the copy before it can touch the file.
+        swapStore->completeFork(pid == 0);
+    }
+
     if (pid == 0) {
         //Allocate a free slot in the instance map
         shared = m_sync.acquire();
@@ -668,6 +697,7 @@ int S2E::fork()
             if (shared->processIds[i] == (unsigned)-1) {
                 shared->processIds[i] = newProcessIndex;
                 shared->processPids[i] = getpid();
+                shared->stateCounts[i] = 0;
                 m_currentProcessId = i;
                 break;
             }
@@ -735,6 +765,33 @@ unsigned S2E::getCurrentProcessCount()
     return ret;
 }
 
+bool S2E::advertiseStateCount(unsigned stateCount)
+{
+    S2EShared *shared = m_sync.acquire();
+    shared->stateCounts[m_currentProcessId] = stateCount;
+
+    bool ret = false;
+    if (shared->currentProcessCount < m_maxProcesses) {
+        //Only the busiest instance takes the free slot.
+        //Ties are broken in favor of the lowest slot.
+        ret = true;
+        for (unsigned i=0; i<m_maxProcesses; ++i) {
+            if (shared->processIds[i] == (unsigned)-1) {
+                continue;
+            }
+
+            unsigned count = shared->stateCounts[i];
+            if (count > stateCount || (count == stateCount && i < m_currentProcessId)) {
+                ret = false;
+                break;
+            }
+        }
+    }
+
+    m_sync.release();
+    return ret;
+}
+
 unsigned S2E::getProcessIndexForId(unsigned id)
 {
     assert(id < m_maxProcesses);
@@ -761,6 +818,7 @@ bool S2E::checkDeadProcesses()
             //Process is dead, we have to decrement everything
             shared->processIds[i] = (unsigned) -1;
             shared->processPids[i] = (unsigned) -1;
+            shared->stateCounts[i] = 0;
             --shared->currentProcessCount;
             ret = true;
         }
@@ -66,6 +66,7 @@ class PluginsFactory;
 class S2EHandler;
 class S2EExecutor;
 class S2EExecutionState;
+class SwapStore;
 
 class Database;
 
@@ -83,10 +84,16 @@ struct S2EShared {
     //the instance index.
     unsigned processIds[S2E_MAX_PROCESSES];
     unsigned processPids[S2E_MAX_PROCESSES];
+
+    //Number of schedulable states advertised by each instance.
+    //Used to decide which instance hands over states to a free slot.
+    unsigned stateCounts[S2E_MAX_PROCESSES];
+
     S2EShared() {
         for (unsigned i=0; i<S2E_MAX_PROCESSES; ++i)    {
             processIds[i] = (unsigned)-1;
             processPids[i] = (unsigned)-1;
+            stateCounts[i] = 0;
         }
     }
 };
@@ -213,7 +220,9 @@ public:
 
     void writeBitCodeToFile();
 
-    int fork();
+    /* The child moves to the copy of swapStore that was made by
+       SwapStore::prepareFork(), before anything else runs in it */
+    int fork(SwapStore *swapStore = NULL);
     bool isForking() const {
         return m_forking;
     }
@@ -235,6 +244,12 @@ public:
 
     unsigned getCurrentProcessCount();
 
+    /** Advertise the number of schedulable states of this instance.
+        Returns true if there is a free process slot and this instance
+        has the most states, i.e., it should fork to hand over some
+        of its states. */
+    bool advertiseStateCount(unsigned stateCount);
+
     bool checkDeadProcesses();
 
     inline uint64_t getStartTime() const {
@@ -75,18 +75,21 @@ llvm::SmallVector<struct BlockDriverState*, 5> S2EDeviceState::s_blockDevices;
 
 QEMUFile *S2EDeviceState::s_memFile = NULL;
 
+std::vector<uint8_t> S2EDeviceState::s_saveBuffer;
+const S2EDeviceState::DeviceBlob *S2EDeviceState::s_loadBlob = NULL;
+
 bool S2EDeviceState::s_devicesInited=false;
 
 extern "C" {
 
 static int s2e_qemu_get_buffer(uint8_t *buf, int64_t pos, int size)
 {
-    return g_s2e_state->getDeviceState()->getBuffer(buf, pos, size);
+    return S2EDeviceState::getBuffer(buf, pos, size);
 }
 
 static int s2e_qemu_put_buffer(const uint8_t *buf, int64_t pos, int size)
 {
-    return g_s2e_state->getDeviceState()->putBuffer(buf, pos, size);
+    return S2EDeviceState::putBuffer(buf, pos, size);
 }
 
 void s2e_init_device_state(S2EExecutionState *s)
@@ -98,33 +101,25 @@ void s2e_init_device_state(S2EExecutionState *s)
 
 
 S2EDeviceState::S2EDeviceState(const S2EDeviceState &state):
-        m_deviceState(state.m_deviceState)
+        m_devices(state.m_devices),
+        m_cowKey(++state.m_cowKey),
+        m_sectors(state.m_sectors)
 {
-    assert(state.m_stateBuffer);
-    m_stateBuffer = (uint8_t*) malloc(state.m_stateBufferSize);
-    m_stateBufferSize = state.m_stateBufferSize;
-    memcpy(m_stateBuffer, state.m_stateBuffer, m_stateBufferSize);
+    assert(m_devices.size() == s_devices.size());
     s_memFile = state.s_memFile;
 }
 
-S2EDeviceState::S2EDeviceState(klee::ExecutionState *state):m_deviceState(state)
+S2EDeviceState::S2EDeviceState():m_cowKey(1)
 {
-    m_stateBuffer = NULL;
-    m_stateBufferSize = 0;
     s_memFile = NULL;
 }
 
 S2EDeviceState::~S2EDeviceState()
 {
-    if (m_stateBuffer) {
-        free(m_stateBuffer);
-    }
 }
 
 void S2EDeviceState::initDeviceState()
 {
-    m_stateBuffer = NULL;
-    
     assert(!s_devicesInited);
 
     s_memFile = qemu_memfile_open(s2e_qemu_get_buffer, s2e_qemu_put_buffer);
@@ -181,31 +176,46 @@ void S2EDeviceState::initDeviceState()
 
 void S2EDeviceState::saveDeviceState()
 {
-    qemu_make_readable(s_memFile);
+    m_devices.resize(s_devices.size());
 
     //DPRINTF("Saving device state %p\n", this);
     /* Iterate through all device descritors and call
-    * their snapshot function */
-    for (vector<void*>::iterator it = s_devices.begin(); it != s_devices.end(); it++) {
-        void *se = *it;
+    * their snapshot function. Each device is serialized separately,
+    * so that the blobs of devices that did not change can be kept. */
+    for (unsigned i = 0; i < s_devices.size(); ++i) {
+        void *se = s_devices[i];
         //DPRINTF("%s ", s2e_qemu_get_se_idstr(se));
+        s_saveBuffer.clear();
+        qemu_make_readable(s_memFile);
         s2e_qemu_save_state(s_memFile, se);
+        qemu_fflush(s_memFile);
+
+        klee::ref<DeviceBlob> &blob = m_devices[i];
+        if (blob.isNull() || blob->data != s_saveBuffer) {
+            blob = new DeviceBlob(s_saveBuffer);
+        }
     }
     //DPRINTF("\n");
-    qemu_fflush(s_memFile);
 }
 
-void S2EDeviceState::restoreDeviceState()
+void S2EDeviceState::restoreDeviceState(const S2EDeviceState *previous)
 {
-    assert(m_stateBuffer);
+    assert(m_devices.size() == s_devices.size());
 
-    qemu_make_readable(s_memFile);
     //DPRINTF("Restoring device state %p\n", this);
-    for (vector<void*>::iterator it = s_devices.begin(); it != s_devices.end(); it++) {
-        void *se = *it;
-        //DPRINTF("%s ", s2e_qemu_get_se_idstr(se));  
+    for (unsigned i = 0; i < s_devices.size(); ++i) {
+        void *se = s_devices[i];
+
+        if (previous && previous->m_devices[i].get() == m_devices[i].get()) {
+            continue;
+        }
+
+        //DPRINTF("%s ", s2e_qemu_get_se_idstr(se));
+        s_loadBlob = m_devices[i].get();
+        qemu_make_readable(s_memFile);
         s2e_qemu_load_state(s_memFile, se);
     }
+    s_loadBlob = NULL;
     //DPRINTF("\n");
 }
 
@@ -214,43 +224,28 @@ void S2EDeviceState::restoreDeviceState()
 /*****************************************************************************/
 /*****************************************************************************/
 
-void S2EDeviceState::allocateBuffer(unsigned int size)
-{
-    if (size < m_stateBufferSize) {
-        return;
-    }
-
-    /* Need to expand the buffer */
-    uint8_t *new_buffer = (uint8_t*) realloc(m_stateBuffer, size);
-    if (!new_buffer) {
-        cerr << "Cannot reallocate memory for device state snapshot" << endl;
-        exit(-1);
-    }
-    m_stateBuffer = new_buffer;
-    m_stateBufferSize = size;
-}
-
 int S2EDeviceState::putBuffer(const uint8_t *buf, int64_t pos, int size)
 {
-    uint8_t *dest;
-
-    allocateBuffer(pos + size);
-    dest = &m_stateBuffer[pos];
+    if ((uint64_t) (pos + size) > s_saveBuffer.size()) {
+        s_saveBuffer.resize(pos + size);
+    }
 
-    memcpy(dest, buf, size);
+    memcpy(&s_saveBuffer[pos], buf, size);
     return size;
 }
 
 int S2EDeviceState::getBuffer(uint8_t *buf, int64_t pos, int size)
 {
-    assert(m_stateBuffer);
-    int toCopy = pos + size <= m_stateBufferSize ? size : m_stateBufferSize - pos;
-    memcpy(buf, &m_stateBuffer[pos], toCopy);
+    assert(s_loadBlob);
+    const std::vector<uint8_t> &data = s_loadBlob->data;
+
+    //QEMU reads ahead past the end of the device data
+    int toCopy = 0;
+    if (pos < (int64_t) data.size()) {
+        toCopy = pos + size <= (int64_t) data.size() ? size : data.size() - pos;
+        memcpy(buf, &data[pos], toCopy);
+    }
     return size;
-
-
-    //memcpy(buf, &m_state[pos], toCopy);
-    //return toCopy;
 }
 
 
@@ -271,57 +266,71 @@ unsigned S2EDeviceState::getBlockDeviceId(struct BlockDriverState* dev)
     return i;
 }
 
-uint64_t S2EDeviceState::getBlockDeviceStart(struct BlockDriverState* dev)
-{
-    unsigned id = getBlockDeviceId(dev);
-    return id * BLOCK_DEV_AS;
-}
-
 /* Return 0 upon success */
 int S2EDeviceState::writeSector(struct BlockDriverState *bs, int64_t sector, const uint8_t *buf, int nb_sectors)
 {
-    uint64_t bstart = getBlockDeviceStart(bs);
+    unsigned deviceId = getBlockDeviceId(bs);
 
     while (nb_sectors > 0) {
-        uintptr_t address = (uintptr_t) bstart + sector * SECTOR_SIZE;
-        ObjectPair op = m_deviceState.findObject(address);
-        if (op.first == NULL) {
-            MemoryObject *mo = new MemoryObject(address, SECTOR_SIZE, false, false, false, NULL);
-            ObjectState *os = new ObjectState(mo);
-            m_deviceState.bindObject(mo, os);
-            op.first = mo;
-            op.second = os;
+        uint64_t key = getClusterKey(deviceId, sector);
+        unsigned first = sector % CLUSTER_SECTORS;
+        unsigned count = CLUSTER_SECTORS - first;
+        if (count > (unsigned) nb_sectors) {
+            count = nb_sectors;
+        }
+
+        SectorCluster *cluster;
+        const SectorClusterMap::value_type *res = m_sectors.lookup(key);
+        if (res && res->second->owner == m_cowKey) {
+            cluster = res->second.get();
+        } else {
+            cluster = res ? new SectorCluster(*res->second, m_cowKey) :
+                            new SectorCluster(m_cowKey);
+            m_sectors = m_sectors.replace(std::make_pair(key, klee::ref<SectorCluster>(cluster)));
         }
 
-        ObjectState *os = m_deviceState.getWriteable(op.first, op.second);
-        memcpy(os->getConcreteStore(false), buf, SECTOR_SIZE);
-        buf += SECTOR_SIZE;
-        --nb_sectors;
-        ++sector;
+        memcpy(&cluster->data[first * SECTOR_SIZE], buf, count * SECTOR_SIZE);
+        cluster->validMask |= ((1 << count) - 1) << first;
+
+        buf += count * SECTOR_SIZE;
+        nb_sectors -= count;
+        sector += count;
     }
 
     return 0;
 }
 
-/* Return the number of sectors that could be read from the local store */
+/* Return the number of sectors that could be read from the local store.
+   Sectors that are not in the store are left untouched in buf. */
 int S2EDeviceState::readSector(struct BlockDriverState *bs, int64_t sector, uint8_t *buf, int nb_sectors)
 {
     int readCount = 0;
 
-    uint64_t bstart = getBlockDeviceStart(bs);
+    unsigned deviceId = getBlockDeviceId(bs);
 
     while (nb_sectors > 0) {
-        uintptr_t address = (uintptr_t) bstart + sector * SECTOR_SIZE;
-        ObjectPair op = m_deviceState.findObject(address);
-        if (!op.first) {
-            return readCount;
+        uint64_t key = getClusterKey(deviceId, sector);
+        unsigned first = sector % CLUSTER_SECTORS;
+        unsigned count = CLUSTER_SECTORS - first;
+        if (count > (unsigned) nb_sectors) {
+            count = nb_sectors;
+        }
+
+        const SectorClusterMap::value_type *res = m_sectors.lookup(key);
+        if (res) {
+            const SectorCluster *cluster = res->second.get();
+            for (unsigned i = 0; i < count; ++i) {
+                if (cluster->validMask & (1 << (first + i))) {
+                    memcpy(&buf[i * SECTOR_SIZE],
+                           &cluster->data[(first + i) * SECTOR_SIZE], SECTOR_SIZE);
+                    ++readCount;
+                }
+            }
         }
 
-        memcpy(buf, op.second->getConcreteStore(false), SECTOR_SIZE);
-        buf += SECTOR_SIZE;
-        ++readCount;
-        --nb_sectors;
-        ++sector;
+        buf += count * SECTOR_SIZE;
+        nb_sectors -= count;
+        sector += count;
     }
 
     return readCount;
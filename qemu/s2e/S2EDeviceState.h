@@ -47,7 +47,8 @@ extern "C" {
 #include <stdint.h>
 #include <llvm/ADT/SmallVector.h>
 
-#include <klee/AddressSpace.h>
+#include <klee/util/Ref.h>
+#include <klee/Internal/ADT/ImmutableMap.h>
 
 #include "s2e_block.h"
 
@@ -59,8 +60,12 @@ class S2EDeviceState {
 private:
     static const unsigned SECTOR_SIZE = 512;
 
-    /* Give 64GB of KLEE address space for each block device */
-    static const uint64_t BLOCK_DEV_AS = (1024 * 1024 * 1024) * 64;
+    /* Written sectors are stored in clusters of consecutive sectors */
+    static const unsigned CLUSTER_SECTORS = 8;
+    static const unsigned CLUSTER_SIZE = CLUSTER_SECTORS * SECTOR_SIZE;
+
+    /* Bits of the cluster key that hold the cluster index in the device */
+    static const unsigned CLUSTER_KEY_BITS = 48;
 
     static std::vector<void *> s_devices;
     static std::set<std::string> s_customDevices;
@@ -68,37 +73,87 @@ private:
 
     static QEMUFile *s_memFile;
 
-    uint8_t *m_stateBuffer;
-    unsigned m_stateBufferSize;
+    /**
+     * Serialized state of one device. Blobs are never modified once
+     * created, which allows states that forked from each other to share
+     * the blobs of devices whose state did not change.
+     */
+    struct DeviceBlob {
+        unsigned refCount;
+        std::vector<uint8_t> data;
+
+        DeviceBlob(const std::vector<uint8_t> &_data):
+            refCount(0), data(_data) {}
+    };
+
+    typedef std::vector<klee::ref<DeviceBlob> > DeviceBlobs;
+
+    /* Scratch buffer in which QEMU serializes the device being saved */
+    static std::vector<uint8_t> s_saveBuffer;
+
+    /* Blob from which QEMU loads the device being restored */
+    static const DeviceBlob *s_loadBlob;
+
+    /* One entry per device in s_devices */
+    DeviceBlobs m_devices;
+
+
+    /**
+     * Sectors written to a block device by one state.
+     * A cluster may be modified in place only by the state whose
+     * copy-on-write key matches the owner of the cluster.
+     */
+    struct SectorCluster {
+        unsigned refCount;
+        unsigned owner;
 
+        /* Bit i is set if sector i of the cluster was written */
+        uint32_t validMask;
+        uint8_t data[CLUSTER_SIZE];
+
+        SectorCluster(unsigned _owner):
+            refCount(0), owner(_owner), validMask(0) {}
+
+        SectorCluster(const SectorCluster &c, unsigned _owner):
+            refCount(0), owner(_owner), validMask(c.validMask) {
+            memcpy(data, c.data, CLUSTER_SIZE);
+        }
+    };
+
+    /* Maps (device id, cluster index) keys to clusters. The map is
+       persistent, cloning a state shares all of its nodes. */
+    typedef klee::ImmutableMap<uint64_t, klee::ref<SectorCluster> > SectorClusterMap;
 
     static llvm::SmallVector<struct BlockDriverState*, 5> s_blockDevices;
-    klee::AddressSpace m_deviceState;
 
-    void allocateBuffer(unsigned int Sz);
+    /* Same copy-on-write scheme as klee::AddressSpace */
+    mutable unsigned m_cowKey;
+    SectorClusterMap m_sectors;
 
     static unsigned getBlockDeviceId(struct BlockDriverState* dev);
-    static uint64_t getBlockDeviceStart(struct BlockDriverState* dev);
+
+    static uint64_t getClusterKey(unsigned deviceId, uint64_t sector) {
+        return ((uint64_t) deviceId << CLUSTER_KEY_BITS) | (sector / CLUSTER_SECTORS);
+    }
 
 public:
-    S2EDeviceState(klee::ExecutionState *state);
+    S2EDeviceState();
     S2EDeviceState(const S2EDeviceState &state);
     ~S2EDeviceState();
 
-    void setExecutionState(klee::ExecutionState *state) {
-        m_deviceState.state = state;
-    }
-
     void initDeviceState();
 
     //From QEMU to KLEE
     void saveDeviceState();
     
     //From KLEE to QEMU
-    void restoreDeviceState();
+    //If QEMU currently holds the device state that was last saved
+    //into previous, devices whose state is shared with previous are
+    //not reloaded.
+    void restoreDeviceState(const S2EDeviceState *previous = NULL);
 
-    int putBuffer(const uint8_t *buf, int64_t pos, int size);
-    int getBuffer(uint8_t *buf, int64_t pos, int size);
+    static int putBuffer(const uint8_t *buf, int64_t pos, int size);
+    static int getBuffer(uint8_t *buf, int64_t pos, int size);
 
     int writeSector(struct BlockDriverState *bs, int64_t sector, const uint8_t *buf, int nb_sectors);
     int readSector(struct BlockDriverState *bs, int64_t sector, uint8_t *buf, int nb_sectors);
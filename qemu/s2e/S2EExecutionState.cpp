@@ -106,7 +106,6 @@ S2EExecutionState::S2EExecutionState(klee::KFunction *kf) :
         m_symbexEnabled(true), m_startSymbexAtPC((uint64_t) -1),
         m_active(true), m_zombie(false), m_yielded(false), m_runningConcrete(true),
         m_cpuRegistersObject(NULL), m_cpuSystemObject(NULL),
-        m_deviceState(this),
         m_qemuIcount(0),
         m_lastS2ETb(NULL),
         m_lastMergeICount((uint64_t)-1),
@@ -124,7 +123,7 @@ S2EExecutionState::~S2EExecutionState()
 {
     assert(m_lastS2ETb == NULL);
 
-    PluginStateMap::iterator it;
+    PluginStateVector::iterator it;
 
     if (VerboseStateDeletion) {
         g_s2e->getDebugStream() << "Deleting state " << m_stateID << " " << this << '\n';
@@ -133,7 +132,7 @@ S2EExecutionState::~S2EExecutionState()
     //print_stacktrace();
 
     for(it = m_PluginState.begin(); it != m_PluginState.end(); ++it) {
-        delete it->second;
+        delete *it;
     }
 
     g_s2e->refreshPlugins();
@@ -315,7 +314,6 @@ ExecutionState* S2EExecutionState::clone()
     clearTlbOwnership();
     S2EExecutionState *ret = new S2EExecutionState(*this);
     ret->addressSpace.state = ret;
-    ret->m_deviceState.setExecutionState(ret);
 
     if(m_lastS2ETb)
         m_lastS2ETb->refCount += 1;
@@ -326,10 +324,10 @@ ExecutionState* S2EExecutionState::clone()
     *ret->m_timersState = *m_timersState;
 
     // Clone the plugins
-    PluginStateMap::iterator it;
-    ret->m_PluginState.clear();
-    for(it = m_PluginState.begin(); it != m_PluginState.end(); ++it) {
-        ret->m_PluginState.insert(std::make_pair((*it).first, (*it).second->clone()));
+    for(unsigned i = 0; i < m_PluginState.size(); ++i) {
+        if (m_PluginState[i]) {
+            ret->m_PluginState[i] = m_PluginState[i]->clone();
+        }
     }
 
     // This objects are not in TLB and won't cause any changes to it
@@ -1266,17 +1264,15 @@ void S2EExecutionState::readRamConcreteCheck(uint64_t hostAddress, uint8_t* buf,
                op.first->address == page_addr &&
                op.first->size == S2E_RAM_OBJECT_SIZE);
 
-        for(uint64_t i=0; i<size; ++i) {
-            if(!op.second->readConcrete8(page_offset+i, buf+i)) {
-                if (PrintModeSwitch) {
-                    g_s2e->getMessagesStream()
-                            << "Switching to KLEE executor at pc = "
-                            << hexval(getPc()) << '\n';
-                }
-                m_startSymbexAtPC = getPc();
-                // XXX: what about regs_to_env ?
-                s2e_longjmp(env->jmp_env, 1);
+        if(!op.second->readConcrete(page_offset, buf, size)) {
+            if (PrintModeSwitch) {
+                g_s2e->getMessagesStream()
+                        << "Switching to KLEE executor at pc = "
+                        << hexval(getPc()) << '\n';
             }
+            m_startSymbexAtPC = getPc();
+            // XXX: what about regs_to_env ?
+            s2e_longjmp(env->jmp_env, 1);
         }
     } else {
         /* Access spans multiple MemoryObject's */
@@ -1307,6 +1303,11 @@ void S2EExecutionState::readRamConcrete(uint64_t hostAddress, uint8_t* buf, uint
                op.first->address == page_addr &&
                op.first->size == S2E_RAM_OBJECT_SIZE);
 
+        if(op.second->readConcrete(page_offset, buf, size)) {
+            return;
+        }
+
+        /* Mixed range, concretize the symbolic bytes */
         ObjectState *wos = NULL;
         for(uint64_t i=0; i<size; ++i) {
             if(!op.second->readConcrete8(page_offset+i, buf+i)) {
@@ -1350,9 +1351,7 @@ void S2EExecutionState::writeRamConcrete(uint64_t hostAddress, const uint8_t* bu
 
         ObjectState* wos =
                 addressSpace.getWriteable(op.first, op.second);
-        for(uint64_t i=0; i<size; ++i) {
-            wos->write8(page_offset+i, buf[i]);
-        }
+        wos->writeConcrete(page_offset, buf, size);
 
     } else {
         /* Access spans multiple MemoryObject's */
@@ -1936,7 +1935,7 @@ void S2EExecutionState::dmaRead(uint64_t hostAddress, uint8_t *buf, unsigned siz
         }
         assert(op.first && op.second && op.first->address == hostPage);
         ObjectState *os = const_cast<ObjectState*>(op.second);
-        uint8_t *concreteStore;
+        const uint8_t *concreteStore;
 
         unsigned offset = hostAddress & (S2E_RAM_OBJECT_SIZE-1);
 
@@ -1944,7 +1943,8 @@ void S2EExecutionState::dmaRead(uint64_t hostAddress, uint8_t *buf, unsigned siz
             concreteStore = (uint8_t*)op.first->address;
             memcpy(buf, concreteStore + offset, length);
         } else {
-            concreteStore = os->getConcreteStore(true);
+            /* Read through the const accessor, the store may be shared */
+            concreteStore = op.second->getConcreteStore(true);
             for (unsigned i=0; i<length; ++i) {
                 if (_s2e_check_concrete(os, offset+i, 1)) {
                     buf[i] = concreteStore[offset+i];
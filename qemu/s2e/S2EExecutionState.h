@@ -39,6 +39,7 @@
 #include <klee/ExecutionState.h>
 #include <klee/Memory.h>
 #include <cpu.h>
+#include "Plugin.h"
 #include "S2EDeviceState.h"
 #include "S2EStatsTracker.h"
 #include "MemoryCache.h"
@@ -86,8 +87,8 @@ class S2EDeviceState;
 class S2EExecutionState;
 struct S2ETranslationBlock;
 
-//typedef std::tr1::unordered_map<const Plugin*, PluginState*> PluginStateMap;
-typedef std::map<const Plugin*, PluginState*> PluginStateMap;
+/* Plugin states indexed by Plugin::getPluginStateSlot() */
+typedef std::vector<PluginState*> PluginStateVector;
 typedef PluginState* (*PluginStateFactory)(Plugin *p, S2EExecutionState *s);
 
 typedef MemoryCachePool<klee::ObjectPair,
@@ -111,13 +112,14 @@ class S2EExecutionState : public klee::ExecutionState
 {
 protected:
     friend class S2EExecutor;
+    friend class S2EStatsTracker;
 
     static unsigned s_lastSymbolicId;
 
     /** Unique numeric ID for the state */
     int m_stateID;
 
-    PluginStateMap m_PluginState;
+    PluginStateVector m_PluginState;
 
     bool m_symbexEnabled;
 
@@ -222,14 +224,19 @@ public:
     /*************************************************/
 
     PluginState* getPluginState(Plugin *plugin, PluginStateFactory factory) {
-        PluginStateMap::iterator it = m_PluginState.find(plugin);
-        if (it == m_PluginState.end()) {
-            PluginState *ret = factory(plugin, this);
-            assert(ret);
-            m_PluginState[plugin] = ret;
-            return ret;
+        unsigned slot = plugin->getPluginStateSlot();
+        if (slot < m_PluginState.size() && m_PluginState[slot]) {
+            return m_PluginState[slot];
         }
-        return (*it).second;
+
+        //The factory may create the states of other plugins
+        PluginState *ret = factory(plugin, this);
+        assert(ret);
+        if (slot >= m_PluginState.size()) {
+            m_PluginState.resize(slot + 1, NULL);
+        }
+        m_PluginState[slot] = ret;
+        return ret;
     }
 
     /** Returns true if this is the active state */
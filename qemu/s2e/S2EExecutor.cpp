@@ -85,6 +85,7 @@ uint64_t helper_set_cc_op_eflags(void);
 #include <s2e/S2EDeviceState.h>
 #include <s2e/SelectRemovalPass.h>
 #include <s2e/S2EStatsTracker.h>
+#include <s2e/SwapStore.h>
 
 //XXX: Remove this from executor
 #include <s2e/Plugins/ModuleExecutionDetector.h>
@@ -115,6 +116,7 @@ uint64_t helper_set_cc_op_eflags(void);
 
 #include <llvm/Support/TimeValue.h>
 
+#include <algorithm>
 #include <vector>
 
 #include <sstream>
@@ -170,6 +172,55 @@ namespace {
                      " disabling leads to faster but possibly incorrect execution"),
             cl::init(true));
 
+    cl::opt<bool>
+    CopyModifiedPagesOnly("state-switch-copy-modified-pages-only",
+            cl::desc("Only save/restore the RAM pages that differ between"
+                     " the old and the new state on state switches"),
+            cl::init(true));
+
+    cl::opt<bool>
+    TrackRamWrites("state-switch-track-ram-writes",
+            cl::desc("Write-protect the RAM after state switches to find the"
+                     " pages to save without comparing all of them"
+                     " (requires state-switch-copy-modified-pages-only)"),
+            cl::init(true));
+
+    cl::opt<bool>
+    SpeculativeLLVMTranslation("speculative-llvm-translation",
+            cl::desc("Generate LLVM code for hot translation blocks"
+                     " while the guest is idle"),
+            cl::init(false));
+
+    cl::opt<unsigned>
+    SpeculativeLLVMThreshold("speculative-llvm-threshold",
+            cl::desc("Number of concrete executions after which a translation"
+                     " block is queued for speculative LLVM translation"),
+            cl::init(64));
+
+    cl::opt<unsigned>
+    LLVMOptimizationThreshold("llvm-optimization-threshold",
+            cl::desc("Run only cheap optimizations on new translation blocks"
+                     " and fully optimize them after this many symbolic"
+                     " executions (0=fully optimize right away)"),
+            cl::init(0));
+
+    cl::opt<bool>
+    StateSwap("state-swap",
+            cl::desc("Keep the memory of execution states in a swap file and"
+                     " swap out idle states when exceeding max-memory"),
+            cl::init(false));
+
+    cl::opt<std::string>
+    StateSwapDir("state-swap-dir",
+            cl::desc("Directory of the state swap file"
+                     " (default: the output directory)"),
+            cl::init(""));
+
+    cl::opt<unsigned>
+    StateSwapInterval("state-swap-interval",
+            cl::desc("Minimum number of seconds between two swap-outs"),
+            cl::init(10));
+
     cl::opt<bool>
     KeepLLVMFunctions("keep-llvm-functions",
             cl::desc("Never delete generated LLVM functions"),
@@ -286,6 +337,82 @@ public:
     void removeFunction(llvm::Function *f);
 };
 
+/**
+ * Write tracking of the RAM saved on state switches. The host pages are
+ * write-protected once their content matches the object states of the
+ * active state. The first write to a page faults, which marks the page as
+ * dirty and unprotects it. Saving a state then only looks at dirty pages.
+ * Guest RAM is only written from the main thread (S2E always uses bounce
+ * buffers for DMA), so the fault handler does not need locking.
+ */
+struct TrackedRamRegion {
+    uint64_t hostAddress;
+    uint64_t size;
+    /* Index of the first object of the region in m_saveOnContextSwitch */
+    unsigned firstObject;
+    /* Index of the first page of the region in s_ramPageDirty */
+    unsigned firstPage;
+};
+
+static std::vector<TrackedRamRegion> s_trackedRamRegions;
+static std::vector<uint8_t> s_ramPageDirty;
+/* Indices of the dirty pages, s_ramDirtyPageCount of them are valid */
+static std::vector<unsigned> s_ramDirtyPages;
+static volatile unsigned s_ramDirtyPageCount;
+static uint64_t s_hostPageSize;
+static bool s_ramWriteTrackingActive;
+
+#ifndef _WIN32
+static struct sigaction s_ramWriteFaultActionOld;
+
+/* Returns true if the fault was caused by a write to a tracked page */
+static bool s2e_ram_write_fault(void *address)
+{
+    if (!s_ramWriteTrackingActive) {
+        return false;
+    }
+
+    uint64_t addr = (uint64_t) (uintptr_t) address;
+    for (unsigned i = 0; i < s_trackedRamRegions.size(); ++i) {
+        const TrackedRamRegion &region = s_trackedRamRegions[i];
+        if (addr < region.hostAddress ||
+            addr >= region.hostAddress + region.size) {
+            continue;
+        }
+
+        uint64_t page = addr & ~(s_hostPageSize - 1);
+        unsigned index = region.firstPage +
+                (page - region.hostAddress) / s_hostPageSize;
+        if (!s_ramPageDirty[index]) {
+            s_ramPageDirty[index] = 1;
+            s_ramDirtyPages[s_ramDirtyPageCount++] = index;
+        }
+        mprotect((void*) page, s_hostPageSize, PROT_READ | PROT_WRITE);
+        return true;
+    }
+
+    return false;
+}
+
+static void s2e_ram_write_fault_handler(int signal, siginfo_t *info, void *context)
+{
+    if (s2e_ram_write_fault(info->si_addr)) {
+        return;
+    }
+
+    /* Not a tracked page, let the previous handler deal with it. The
+       default action is triggered again when the access is retried. */
+    if (s_ramWriteFaultActionOld.sa_flags & SA_SIGINFO) {
+        s_ramWriteFaultActionOld.sa_sigaction(signal, info, context);
+    } else if (s_ramWriteFaultActionOld.sa_handler == SIG_DFL ||
+               s_ramWriteFaultActionOld.sa_handler == SIG_IGN) {
+        sigaction(SIGSEGV, &s_ramWriteFaultActionOld, NULL);
+    } else {
+        s_ramWriteFaultActionOld.sa_handler(signal);
+    }
+}
+#endif
+
 extern "C" {
 
 // FIXME: This is not reentrant.
@@ -298,6 +425,8 @@ static void s2e_ext_sigsegv_handler(int signal)
 }
 #else
 static void s2e_ext_sigsegv_handler(int signal, siginfo_t *info, void *context) {
+  if (s2e_ram_write_fault(info->si_addr))
+    return;
   s2e_longjmp(s2e_escapeCallJmpBuf, 1);
 }
 #endif
@@ -621,7 +750,8 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
         : Executor(opts, ie, tcgLLVMContext->getExecutionEngine()),
           m_s2e(s2e), m_tcgLLVMContext(tcgLLVMContext),
           m_executeAlwaysKlee(false), m_forkProcTerminateCurrentState(false),
-          m_inLoadBalancing(false), yieldedState(NULL)
+          m_inLoadBalancing(false), yieldedState(NULL),
+          m_swapStore(NULL), m_lastSwapOut(0)
 {
     delete externalDispatcher;
     externalDispatcher = new S2EExternalDispatcher(
@@ -769,11 +899,32 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
     }
 #endif
 
+    if (StateSwap) {
+        std::string dir = StateSwapDir.empty() ?
+                    m_s2e->getOutputDirectory() : StateSwapDir;
+
+        //The store is never deleted, object states may outlive the executor
+        m_swapStore = new SwapStore(dir, S2E_RAM_OBJECT_SIZE, 64 * 1024 * 1024);
+        if (m_swapStore->initialize()) {
+            ObjectState::setConcreteStoreAllocator(m_swapStore);
+            if (!getMaxMemory()) {
+                m_s2e->getWarningsStream()
+                        << "State swapping requires --max-memory\n";
+            }
+        } else {
+            m_s2e->getWarningsStream() << "Could not create the state swap file\n";
+            delete m_swapStore;
+            m_swapStore = NULL;
+        }
+    }
+
     if(UseSelectCleaner) {
         m_tcgLLVMContext->getFunctionPassManager()->add(new SelectRemovalPass());
         m_tcgLLVMContext->getFunctionPassManager()->doInitialization();
     }
 
+    m_tcgLLVMContext->setTieredOptimization(LLVMOptimizationThreshold > 0);
+
     ModuleOptions MOpts = ModuleOptions(vector<string>(),
                                         /* Optimize= */ true, /* CheckDivZero= */ false);
     /* Set module for the executor */
@@ -1060,6 +1211,7 @@ void S2EExecutor::registerCpu(S2EExecutionState *initialState,
     initialState->m_cpuSystemState->setName("CpuSystemState");
 
     m_saveOnContextSwitch.push_back(initialState->m_cpuSystemState);
+    m_untrackedSaveOnContextSwitch.push_back(initialState->m_cpuSystemState);
 
     const ObjectState *cpuSystemObject = initialState->addressSpace
                                 .findObject(initialState->m_cpuSystemState);
@@ -1095,6 +1247,9 @@ void S2EExecutor::registerRam(S2EExecutionState *initialState,
     qemu_log("\t host_address: %"PRIx64".\n", hostAddress);
 #endif
 
+    bool saved = isSharedConcrete && (saveOnContextSwitch || !StateSharedMemory);
+    bool tracked = saved && trackRamWrites(hostAddress, size);
+
     for(uint64_t addr = hostAddress; addr < hostAddress+size;
                  addr += S2E_RAM_OBJECT_SIZE) {
         std::stringstream ss;
@@ -1119,8 +1274,11 @@ void S2EExecutor::registerRam(S2EExecutionState *initialState,
 
         mo->setName(ss.str());
 
-        if (isSharedConcrete && (saveOnContextSwitch || !StateSharedMemory)) {
+        if (saved) {
             m_saveOnContextSwitch.push_back(mo);
+            if (!tracked) {
+                m_untrackedSaveOnContextSwitch.push_back(mo);
+            }
         }
     }
 
@@ -1153,6 +1311,7 @@ void S2EExecutor::registerDirtyMask(S2EExecutionState *initial_state, uint64_t h
     initial_state->m_dirtyMask->setName("dirtyMask");
 
     m_saveOnContextSwitch.push_back(initial_state->m_dirtyMask);
+    m_untrackedSaveOnContextSwitch.push_back(initial_state->m_dirtyMask);
 
     const ObjectState *dirtyMaskObject = initial_state->addressSpace
                                 .findObject(initial_state->m_dirtyMask);
@@ -1241,12 +1400,7 @@ bool S2EExecutor::copyInConcretes(klee::ExecutionState &state)
 
 void S2EExecutor::doLoadBalancing()
 {
-    if (states.size() < 2) {
-        return;
-    }
-
-    //Don't bother copying stuff if it's obvious that it'll very likely fail
-    if (m_s2e->getCurrentProcessCount() == m_s2e->getMaxProcesses()) {
+    if (m_s2e->getMaxProcesses() == 1) {
         return;
     }
 
@@ -1259,6 +1413,12 @@ void S2EExecutor::doLoadBalancing()
         }
     }
 
+    //Let the other instances know how much work we have, so that
+    //free process slots go to the instance with the most states.
+    if (!m_s2e->advertiseStateCount(allStates.size())) {
+        return;
+    }
+
     if (allStates.size() < 2) {
         return;
     }
@@ -1269,9 +1429,18 @@ void S2EExecutor::doLoadBalancing()
 
     vm_stop(RUN_STATE_SAVE_VM);
 
+    //The swap file would be shared with the child. Copy it now, the
+    //child moves to the copy as soon as it starts, the parent keeps it.
+    if (m_swapStore && !m_swapStore->prepareFork()) {
+        m_inLoadBalancing = false;
+        vm_start();
+        return;
+    }
+
     unsigned parentId = m_s2e->getCurrentProcessIndex();
     m_s2e->getCorePlugin()->onProcessFork.emit(true, false, -1);
-    int child = m_s2e->fork();
+    int child = m_s2e->fork(m_swapStore);
+
     if (child < 0) {
         //Fork did not succeed
         m_s2e->getCorePlugin()->onProcessFork.emit(false, false, -1);
@@ -1324,6 +1493,206 @@ void S2EExecutor::initializeStateSwitchTimer()
     qemu_mod_timer(m_stateSwitchTimer, qemu_get_clock_ms(host_clock) + 100);
 }
 
+/* Returns the number of bytes copied from the host into the state */
+static uint64_t saveSharedConcreteObject(S2EExecutionState *state,
+                                         const MemoryObject *mo)
+{
+    const ObjectState *os = state->addressSpace.findObject(mo);
+
+    /**
+     * Calling getWriteable() on an object state that is shared with
+     * another state duplicates it. Unmodified pages must therefore be
+     * skipped, which also lets restoreSharedConcreteMemory() detect
+     * them by comparing object state pointers.
+     */
+    if (CopyModifiedPagesOnly) {
+        const uint8_t *store = os->getConcreteStore();
+        assert(store);
+        if (!memcmp(store, (uint8_t*) mo->address, mo->size)) {
+            return 0;
+        }
+    }
+
+    ObjectState *wos = state->addressSpace.getWriteable(mo, os);
+    uint8_t *store = wos->getConcreteStore();
+    assert(store);
+    memcpy(store, (uint8_t*) mo->address, mo->size);
+    return mo->size;
+}
+
+static const TrackedRamRegion &findTrackedRamRegion(unsigned page)
+{
+    for (unsigned i = 0; i < s_trackedRamRegions.size(); ++i) {
+        const TrackedRamRegion &region = s_trackedRamRegions[i];
+        if (page >= region.firstPage &&
+            page < region.firstPage + region.size / s_hostPageSize) {
+            return region;
+        }
+    }
+
+    assert(false && "page is not tracked");
+    abort();
+}
+
+void S2EExecutor::saveSharedConcreteMemory(S2EExecutionState *state,
+                                           const MemoryObject *skip,
+                                           uint64_t *bytesCopied)
+{
+    uint64_t copied = 0;
+
+    if (s_ramWriteTrackingActive) {
+        /* Pages that were not written still match the object states */
+        unsigned objectsPerPage = s_hostPageSize / S2E_RAM_OBJECT_SIZE;
+        for (unsigned i = 0; i < s_ramDirtyPageCount; ++i) {
+            unsigned page = s_ramDirtyPages[i];
+            const TrackedRamRegion &region = findTrackedRamRegion(page);
+            unsigned first = region.firstObject +
+                    (page - region.firstPage) * objectsPerPage;
+            for (unsigned j = 0; j < objectsPerPage; ++j) {
+                copied += saveSharedConcreteObject(state,
+                                                   m_saveOnContextSwitch[first + j]);
+            }
+        }
+
+        foreach(MemoryObject* mo, m_untrackedSaveOnContextSwitch) {
+            if(mo != skip)
+                copied += saveSharedConcreteObject(state, mo);
+        }
+    } else {
+        foreach(MemoryObject* mo, m_saveOnContextSwitch) {
+            if(mo != skip)
+                copied += saveSharedConcreteObject(state, mo);
+        }
+    }
+
+    if (bytesCopied) {
+        *bytesCopied = copied;
+    }
+}
+
+/** Returns true if the objects of the given RAM region will be saved
+    through write tracking. Must be called before the objects are added to
+    m_saveOnContextSwitch. */
+bool S2EExecutor::trackRamWrites(uint64_t hostAddress, uint64_t size)
+{
+#ifdef _WIN32
+    return false;
+#else
+    if (!TrackRamWrites || !CopyModifiedPagesOnly || s_ramWriteTrackingActive) {
+        return false;
+    }
+
+    if (!s_hostPageSize) {
+        s_hostPageSize = sysconf(_SC_PAGESIZE);
+    }
+
+    if ((hostAddress | size) & (s_hostPageSize - 1) ||
+        s_hostPageSize % S2E_RAM_OBJECT_SIZE) {
+        return false;
+    }
+
+    TrackedRamRegion region;
+    region.hostAddress = hostAddress;
+    region.size = size;
+    region.firstObject = m_saveOnContextSwitch.size();
+    region.firstPage = s_ramPageDirty.size();
+    s_trackedRamRegions.push_back(region);
+
+    s_ramPageDirty.resize(s_ramPageDirty.size() + size / s_hostPageSize, 0);
+    s_ramDirtyPages.resize(s_ramPageDirty.size());
+    return true;
+#endif
+}
+
+/** Write-protect the tracked RAM once the host memory holds the content
+    of the object states of the active state. */
+void S2EExecutor::resetRamWriteTracking()
+{
+#ifndef _WIN32
+    if (s_trackedRamRegions.empty()) {
+        return;
+    }
+
+    if (!s_ramWriteTrackingActive) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_SIGINFO;
+        action.sa_sigaction = s2e_ram_write_fault_handler;
+        sigaction(SIGSEGV, &action, &s_ramWriteFaultActionOld);
+
+        foreach(const TrackedRamRegion &region, s_trackedRamRegions) {
+            if (mprotect((void*) region.hostAddress, region.size, PROT_READ) < 0) {
+                m_s2e->getWarningsStream()
+                        << "Could not write-protect RAM, saving all pages on state switches\n";
+                foreach(const TrackedRamRegion &r, s_trackedRamRegions) {
+                    mprotect((void*) r.hostAddress, r.size, PROT_READ | PROT_WRITE);
+                }
+                sigaction(SIGSEGV, &s_ramWriteFaultActionOld, NULL);
+                s_trackedRamRegions.clear();
+                return;
+            }
+        }
+
+        s_ramWriteTrackingActive = true;
+        return;
+    }
+
+    /* Protect runs of consecutive pages with a single call */
+    std::sort(s_ramDirtyPages.begin(), s_ramDirtyPages.begin() + s_ramDirtyPageCount);
+    for (unsigned i = 0; i < s_ramDirtyPageCount; ) {
+        unsigned first = s_ramDirtyPages[i];
+        const TrackedRamRegion &region = findTrackedRamRegion(first);
+        unsigned end = region.firstPage + region.size / s_hostPageSize;
+        unsigned count = 0;
+        while (i < s_ramDirtyPageCount && s_ramDirtyPages[i] == first + count &&
+               first + count < end) {
+            s_ramPageDirty[first + count] = 0;
+            ++count;
+            ++i;
+        }
+
+        uint64_t address = region.hostAddress +
+                (uint64_t) (first - region.firstPage) * s_hostPageSize;
+        mprotect((void*) address, count * s_hostPageSize, PROT_READ);
+    }
+    s_ramDirtyPageCount = 0;
+#endif
+}
+
+void S2EExecutor::restoreSharedConcreteMemory(S2EExecutionState *state,
+                                              const S2EExecutionState *previousState,
+                                              const MemoryObject *skip,
+                                              uint64_t *bytesCopied)
+{
+    uint64_t copied = 0;
+
+    if (!CopyModifiedPagesOnly) {
+        previousState = NULL;
+    }
+
+    foreach(MemoryObject* mo, m_saveOnContextSwitch) {
+        if(mo == skip)
+            continue;
+
+        const ObjectState *os = state->addressSpace.findObject(mo);
+
+        //Both states share the same page, which is already in host memory
+        if (previousState && previousState->addressSpace.findObject(mo) == os) {
+            continue;
+        }
+
+        const uint8_t *store = os->getConcreteStore();
+        assert(store);
+        memcpy((uint8_t*) mo->address, store, mo->size);
+        copied += mo->size;
+    }
+
+    if (bytesCopied) {
+        *bytesCopied = copied;
+    }
+}
+
 void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
                                 S2EExecutionState* newState)
 {
@@ -1332,6 +1701,9 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
     assert(!newState || !newState->m_active);
     assert(!newState || !newState->m_runningConcrete);
 
+    TimerStatIncrementer switchTimer(stats::stateSwitchTime,
+                                     &stats::stateSwitchTimeHistogram);
+
     //Some state save/restore logic in QEMU flushes the cache.
     //This can have bad effects in case of saving/restoring states
     //that were in the middle of a memory operation. Therefore,
@@ -1352,6 +1724,9 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
     const MemoryObject* cpuMo = oldState ? oldState->m_cpuSystemState :
                                             newState->m_cpuSystemState;
 
+    uint64_t totalSaved = 0;
+    uint64_t totalCopied = 0;
+
     if(oldState) {
         if(oldState->m_runningConcrete)
             switchToSymbolic(oldState);
@@ -1363,16 +1738,7 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
         }
         */
 
-        foreach(MemoryObject* mo, m_saveOnContextSwitch) {
-            if(mo == cpuMo)
-                continue;
-
-            const ObjectState *oldOS = oldState->addressSpace.findObject(mo);
-            ObjectState *oldWOS = oldState->addressSpace.getWriteable(mo, oldOS);
-            uint8_t *oldStore = oldWOS->getConcreteStore();
-            assert(oldStore);
-            memcpy(oldStore, (uint8_t*) mo->address, mo->size);
-        }
+        saveSharedConcreteMemory(oldState, cpuMo, &totalSaved);
 
         //copyInConcretes(*oldState);
         oldState->getDeviceState()->saveDeviceState();
@@ -1385,9 +1751,6 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
         oldState->m_active = false;
     }
 
-    uint64_t totalCopied = 0;
-    uint64_t objectsCopied = 0;
-
     if(newState) {
         timers_state = *newState->m_timersState;
         //qemu_icount = newState->m_qemuIcount;
@@ -1395,23 +1758,16 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
         jmp_buf jmp_env;
         memcpy(&jmp_env, &env->jmp_env, sizeof(jmp_buf));
 
-        const uint8_t *newStore = newState->m_cpuSystemObject->getConcreteStore();
+        const ObjectState *newCpuObject = newState->m_cpuSystemObject;
+        const uint8_t *newStore = newCpuObject->getConcreteStore();
         memcpy((uint8_t*) cpuMo->address, newStore, cpuMo->size);
 
         memcpy(&env->jmp_env, &jmp_env, sizeof(jmp_buf));
 
-        foreach(MemoryObject* mo, m_saveOnContextSwitch) {
-            if(mo == cpuMo)
-                continue;
+        restoreSharedConcreteMemory(newState, oldState, cpuMo, &totalCopied);
 
-            const ObjectState *newOS = newState->addressSpace.findObject(mo);
-            const uint8_t *newStore = newOS->getConcreteStore();
-            assert(newStore);
-            memcpy((uint8_t*) mo->address, newStore, mo->size);
-
-            totalCopied += mo->size;
-            objectsCopied++;
-        }
+        //Devices may write to RAM below, track these writes
+        resetRamWriteTracking();
 
         newState->m_active = true;
 
@@ -1419,7 +1775,8 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
         //after the state is activated
         //XXX: assigning g_s2e_state here is ugly but is required for restoreDeviceState...
         g_s2e_state = newState;
-        newState->getDeviceState()->restoreDeviceState();
+        newState->getDeviceState()->restoreDeviceState(
+                oldState ? oldState->getDeviceState() : NULL);
 
         /**
          * Memory region layout may change in between state switches.
@@ -1440,7 +1797,8 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
     cpu_enable_ticks();
 
     if (VerboseStateSwitching) {
-        s2e_debug_print("Copied %d (count=%d)\n", totalCopied, objectsCopied);
+        s2e_debug_print("Saved %" PRIu64 " bytes, restored %" PRIu64 " bytes\n",
+                        totalSaved, totalCopied);
     }
 
     if(FlushTBsOnStateSwitch)
@@ -1482,6 +1840,7 @@ ExecutionState* S2EExecutor::selectNonSpeculativeState(S2EExecutionState *state)
 
     if (!newState) {
         m_s2e->getWarningsStream() << "All states were terminated" << '\n';
+        m_s2e->advertiseStateCount(0);
         foreach(S2EExecutionState* s, m_deletedStates) {
             //Leave the current state in a zombie form to let QEMU exit gracefully.
             if (s != g_s2e_state) {
@@ -1539,6 +1898,8 @@ S2EExecutionState* S2EExecutor::selectNextState(S2EExecutionState *state)
         vm_stop(RUN_STATE_SAVE_VM);
         doStateSwitch(state, newState);
         vm_start();
+
+        swapOutIdleStates(newState);
     }
 
     //We can't free the state immediately if it is the current state.
@@ -1554,6 +1915,109 @@ S2EExecutionState* S2EExecutor::selectNextState(S2EExecutionState *state)
     return newState;
 }
 
+/** Once the process exceeds max-memory, drop from RAM the memory that
+    only idle states use instead of killing states. The kernel pages it
+    back in from the swap file when one of these states is resumed. */
+void S2EExecutor::swapOutIdleStates(S2EExecutionState *activeState)
+{
+    if (!m_swapStore || !getMaxMemory()) {
+        return;
+    }
+
+    uint64_t now = llvm::sys::TimeValue::now().seconds();
+    if (now < m_lastSwapOut + StateSwapInterval) {
+        return;
+    }
+
+    uint64_t resident = S2EStatsTracker::getProcessResidentMemoryUsage() >> 20;
+    if (resident <= getMaxMemory()) {
+        return;
+    }
+
+    m_lastSwapOut = now;
+
+    std::vector<const uint8_t*> keep;
+    MemoryMap::iterator it = activeState->addressSpace.objects.begin();
+    MemoryMap::iterator ie = activeState->addressSpace.objects.end();
+    for (; it != ie; ++it) {
+        const ObjectState *os = (*it).second;
+        keep.push_back(os->getConcreteStore(true));
+    }
+
+    uint64_t released = m_swapStore->swapOut(keep);
+
+    m_s2e->getMessagesStream(activeState)
+            << "Memory usage is " << resident << " MB, swapped out "
+            << (released >> 20) << " MB of idle state memory\n";
+}
+
+/** Replace the function of a hot TB with a fully optimized copy.
+    The old function is kept until the TB is freed, because
+    suspended states may still be executing it. */
+void S2EExecutor::optimizeTranslationBlock(TranslationBlock *tb)
+{
+    S2ETranslationBlock *s2e_tb = tb->s2e_tb;
+    llvm::Function *function = tb->llvm_function;
+    assert(s2e_tb->llvm_function == function);
+    assert(kmodule->functionMap.find(function) != kmodule->functionMap.end());
+
+    s2e_tb->llvmOptimized = true;
+
+    /* Functions loaded from the translation cache are already optimized */
+    if (m_tcgLLVMContext->isCachedFunction(function)) {
+        return;
+    }
+
+    llvm::Function *optimized = m_tcgLLVMContext->createOptimizedFunction(function);
+    addFunctionToKModule(optimized, true, true);
+    m_tcgLLVMContext->storeInCache(optimized);
+
+    s2e_tb->retiredFunctions.push_back(function);
+    s2e_tb->llvm_function = optimized;
+    tb->llvm_function = optimized;
+}
+
+/** Create the KLEE structures for a new TB function */
+KFunction* S2EExecutor::addFunctionToKModule(llvm::Function *function,
+                                             bool optimize, bool lower)
+{
+    unsigned cIndex = kmodule->constants.size();
+    KFunction *kf = kmodule->updateModuleWithFunction(function, optimize, lower);
+
+    for(unsigned i = 0; i < kf->numInstructions; ++i)
+        bindInstructionConstants(kf->instructions[i]);
+
+    /* Update global functions (new functions can be added
+       while creating added function) */
+    for (Module::iterator i = kmodule->module->begin(),
+                          ie = kmodule->module->end(); i != ie; ++i) {
+        Function *f = i;
+        ref<klee::ConstantExpr> addr(0);
+
+        // If the symbol has external weak linkage then it is implicitly
+        // not defined in this module; if it isn't resolvable then it
+        // should be null.
+        if (f->hasExternalWeakLinkage() &&
+                !externalDispatcher->resolveSymbol(f->getName())) {
+            addr = Expr::createPointer(0);
+        } else {
+            addr = Expr::createPointer((uintptr_t) (void*) f);
+            legalFunctions.insert((uint64_t) (uintptr_t) (void*) f);
+        }
+
+        globalAddresses.insert(std::make_pair(f, addr));
+    }
+
+    kmodule->constantTable.resize(kmodule->constants.size());
+
+    for(unsigned i = cIndex; i < kmodule->constants.size(); ++i) {
+        Cell &c = kmodule->constantTable[i];
+        c.value = evalConstant(kmodule->constants[i]);
+    }
+
+    return kf;
+}
+
 /** Simulate start of function execution, creating KLEE structs of required */
 void S2EExecutor::prepareFunctionExecution(S2EExecutionState *state,
                             llvm::Function *function,
@@ -1565,39 +2029,15 @@ void S2EExecutor::prepareFunctionExecution(S2EExecutionState *state,
     if(it != kmodule->functionMap.end()) {
         kf = it->second;
     } else {
-
-        unsigned cIndex = kmodule->constants.size();
-        kf = kmodule->updateModuleWithFunction(function);
-
-        for(unsigned i = 0; i < kf->numInstructions; ++i)
-            bindInstructionConstants(kf->instructions[i]);
-
-        /* Update global functions (new functions can be added
-           while creating added function) */
-        for (Module::iterator i = kmodule->module->begin(),
-                              ie = kmodule->module->end(); i != ie; ++i) {
-            Function *f = i;
-            ref<klee::ConstantExpr> addr(0);
-
-            // If the symbol has external weak linkage then it is implicitly
-            // not defined in this module; if it isn't resolvable then it
-            // should be null.
-            if (f->hasExternalWeakLinkage() &&
-                    !externalDispatcher->resolveSymbol(f->getName())) {
-                addr = Expr::createPointer(0);
-            } else {
-                addr = Expr::createPointer((uintptr_t) (void*) f);
-                legalFunctions.insert((uint64_t) (uintptr_t) (void*) f);
-            }
-
-            globalAddresses.insert(std::make_pair(f, addr));
-        }
-
-        kmodule->constantTable.resize(kmodule->constants.size());
-
-        for(unsigned i = cIndex; i < kmodule->constants.size(); ++i) {
-            Cell &c = kmodule->constantTable[i];
-            c.value = evalConstant(kmodule->constants[i]);
+        /* Functions loaded from the translation cache were stored after
+           optimization and lowering, so they skip both. With tiered
+           optimization, new TBs are only lowered. */
+        bool cached = m_tcgLLVMContext->isCachedFunction(function);
+        kf = addFunctionToKModule(function,
+                                  !cached && LLVMOptimizationThreshold == 0,
+                                  !cached);
+        if (!cached && LLVMOptimizationThreshold == 0) {
+            m_tcgLLVMContext->storeInCache(function);
         }
     }
 
@@ -1768,6 +2208,13 @@ uintptr_t S2EExecutor::executeTranslationBlockKlee(
             tb->llvm_function, std::vector<ref<Expr> >(1,
                 Expr::createPointer((uint64_t) tb_function_args)));
 
+    /* The KFunction exists now. The optimized version is used
+       starting with the next execution of the block. */
+    if (LLVMOptimizationThreshold && !tb->s2e_tb->llvmOptimized &&
+            ++tb->s2e_tb->kleeExecutionCount >= LLVMOptimizationThreshold) {
+        optimizeTranslationBlock(tb);
+    }
+
     if (executeInstructions(state)) {
         throw CpuExitException();
     }
@@ -1962,6 +2409,11 @@ uintptr_t S2EExecutor::executeTranslationBlock(
         }
         cpu_enable_scaling(new_scaling);
 
+        if (SpeculativeLLVMTranslation && !tb->llvm_function &&
+            ++tb->s2e_tb->concreteExecutionCount == SpeculativeLLVMThreshold) {
+            queueSpeculativeTranslation(state, tb);
+        }
+
         return executeTranslationBlockConcrete(state, tb);
     }
 }
@@ -2113,6 +2565,7 @@ S2EExecutor::StatePair S2EExecutor::fork(ExecutionState &current,
     assert(dynamic_cast<S2EExecutionState*>(&current));
     assert(!static_cast<S2EExecutionState*>(&current)->m_runningConcrete);
 
+    WallTimer forkTimer;
     StatePair res;
 
     if (ConcolicMode) {
@@ -2137,6 +2590,8 @@ S2EExecutor::StatePair S2EExecutor::fork(ExecutionState &current,
 
         doStateFork(static_cast<S2EExecutionState*>(&current),
                        newStates, newConditions);
+
+        stats::forkTimeHistogram.add(forkTimer.check());
     }
     return res;
 }
@@ -2158,16 +2613,11 @@ void S2EExecutor::notifyBranch(ExecutionState &state)
      * These objects must be saved before the cpu state, because
      * getWritable() may modify the TLB.
      */
-    foreach(MemoryObject* mo, m_saveOnContextSwitch) {
-        const ObjectState *os = s2eState->addressSpace.findObject(mo);
-        ObjectState *wos = s2eState->addressSpace.getWriteable(mo, os);
-        uint8_t *store = wos->getConcreteStore();
-        assert(store);
-        memcpy(store, (uint8_t*) mo->address, mo->size);
-    }
+    const MemoryObject* cpuMo = s2eState->m_cpuSystemState;
+    saveSharedConcreteMemory(s2eState, cpuMo, NULL);
+    resetRamWriteTracking();
 
     /* Save CPU state */
-    const MemoryObject* cpuMo = s2eState->m_cpuSystemState;
     uint8_t *cpuStore = s2eState->m_cpuSystemObject->getConcreteStore();
     memcpy(cpuStore, (uint8_t*) cpuMo->address, cpuMo->size);
 
@@ -2453,7 +2903,14 @@ void S2EExecutor::unrefS2ETb(S2ETranslationBlock* s2e_tb)
         if(s2e_tb->llvm_function && !KeepLLVMFunctions) {
             S2EExternalDispatcher *s2eDispatcher = static_cast<S2EExternalDispatcher*>(externalDispatcher);
             s2eDispatcher->removeFunction(s2e_tb->llvm_function);
+            m_tcgLLVMContext->forgetFunction(s2e_tb->llvm_function);
             kmodule->removeFunction(s2e_tb->llvm_function);
+
+            foreach(llvm::Function *f, s2e_tb->retiredFunctions) {
+                s2eDispatcher->removeFunction(f);
+                m_tcgLLVMContext->forgetFunction(f);
+                kmodule->removeFunction(f);
+            }
         }
         foreach(void* s, s2e_tb->executionSignals) {
             delete static_cast<ExecutionSignal*>(s);
@@ -2461,6 +2918,50 @@ void S2EExecutor::unrefS2ETb(S2ETranslationBlock* s2e_tb)
     }
 }
 
+void S2EExecutor::queueSpeculativeTranslation(S2EExecutionState *state,
+                                              TranslationBlock *tb)
+{
+    static const unsigned MaxQueuedTbs = 4096;
+
+    if (m_speculativeTbs.size() >= MaxQueuedTbs) {
+        unrefS2ETb(m_speculativeTbs.front().s2e_tb);
+        m_speculativeTbs.pop_front();
+    }
+
+    /* Plugins instrument code depending on the current process,
+       so the TB must be translated in the same context */
+    SpeculativeTb s = { tb, tb->s2e_tb, state->getPid() };
+    tb->s2e_tb->refCount += 1;
+    m_speculativeTbs.push_back(s);
+}
+
+bool S2EExecutor::translateSpeculativeTb(S2EExecutionState *state)
+{
+    while (!m_speculativeTbs.empty()) {
+        SpeculativeTb s = m_speculativeTbs.front();
+        m_speculativeTbs.pop_front();
+
+        /* s2e_tb is reset when the TB is freed */
+        bool valid = s.tb->s2e_tb == s.s2e_tb && !s.tb->llvm_function &&
+                     s.pid == state->getPid();
+        unrefS2ETb(s.s2e_tb);
+
+        if (valid && cpu_gen_llvm_speculative(env, s.tb)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void S2EExecutor::clearSpeculativeTranslations()
+{
+    foreach(const SpeculativeTb &s, m_speculativeTbs) {
+        unrefS2ETb(s.s2e_tb);
+    }
+    m_speculativeTbs.clear();
+}
+
 void S2EExecutor::queueStateForMerge(S2EExecutionState *state)
 {
     if(dynamic_cast<MergingSearcher*>(searcher) == NULL) {
@@ -2521,6 +3022,10 @@ void s2e_initialize_execution(S2E *s2e, S2EExecutionState *initial_state,
     s2e->getExecutor()->initializeExecution(initial_state, execute_always_klee);
     //XXX: move it to better place (signal handler for this?)
     tcg_register_helper((void*)&s2e_tcg_execution_handler, "s2e_tcg_execution_handler");
+#ifdef S2E_USE_FAST_SIGNALS
+    tcg_register_helper((void*)&s2e_tcg_execution_handler1, "s2e_tcg_execution_handler1");
+    tcg_register_helper((void*)&s2e_tcg_execution_handler2, "s2e_tcg_execution_handler2");
+#endif
     tcg_register_helper((void*)&s2e_tcg_custom_instruction_handler, "s2e_tcg_custom_instruction_handler");
 }
 
@@ -2649,6 +3154,9 @@ void s2e_tb_alloc(S2E*, TranslationBlock *tb)
     tb->s2e_tb = new S2ETranslationBlock;
     tb->s2e_tb->llvm_function = NULL;
     tb->s2e_tb->refCount = 1;
+    tb->s2e_tb->concreteExecutionCount = 0;
+    tb->s2e_tb->kleeExecutionCount = 0;
+    tb->s2e_tb->llvmOptimized = false;
 
     /* Push one copy of a signal to use it as a cache */
     tb->s2e_tb->executionSignals.push_back(new s2e::ExecutionSignal);
@@ -2662,9 +3170,51 @@ void s2e_set_tb_function(S2E*, TranslationBlock *tb)
     tb->s2e_tb->llvm_function = tb->llvm_function;
 }
 
+unsigned s2e_tb_get_host_pointers(TranslationBlock *tb,
+                                  uint64_t *pointers, unsigned max)
+{
+    unsigned count = 0;
+    if (count < max) {
+        pointers[count] = (uint64_t) tb;
+    }
+    ++count;
+
+    if (tb->s2e_tb) {
+        foreach(void* s, tb->s2e_tb->executionSignals) {
+            if (count < max) {
+                pointers[count] = (uint64_t) s;
+            }
+            ++count;
+
+#ifdef S2E_USE_FAST_SIGNALS
+            /* Functors of signals with one or two subscribers are
+               passed directly to the execution handlers */
+            ExecutionSignal::func_t funcs[2];
+            unsigned n = static_cast<ExecutionSignal*>(s)->getFunctors(funcs, 2);
+            for (unsigned i = 0; n <= 2 && i < n; ++i) {
+                if (count < max) {
+                    pointers[count] = (uint64_t) funcs[i];
+                }
+                ++count;
+            }
+#endif
+        }
+    }
+    return count;
+}
+
 void s2e_tb_free(S2E* s2e, TranslationBlock *tb)
 {
     s2e->getExecutor()->unrefS2ETb(tb->s2e_tb);
+    tb->s2e_tb = NULL;
+}
+
+int s2e_translate_speculative_tb(S2E* s2e)
+{
+    if (!s2e || !g_s2e_state) {
+        return 0;
+    }
+    return s2e->getExecutor()->translateSpeculativeTb(g_s2e_state);
 }
 
 void s2e_flush_tlb_cache()
@@ -2674,6 +3224,10 @@ void s2e_flush_tlb_cache()
 
 void s2e_flush_tb_cache()
 {
+    if (g_s2e) {
+        g_s2e->getExecutor()->clearSpeculativeTranslations();
+    }
+
     if (g_s2e && g_s2e->getExecutor()->getStatesCount() > 1) {
         if (!FlushTBsOnStateSwitch) {
             g_s2e->getWarningsStream() << "Flushing TB cache with more than 1 state. Dangerous. Expect crashes.\n";
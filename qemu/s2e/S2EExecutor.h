@@ -40,6 +40,8 @@
 #include <llvm/Support/raw_ostream.h>
 #include <cpu.h>
 
+#include <deque>
+
 class TCGLLVMContext;
 
 struct TranslationBlock;
@@ -85,6 +87,8 @@ public:
 
 typedef void (*StateManagerCb)(S2EExecutionState *s, bool killingState);
 
+class SwapStore;
+
 class S2EExecutor : public klee::Executor
 {
 protected:
@@ -100,6 +104,9 @@ protected:
 
     std::vector<klee::MemoryObject*> m_saveOnContextSwitch;
 
+    /* Objects of m_saveOnContextSwitch whose writes are not tracked */
+    std::vector<klee::MemoryObject*> m_untrackedSaveOnContextSwitch;
+
     std::vector<S2EExecutionState*> m_deletedStates;
 
     bool m_executeAlwaysKlee;
@@ -115,9 +122,28 @@ protected:
     /** Holds the yielded state, if any */
     S2EExecutionState* yieldedState;
 
+    /** TBs that ran often enough in concrete mode to be worth translating
+        to LLVM before they access symbolic data. Each entry holds a
+        reference to the S2E part of the TB. */
+    struct SpeculativeTb {
+        TranslationBlock *tb;
+        S2ETranslationBlock *s2e_tb;
+        uint64_t pid;
+    };
+    std::deque<SpeculativeTb> m_speculativeTbs;
+
+    void queueSpeculativeTranslation(S2EExecutionState *state,
+                                     TranslationBlock *tb);
+
     /** Moves yielded state back into list of schedulable states */
     void restoreYieldedState(void);
 
+    /** Holds the concrete memory of states when state swapping is enabled */
+    SwapStore *m_swapStore;
+    uint64_t m_lastSwapOut;
+
+    void swapOutIdleStates(S2EExecutionState *activeState);
+
 public:
     S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLVMContext,
                 const InterpreterOptions &opts,
@@ -213,6 +239,12 @@ public:
 
     void unrefS2ETb(S2ETranslationBlock* s2e_tb);
 
+    /** Generate LLVM code for the next queued hot TB.
+        Returns false when there is nothing left to translate. */
+    bool translateSpeculativeTb(S2EExecutionState *state);
+
+    void clearSpeculativeTranslations();
+
     void queueStateForMerge(S2EExecutionState *state);
 
     void initializeStatistics();
@@ -269,6 +301,11 @@ protected:
                                klee::KInstruction* target,
                                std::vector<klee::ref<klee::Expr> > &args);
     
+    klee::KFunction* addFunctionToKModule(llvm::Function *function,
+                                          bool optimize, bool lower);
+
+    void optimizeTranslationBlock(TranslationBlock *tb);
+
     void prepareFunctionExecution(S2EExecutionState *state,
                            llvm::Function* function,
                            const std::vector<klee::ref<klee::Expr> >& args);
@@ -285,6 +322,28 @@ protected:
     void doStateSwitch(S2EExecutionState* oldState,
                        S2EExecutionState* newState);
 
+    /** Save the host copy of m_saveOnContextSwitch objects into the
+        object states of the given state. Pages whose content did not
+        change since they were last restored are left untouched, in order
+        to avoid breaking the copy-on-write sharing with other states.
+        When RAM writes are tracked, only the pages written since the last
+        save or restore are compared. */
+    void saveSharedConcreteMemory(S2EExecutionState *state,
+                                  const klee::MemoryObject *skip,
+                                  uint64_t *bytesCopied);
+
+    bool trackRamWrites(uint64_t hostAddress, uint64_t size);
+    void resetRamWriteTracking();
+
+    /** Restore the host copy of m_saveOnContextSwitch objects from the
+        given state. If the host memory currently holds the content of
+        previousState, only the pages whose object states differ between
+        the two states are copied. */
+    void restoreSharedConcreteMemory(S2EExecutionState *state,
+                                     const S2EExecutionState *previousState,
+                                     const klee::MemoryObject *skip,
+                                     uint64_t *bytesCopied);
+
     void doStateFork(S2EExecutionState *originalState,
                         const std::vector<S2EExecutionState*>& newStates,
                         const std::vector<klee::ref<klee::Expr> >& conditions);
@@ -443,6 +502,20 @@ struct S2ETranslationBlock
         when this translation block will be flushed.
         XXX: how could we avoid using void* here ? */
     std::vector<void*> executionSignals;
+
+    /** Number of times the block was executed concretely
+        before LLVM code was generated for it */
+    unsigned concreteExecutionCount;
+
+    /** Number of times the block was executed in KLEE */
+    unsigned kleeExecutionCount;
+
+    /** True once the block no longer needs to be fully optimized */
+    bool llvmOptimized;
+
+    /** Functions that were replaced by an optimized version.
+        They are deleted together with llvm_function. */
+    std::vector<llvm::Function*> retiredFunctions;
 };
 
 } // namespace s2e
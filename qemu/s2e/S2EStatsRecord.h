@@ -0,0 +1,109 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2E_STATSRECORD_H
+#define S2E_STATSRECORD_H
+
+#include <inttypes.h>
+
+namespace s2e {
+
+/**
+ *  Layout of run.stats.bin, written by S2EStatsTracker when
+ *  -binary-stats is enabled. The file starts with a header followed
+ *  by one fixed-size record per stats interval. Records are appended
+ *  in host byte order. Counters and histograms are cumulative since the
+ *  start of the process, times are in microseconds.
+ */
+#define S2E_STATS_MAGIC 0x3154415453453253ULL /* "S2ESTAT1" */
+#define S2E_STATS_VERSION 1
+#define S2E_STATS_HISTOGRAM_BUCKETS 24
+
+struct S2EStatsFileHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t histogramBuckets;
+    uint32_t processIndex;
+    uint64_t pid;
+    //Wall clock time the statistics file was created, in microseconds since the epoch
+    uint64_t startTime;
+}__attribute__((packed));
+
+struct S2EStatsRecord {
+    uint64_t wallTime;
+    uint64_t userTime;
+
+    uint32_t stateCount;
+    uint32_t currentStateId;
+
+    uint64_t queries;
+    uint64_t queryConstructs;
+
+    uint64_t translationBlocks;
+    uint64_t translationBlocksConcrete;
+    uint64_t translationBlocksKlee;
+    uint64_t cpuInstructions;
+    uint64_t cpuInstructionsConcrete;
+    uint64_t cpuInstructionsKlee;
+
+    uint64_t concreteModeTime;
+    uint64_t symbolicModeTime;
+    uint64_t queryTime;
+    uint64_t solverTime;
+    uint64_t cexCacheTime;
+    uint64_t forkTime;
+    uint64_t resolveTime;
+    uint64_t stateSwitchTime;
+
+    //Counters of the current state (S2EStateStats)
+    uint64_t stateTranslationBlocksConcrete;
+    uint64_t stateTranslationBlocksSymbolic;
+    uint64_t stateInstructionsSymbolic;
+    uint64_t stateInstructions;
+
+    //Virtual and resident memory, in bytes
+    uint64_t memoryUsage;
+    uint64_t residentMemoryUsage;
+
+    //Bucket i counts the durations in [2^i, 2^(i+1)) microseconds
+    uint64_t solverTimeHistogram[S2E_STATS_HISTOGRAM_BUCKETS];
+    uint64_t forkTimeHistogram[S2E_STATS_HISTOGRAM_BUCKETS];
+    uint64_t stateSwitchTimeHistogram[S2E_STATS_HISTOGRAM_BUCKETS];
+}__attribute__((packed));
+
+} // namespace s2e
+
+#endif
@@ -34,20 +34,25 @@
  */
 
 #include "S2EStatsTracker.h"
+#include "S2EStatsRecord.h"
 
+#include <s2e/S2E.h>
 #include <s2e/S2EExecutor.h>
 #include <s2e/S2EExecutionState.h>
+#include <s2e/s2e_qemu.h>
 
 #include <klee/CoreStats.h>
 #include <klee/SolverStats.h>
 #include <klee/Internal/System/Time.h>
 
 #include <llvm/Support/Process.h>
-
-#include <sstream>
+#include <llvm/Support/CommandLine.h>
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 
 #include "config.h"
@@ -74,15 +79,77 @@ namespace stats {
 
     Statistic concreteModeTime("ConcreteModeTime", "ConcModeTime");
     Statistic symbolicModeTime("SymbolicModeTime", "SymbModeTime");
+    Statistic stateSwitchTime("StateSwitchTime", "SwitchTime");
+
+    LatencyHistogram forkTimeHistogram;
+    LatencyHistogram stateSwitchTimeHistogram;
 } // namespace stats
 } // namespace klee
 
 using namespace klee;
 using namespace llvm;
 
+namespace {
+    cl::opt<bool>
+    BinaryStats("binary-stats",
+                cl::desc("Write statistics as fixed-size binary records to run.stats.bin"),
+                cl::init(false));
+}
+
 
 namespace s2e {
 
+#if !defined(CONFIG_WIN32) && !defined(CONFIG_DARWIN)
+/**
+ *  Reads the virtual and resident sizes (in pages) from /proc/self/statm.
+ *  The file stays open, so that sampling costs a single read.
+ *  It is reopened in forked processes, because it describes the
+ *  process that opened it.
+ */
+static bool readStatm(uint64_t *size, uint64_t *resident)
+{
+    static int fd = -1;
+    static pid_t fdPid = 0;
+
+    pid_t pid = getpid();
+    if (fd < 0 || fdPid != pid) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        fd = open("/proc/self/statm", O_RDONLY);
+        fdPid = pid;
+        if (fd < 0) {
+            return false;
+        }
+    }
+
+    char buffer[128];
+    ssize_t length = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if (length <= 0) {
+        return false;
+    }
+    buffer[length] = 0;
+
+    char *end;
+    *size = strtoull(buffer, &end, 10);
+    *resident = strtoull(end, NULL, 10);
+    return true;
+}
+#endif
+
+S2EStatsTracker::S2EStatsTracker(klee::Executor &_executor, std::string _objectFilename,
+                                 bool _updateMinDistToUncovered)
+    : StatsTracker(_executor, _objectFilename, _updateMinDistToUncovered),
+      m_binaryStatsFile(NULL), m_startTime(0), m_lastFlushTime(0)
+{
+
+}
+
+S2EStatsTracker::~S2EStatsTracker()
+{
+    delete m_binaryStatsFile;
+}
+
 /**
  *  Replaces the broken LLVM functions
  */
@@ -114,31 +181,55 @@ uint64_t S2EStatsTracker::getProcessMemoryUsage()
     return t_info.resident_size;
 
 #else
-    pid_t myPid = getpid();
-    std::stringstream ss;
-    ss << "/proc/" << myPid << "/status";
-
-    FILE *fp = fopen(ss.str().c_str(), "r");
-    if (!fp) {
+    uint64_t size, resident;
+    if (!readStatm(&size, &resident)) {
         return 0;
     }
 
-    uint64_t peakMem=0;
+    return size * getpagesize();
+#endif
+}
 
-    char buffer[512];
-    while(!peakMem && fgets(buffer, sizeof(buffer), fp)) {
-        if (sscanf(buffer, "VmSize: %" PRIu64, &peakMem)) {
-            break;
-        }
+/**
+ *  Returns the resident set size. Unlike the virtual size, it goes down
+ *  when memory is swapped out.
+ */
+uint64_t S2EStatsTracker::getProcessResidentMemoryUsage()
+{
+#if defined(CONFIG_WIN32) || defined(CONFIG_DARWIN)
+    return getProcessMemoryUsage();
+#else
+    uint64_t size, resident;
+    if (!readStatm(&size, &resident)) {
+        return 0;
     }
 
-    fclose(fp);
-
-    return peakMem * 1024;
+    return resident * getpagesize();
 #endif
 }
 
 void S2EStatsTracker::writeStatsHeader() {
+  if (BinaryStats) {
+    assert(S2E_STATS_HISTOGRAM_BUCKETS == LatencyHistogram::BUCKETS);
+
+    m_binaryStatsFile = g_s2e->openOutputFile("run.stats.bin");
+    m_startTime = util::getWallTime() * 1000000.;
+
+    S2EStatsFileHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = S2E_STATS_MAGIC;
+    hdr.version = S2E_STATS_VERSION;
+    hdr.recordSize = sizeof(S2EStatsRecord);
+    hdr.histogramBuckets = S2E_STATS_HISTOGRAM_BUCKETS;
+    hdr.processIndex = g_s2e->getCurrentProcessIndex();
+    hdr.pid = getpid();
+    hdr.startTime = m_startTime;
+
+    m_binaryStatsFile->write((const char*) &hdr, sizeof(hdr));
+    m_binaryStatsFile->flush();
+    return;
+  }
+
   *statsFile //<< "('Instructions',"
              //<< "'FullBranches',"
              //<< "'PartialBranches',"
@@ -170,6 +261,11 @@ void S2EStatsTracker::writeStatsHeader() {
 }
 
 void S2EStatsTracker::writeStatsLine() {
+  if (m_binaryStatsFile) {
+    writeStatsRecord();
+    return;
+  }
+
   *statsFile //<< "(" << stats::instructions
              //<< "," << fullBranches
              //<< "," << partialBranches
@@ -200,6 +296,74 @@ void S2EStatsTracker::writeStatsLine() {
   statsFile->flush();
 }
 
+/**
+ *  Appends one binary record. Unlike the text format, the file is only
+ *  flushed once per second, which keeps short stats intervals cheap.
+ */
+void S2EStatsTracker::writeStatsRecord()
+{
+    S2EStatsRecord r;
+    memset(&r, 0, sizeof(r));
+
+    double now = elapsed();
+    r.wallTime = now * 1000000.;
+    r.userTime = util::getUserTime() * 1000000.;
+
+    r.stateCount = executor.getStatesCount();
+
+    S2EExecutionState *state = g_s2e_state;
+    if (state) {
+        r.currentStateId = state->getID();
+        r.stateTranslationBlocksConcrete = state->m_stats.m_statTranslationBlockConcrete;
+        r.stateTranslationBlocksSymbolic = state->m_stats.m_statTranslationBlockSymbolic;
+        r.stateInstructionsSymbolic = state->m_stats.m_statInstructionCountSymbolic;
+        r.stateInstructions = state->getTotalInstructionCount();
+    }
+
+    r.queries = stats::queries;
+    r.queryConstructs = stats::queryConstructs;
+
+    r.translationBlocks = stats::translationBlocks;
+    r.translationBlocksConcrete = stats::translationBlocksConcrete;
+    r.translationBlocksKlee = stats::translationBlocksKlee;
+    r.cpuInstructions = stats::cpuInstructions;
+    r.cpuInstructionsConcrete = stats::cpuInstructionsConcrete;
+    r.cpuInstructionsKlee = stats::cpuInstructionsKlee;
+
+    r.concreteModeTime = stats::concreteModeTime;
+    r.symbolicModeTime = stats::symbolicModeTime;
+    r.queryTime = stats::queryTime;
+    r.solverTime = stats::solverTime;
+    r.cexCacheTime = stats::cexCacheTime;
+    r.forkTime = stats::forkTime;
+    r.resolveTime = stats::resolveTime;
+    r.stateSwitchTime = stats::stateSwitchTime;
+
+#if defined(CONFIG_WIN32) || defined(CONFIG_DARWIN)
+    r.memoryUsage = getProcessMemoryUsage();
+    r.residentMemoryUsage = getProcessResidentMemoryUsage();
+#else
+    uint64_t size, resident;
+    if (readStatm(&size, &resident)) {
+        r.memoryUsage = size * getpagesize();
+        r.residentMemoryUsage = resident * getpagesize();
+    }
+#endif
+
+    for (unsigned i = 0; i < S2E_STATS_HISTOGRAM_BUCKETS; ++i) {
+        r.solverTimeHistogram[i] = stats::solverTimeHistogram.getCount(i);
+        r.forkTimeHistogram[i] = stats::forkTimeHistogram.getCount(i);
+        r.stateSwitchTimeHistogram[i] = stats::stateSwitchTimeHistogram.getCount(i);
+    }
+
+    m_binaryStatsFile->write((const char*) &r, sizeof(r));
+
+    if (now - m_lastFlushTime >= 1.0) {
+        m_binaryStatsFile->flush();
+        m_lastFlushTime = now;
+    }
+}
+
 S2EStateStats::S2EStateStats():
     m_statTranslationBlockConcrete(0),
     m_statTranslationBlockSymbolic(0),
@@ -38,6 +38,7 @@
 
 #include <klee/Statistic.h>
 #include <klee/StatsTracker.h>
+#include <klee/LatencyHistogram.h>
 
 namespace klee {
 namespace stats {
@@ -51,6 +52,10 @@ namespace stats {
 
     extern klee::Statistic concreteModeTime;
     extern klee::Statistic symbolicModeTime;
+    extern klee::Statistic stateSwitchTime;
+
+    extern klee::LatencyHistogram forkTimeHistogram;
+    extern klee::LatencyHistogram stateSwitchTimeHistogram;
 } // namespace stats
 } // namespace klee
 
@@ -60,13 +65,21 @@ class S2EStatsTracker: public klee::StatsTracker
 {
 public:
     S2EStatsTracker(klee::Executor &_executor, std::string _objectFilename,
-                    bool _updateMinDistToUncovered)
-        : StatsTracker(_executor, _objectFilename, _updateMinDistToUncovered) {}
+                    bool _updateMinDistToUncovered);
+    virtual ~S2EStatsTracker();
 
     static uint64_t getProcessMemoryUsage();
+    static uint64_t getProcessResidentMemoryUsage();
 protected:
     void writeStatsHeader();
     void writeStatsLine();
+
+private:
+    llvm::raw_ostream *m_binaryStatsFile;
+    uint64_t m_startTime;
+    double m_lastFlushTime;
+
+    void writeStatsRecord();
 };
 
 class S2EExecutionState;
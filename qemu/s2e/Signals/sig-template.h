@@ -108,6 +108,19 @@ bool empty() const{
     return m_activeSignals == 0;
 }
 
+/* Copies up to max connected functors into funcs and returns the number
+   of connected functors. Lets callers that emit the same signal many
+   times invoke the functors directly. */
+unsigned getFunctors(func_t *funcs, unsigned max) const {
+    unsigned count = 0;
+    for (unsigned i=0; i<m_size && count < max; ++i) {
+        if (m_funcs[i]) {
+            funcs[count++] = m_funcs[i];
+        }
+    }
+    return m_activeSignals;
+}
+
 void emit(OPERATOR_PARAM_DECL) {
     for (unsigned i=0; i<m_size; ++i) {
         if (m_funcs[i]) {
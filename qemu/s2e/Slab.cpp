@@ -35,410 +35,228 @@
 
 #include <iostream>
 #include <exception>
+#include <new>
 
-//#define DEBUG_ALLOC
 //#define TESTSUITE_ALLOC
 
 #include "Slab.h"
 
+#include <stdlib.h>
+#include <string.h>
 
 #ifdef _WIN32
 #include <windows.h>
 #else
-#include <stdlib.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/types.h>
-#include <sys/stat.h>
 #include <sys/mman.h>
-#include <fcntl.h>
 #endif
 
 namespace s2e
 {
 
-PageAllocator::PageAllocator()
-{
-
-}
-
-PageAllocator::~PageAllocator()
+SlabRegionMap::SlabRegionMap()
 {
-    RegionMap::iterator it;
-
-    for (it = m_regions.begin(); it != m_regions.end(); ++it) {
-        osFree((*it).first);
-    }
-
-    RegionSet::iterator sit;
-    for (sit = m_busyRegions.begin(); sit != m_busyRegions.end(); ++sit) {
-        osFree((*sit));
-    }
-
+    memset((void*) m_root, 0, sizeof(m_root));
 }
 
-uintptr_t PageAllocator::osAlloc()
+static void *slab_os_alloc(size_t size)
 {
 #ifdef _WIN32
-    return(uintptr_t) VirtualAlloc(NULL, getRegionSize(), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
-#elif defined(__APPLE__)
-    return (uintptr_t) mmap(NULL, getRegionSize(), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+    return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
 #else
-    return (uintptr_t) mmap(NULL, getRegionSize(), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    void *p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
 #endif
 }
 
-void PageAllocator::osFree(uintptr_t region)
+bool SlabRegionMap::set(uintptr_t regionBase, unsigned value)
 {
-#ifdef _WIN32
-    BOOL b = VirtualFree((PVOID)region, 0, MEM_RELEASE);
-    assert(b);
-#else
-    munmap((void*)region, getRegionSize());
-#endif
-}
-
-uintptr_t PageAllocator::allocPage()
-{
-    RegionMap::iterator it = m_regions.begin();
-    if (it == m_regions.end()) {
-        uintptr_t region = osAlloc();
-        if (!region) {
-            return 0;
-        }
-
-#ifdef DEBUG_ALLOC
-        std::cout << "Allocating new region " << std::hex << region << std::dec << std::endl;
-#endif
-
-        m_regions[region] = ((uint64_t)-1) & ~1LL;
-        return region;
+    uintptr_t region = regionBase >> SLAB_REGION_BITS;
+    uintptr_t root = region >> LeafBits;
+    if (root >= (1 << RootBits)) {
+        return false;
     }
 
-    uint64_t index;
-    int b = bit_scan_forward_64(&index, (*it).second);
-    assert(b);
-    (*it).second &= ~(1LL << index);
-
-    uintptr_t reg = (*it).first;
-
-    if ((*it).second == 0) {
-
-#ifdef DEBUG_ALLOC
-        std::cout << "Region " << std::hex << reg << " is full" << std::dec << std::endl;
-#endif
-
-        m_busyRegions.insert(reg);
-        m_regions.erase(reg);
+    if (!m_root[root]) {
+        m_lock.lock();
+        if (!m_root[root]) {
+            uint8_t *leaf = (uint8_t*) slab_os_alloc(1 << LeafBits);
+            if (!leaf) {
+                m_lock.unlock();
+                return false;
+            }
+            __sync_synchronize();
+            m_root[root] = leaf;
+        }
+        m_lock.unlock();
     }
 
-    uintptr_t ret = reg + index * getPageSize();
-    memset((void*)ret, 0xAA, getPageSize());
-    return ret;
+    m_root[root][region & ((1 << LeafBits) - 1)] = value;
+    return true;
 }
 
-void PageAllocator::freePage(uintptr_t page)
-{
-    memset((void*)page, 0xBB, getPageSize());
-
-    RegionMap::iterator it = m_regions.find(page);
-    if (it == m_regions.end()) {
-#ifdef DEBUG_ALLOC
-        std::cout << "busy size " << std::dec << m_busyRegions.size() << std::endl;
-        std::cout << "freeing " << std::hex << page << std::dec << std::endl;
-#endif
-
-        RegionSet::iterator itr = m_busyRegions.find(page);
-        assert(itr != m_busyRegions.end());
-        uint64_t index = (page - (*itr)) / getPageSize();
-
-        m_busyRegions.erase(*itr);
-        m_regions[*itr] = (1LL << index);
-        return;
-    }
-
-    uint64_t index = (page - (*it).first) / getPageSize();
-
-    assert(!((*it).second & (1LL << index)));
-
-    (*it).second |= 1LL << index;
-    if ((*it).second == (uint64_t)-1) {
-#ifdef DEBUG_ALLOC
-        std::cout << "Freeing empty region " << std::hex << (*it).first << std::dec << std::endl;
-#endif
-
-        osFree((*it).first);
-        m_regions.erase((*it).first);
-    }
+__thread SlabAllocator::Magazine SlabAllocator::t_magazines[SLAB_CLASS_COUNT];
 
-    return;
-}
+static const unsigned s_classSizes[SLAB_CLASS_COUNT] = {
+    8, 16, 32, 48, 64, 96, 128, 192, 256
+};
 
-//XXX: this needs to be seriously optimized
-bool PageAllocator::belongsToUs(uintptr_t addr) const
+SlabAllocator::SlabAllocator()
 {
-    RegionMap::const_iterator it;
-    RegionSet::const_iterator sit;
-    bool inreg = false;
-
-    for(it = m_regions.begin(); it != m_regions.end(); ++it) {
-        uintptr_t a = (*it).first;
-        if (addr >= a && addr < a + REGION_SIZE) {
-            inreg = true;
-            break;
+    unsigned cls = 0;
+    for (unsigned i = 0; i <= SLAB_MAX_SIZE / 8; ++i) {
+        while (s_classSizes[cls] < i * 8) {
+            ++cls;
         }
+        m_sizeToClass[i] = cls;
     }
 
-    for(sit = m_busyRegions.begin(); sit != m_busyRegions.end(); ++sit) {
-        uintptr_t a = (*sit);
-        if (addr >= a && addr < a + REGION_SIZE) {
-            inreg = true;
-            break;
-        }
+    for (unsigned i = 0; i < SLAB_CLASS_COUNT; ++i) {
+        SizeClass &c = m_classes[i];
+        c.blockSize = s_classSizes[i];
+        c.freeList = NULL;
+        c.freeCount = 0;
+        c.current = c.end = 0;
+        memset(&c.stats, 0, sizeof(c.stats));
     }
-
-    return inreg;
 }
 
-
-BlockAllocator::BlockAllocator(PageAllocator *pa, unsigned blockSizePo2, uint8_t magic)
+/** Returns a region aligned on its size */
+uintptr_t SlabAllocator::osAlloc()
 {
-    list_init_head(&m_totallyFreeList);
-    list_init_head(&m_freeList);
-    list_init_head(&m_busyList);
-
-    m_magic = magic;
-
-    m_freePagesCount = 0;
-    m_busyPagesCount = 0;
-    m_freeBlocksCount = 0;
-
-    m_allocatedBlocksCount = 0;
-
-    m_pa = pa;
-
-    m_pageSize = pa->getPageSize();
-    m_blockSize = 1 << blockSizePo2;
-    assert(m_blockSize < 2048);
-
-    m_blocksPerPage = (m_pageSize - sizeof(BlockAllocatorHdr)) / m_blockSize;
-
-    assert((m_blocksPerPage) < sizeof(((BlockAllocatorHdr*)(0))->mask) * 8);
-}
-
-uintptr_t BlockAllocator::expand()
-{
-    uintptr_t newPage = m_pa->allocPage();
-    if( !newPage) {
+    uintptr_t p = (uintptr_t) slab_os_alloc(SLAB_REGION_SIZE * 2);
+    if (!p) {
         return 0;
     }
 
-    BlockAllocatorHdr *hdr = (BlockAllocatorHdr*)newPage;
-    hdr->init(hdr, m_blocksPerPage);
-    hdr->signature = BLOCK_HDR_SIGNATURE | m_magic;
+    uintptr_t region = (p + SLAB_REGION_SIZE - 1) & ~(uintptr_t) (SLAB_REGION_SIZE - 1);
 
-    list_insert_tail(&m_totallyFreeList, &hdr->link);
+#ifndef _WIN32
+    //Give the unaligned parts back
+    if (region > p) {
+        munmap((void*) p, region - p);
+    }
+    munmap((void*) (region + SLAB_REGION_SIZE), p + SLAB_REGION_SIZE - region);
+#endif
 
-    m_freePagesCount++;
-    m_freeBlocksCount += m_blocksPerPage;
-    return newPage;
+    return region;
 }
 
-void BlockAllocator::shrink()
+void SlabAllocator::flushStats(unsigned cls, Magazine *mag)
 {
-    list_t *entry;
-    BlockAllocatorHdr *page;
-
-    if (list_empty(&m_totallyFreeList)) {
-        return;
-    }
-
-    entry = list_remove_tail(&m_totallyFreeList);
-    page = containing_record(entry, BlockAllocatorHdr, link);
-    m_pa->freePage((uintptr_t)page);
-    m_freePagesCount--;
-    m_freeBlocksCount -= m_blocksPerPage;
+    SizeClass &c = m_classes[cls];
+    c.stats.allocations += mag->allocations;
+    c.stats.frees += mag->frees;
+    mag->allocations = 0;
+    mag->frees = 0;
 }
 
-uintptr_t BlockAllocator::alloc()
+/** Fills half of the magazine, from the free list first */
+void SlabAllocator::refill(unsigned cls, Magazine *mag)
 {
+    SizeClass &c = m_classes[cls];
+    unsigned count = SLAB_MAGAZINE_SIZE / 2;
 
-    if (!m_freeBlocksCount) {
-        uintptr_t page = expand();
-        if (!page) {
-            return 0;
-        }
-    }
+    c.lock.lock();
 
-    list_t *freeItem;
+    flushStats(cls, mag);
 
-    if (list_empty(&m_freeList)) {
-        if (list_empty(&m_totallyFreeList)) {
-            assert(false);
-        }
-        freeItem = m_totallyFreeList.next;
-    }else {
-        freeItem = m_freeList.next;
+    while (mag->count < count && c.freeList) {
+        mag->blocks[mag->count++] = c.freeList;
+        c.freeList = c.freeList->next;
+        --c.freeCount;
     }
 
-    BlockAllocatorHdr *page = containing_record(freeItem, BlockAllocatorHdr, link);
-    assert((((uintptr_t)page) & (m_pageSize-1)) == 0);
+    while (mag->count < count) {
+        if (c.current + c.blockSize > c.end) {
+            uintptr_t region = osAlloc();
+            if (!region || !m_regions.set(region, cls + 1)) {
+                break;
+            }
 
-    unsigned fb = page->findFree(m_blocksPerPage);
-
-    page->alloc(fb);
-    m_freeBlocksCount--;
-
-    if (page->freeCount == m_blocksPerPage - 1) {
-        list_remove_entry(&page->link);
-        list_insert_head(&m_freeList, &page->link);
-    }
+            c.current = region;
+            c.end = region + SLAB_REGION_SIZE;
+            ++c.stats.regions;
+        }
 
-    if (!page->freeCount) {
-        list_remove_entry(&page->link);
-        list_insert_head(&m_busyList, &page->link);
-        m_freePagesCount--;
-        m_busyPagesCount++;
+        mag->blocks[mag->count++] = (void*) c.current;
+        c.current += c.blockSize;
     }
 
-    m_allocatedBlocksCount++;
-
-    uintptr_t ret = ((uintptr_t)page) + sizeof(BlockAllocatorHdr) + fb * m_blockSize;
-    memset((void*)ret, 0xEB, m_blockSize);
-    return ret;
+    c.lock.unlock();
 }
 
-
-void BlockAllocator::free(uintptr_t b)
+void SlabAllocator::drain(unsigned cls, Magazine *mag, unsigned count)
 {
-    uintptr_t bhdr = b & ~(m_pageSize-1);
-    BlockAllocatorHdr *hdr = (BlockAllocatorHdr*)bhdr;
-
-    assert(hdr->signature == (BLOCK_HDR_SIGNATURE | m_magic));
-
+    SizeClass &c = m_classes[cls];
 
-    memset((void*)b, 0xDB, m_blockSize);
+    c.lock.lock();
 
-    unsigned index = ((b & (m_pageSize-1)) - sizeof(BlockAllocatorHdr)) / m_blockSize;
+    flushStats(cls, mag);
 
-    hdr->free(index);
-    m_freeBlocksCount++;
-    m_allocatedBlocksCount--;
-
-    if (hdr->freeCount == 1) {
-        list_remove_entry(&hdr->link);
-        list_insert_head(&m_freeList, &hdr->link);
-        m_freePagesCount++;
-        m_busyPagesCount--;
-    }
-
-    if (hdr->freeCount == m_blocksPerPage) {
-      list_remove_entry(&hdr->link);
-      list_insert_head(&m_totallyFreeList, &hdr->link);
+    for (unsigned i = 0; i < count && mag->count; ++i) {
+        FreeBlock *b = (FreeBlock*) mag->blocks[--mag->count];
+        b->next = c.freeList;
+        c.freeList = b;
+        ++c.freeCount;
     }
 
-
+    c.lock.unlock();
 }
 
-SlabAllocator::SlabAllocator(unsigned minPo2, unsigned maxPo2)
+void SlabAllocator::flushThreadCache()
 {
-    assert(minPo2 <= maxPo2);
-
-    m_minPo2 = minPo2;
-    m_maxPo2 = maxPo2;
-
-    m_pa = new PageAllocator();
-
-    m_bas = new BlockAllocator*[m_maxPo2 - m_minPo2];
-
-    for (unsigned i=0; i<=(m_maxPo2 - m_minPo2); ++i) {
-        m_bas[i] = new BlockAllocator(m_pa, i + m_minPo2, i + m_minPo2);
+    for (unsigned i = 0; i < SLAB_CLASS_COUNT; ++i) {
+        drain(i, &t_magazines[i], SLAB_MAGAZINE_SIZE);
     }
 }
 
-SlabAllocator::~SlabAllocator()
+void SlabAllocator::lockAll()
 {
-    delete [] m_bas;
-    delete m_pa;
-}
-
-BlockAllocator *SlabAllocator::getSlab(uintptr_t addr) const
-{
-    //read the magic number
-    uintptr_t bhdr = addr & ~(m_pa->getPageSize()-1);
-    const BlockAllocatorHdr *hdr = (const BlockAllocatorHdr*)bhdr;
-
-    if ((hdr->signature & 0xFFFFFF00) != BLOCK_HDR_SIGNATURE) {
-        return NULL;
-    }
-
-    uint8_t m = hdr->signature & 0xFF;
-    if (!(m <= m_maxPo2 && m >= m_minPo2)) {
-        std::cerr << std::hex << "invalid signature " << hdr->signature << std::dec << std::endl;
-        assert(false);
+    for (unsigned i = 0; i < SLAB_CLASS_COUNT; ++i) {
+        m_classes[i].lock.lock();
     }
-
-    return m_bas[m - m_minPo2];
 }
 
-unsigned SlabAllocator::log(size_t size) const
+void SlabAllocator::unlockAll()
 {
-    if (size  >= 4 && size <= 8) {
-        return 3;
-    }else if (size  >= 9 && size <= 16) {
-        return 4;
-    }else if (size  >= 17 && size <= 32) {
-        return 5;
-    }else if (size  >= 33 && size <= 64) {
-        return 6;
-    }else if (size  >= 65 && size <= 128) {
-        return 7;
-    }else if (size  >= 129 && size <= 256) {
-        return 8;
+    for (unsigned i = SLAB_CLASS_COUNT; i > 0; --i) {
+        m_classes[i - 1].lock.unlock();
     }
-
-    return 0;
 }
 
-uintptr_t SlabAllocator::alloc(size_t size)
+/** The counters of other threads are only accounted when they refill or
+    drain their magazines, so the numbers are approximate. */
+void SlabAllocator::printStats(std::ostream &os)
 {
-    unsigned i = log(size);
-    if (!i || i < m_minPo2 || i > m_maxPo2) {
-        return 0;
-    }
-
-    uintptr_t ret = m_bas[i - m_minPo2]->alloc();
-
-    return ret;
-}
+    SlabClassStats stats[SLAB_CLASS_COUNT];
+    uint64_t freeCounts[SLAB_CLASS_COUNT];
 
-bool SlabAllocator::free(uintptr_t addr)
-{
-    BlockAllocator *b = getSlab(addr);
-    if (!b) {
-        //std::cerr << "Invalid addr " << std::hex << addr << std::dec << std::endl;
-        return false;
+    for (unsigned i = 0; i < SLAB_CLASS_COUNT; ++i) {
+        m_classes[i].lock.lock();
+        flushStats(i, &t_magazines[i]);
+        stats[i] = m_classes[i].stats;
+        freeCounts[i] = m_classes[i].freeCount;
+        m_classes[i].lock.unlock();
     }
-    assert(m_pa->belongsToUs(addr));
-
-    b->free(addr);
-    return true;
-}
 
-bool SlabAllocator::isValid(uintptr_t addr) const
-{
-    return getSlab(addr) != NULL;
-}
-
-void SlabAllocator::printStats(std::ostream &os) const
-{
-    uint64_t totalSize = 0;
+    uint64_t totalSize = 0, totalMapped = 0;
 
     os << std::dec << "Allocator statistics" << std::endl;
-    for (unsigned i=m_minPo2; i<= m_maxPo2; ++i) {
-        totalSize += (1<<i) * m_bas[i-m_minPo2]->getAllocatedBlocksCount();
-        os << "[" << (1<<i) <<  "] allocatedBlocks:" << m_bas[i-m_minPo2]->getAllocatedBlocksCount() << std::endl;
+    for (unsigned i = 0; i < SLAB_CLASS_COUNT; ++i) {
+        uint64_t live = stats[i].allocations - stats[i].frees;
+        totalSize += live * s_classSizes[i];
+        totalMapped += stats[i].regions * SLAB_REGION_SIZE;
+
+        os << "[" << s_classSizes[i] << "]"
+           << " allocatedBlocks:" << live
+           << " allocations:" << stats[i].allocations
+           << " freeBlocks:" << freeCounts[i]
+           << " regions:" << stats[i].regions << std::endl;
     }
-    os << "Total size:" << totalSize << std::endl;
+    os << "Total size:" << totalSize << " mapped:" << totalMapped << std::endl;
 }
 
 static SlabAllocator *s_slab = NULL;
@@ -453,6 +271,27 @@ void slab_print_stats(std::ostream &os)
     s_slab->printStats(os);
 }
 
+#ifndef _WIN32
+static pthread_key_t s_threadKey;
+static __thread bool t_threadRegistered = false;
+
+static void slab_thread_exit(void *)
+{
+    s_slab->flushThreadCache();
+}
+
+/* Keep the allocator consistent in the child of a fork */
+static void slab_prefork()
+{
+    s_slab->lockAll();
+}
+
+static void slab_postfork()
+{
+    s_slab->unlockAll();
+}
+#endif
+
 }
 
 extern "C" {
@@ -462,157 +301,102 @@ void slab_init()
         return;
     }
 
-    s2e::s_slab = new s2e::SlabAllocator(3, 8);
+#ifndef _WIN32
+    pthread_key_create(&s2e::s_threadKey, s2e::slab_thread_exit);
+    pthread_atfork(s2e::slab_prefork, s2e::slab_postfork, s2e::slab_postfork);
+#endif
+
+    s2e::s_slab = new s2e::SlabAllocator();
 }
 }
 
-static bool s_inalloc = false;
-
-void* operator new (size_t size)
+void* operator new (size_t size) throw(std::bad_alloc)
 {
-    if (!s2e::s_slab || s_inalloc) {
-        void *p = malloc(size);
-        if (!p) {
-            throw new std::bad_alloc();
+    s2e::SlabAllocator *slab = s2e::s_slab;
+    if (slab) {
+#ifndef _WIN32
+        //Return the magazines of the thread to the allocator when it exits
+        if (!s2e::t_threadRegistered) {
+            s2e::t_threadRegistered = true;
+            pthread_setspecific(s2e::s_threadKey, slab);
         }
-        return p;
-    }
+#endif
 
-    s_inalloc = true;
-    uintptr_t pr = s2e::s_slab->alloc(size);
-    if (pr) {
-        s_inalloc = false;
-        return (void*)pr;
+        void *p = slab->alloc(size);
+        if (p) {
+            return p;
+        }
     }
 
-    void *p = malloc(size);
+    void *p = malloc(size ? size : 1);
     if (!p) {
-        throw new std::bad_alloc();
+        throw std::bad_alloc();
     }
-
-    s_inalloc = false;
-
     return p;
 }
 
-void operator delete (void *p)
+void operator delete (void *p) throw()
 {
-    if (!s2e::s_slab) {
-        free(p);
+    if (!p) {
         return;
     }
 
-    s_inalloc = true;
-
-    if (!s2e::s_slab->free((uintptr_t)p)) {
-        assert(!s2e::s_slab->getPageAllocator()->belongsToUs((uintptr_t)p));
+    s2e::SlabAllocator *slab = s2e::s_slab;
+    if (!slab || !slab->free(p)) {
         free(p);
     }
-
-    s_inalloc = false;
 }
 
 
 
 
 #ifdef TESTSUITE_ALLOC
-using namespace s2e;
-
-void testPageAllocator()
-{
-    std::set<uintptr_t> allocated;
-
-    PageAllocator a;
-
-    unsigned count=0;
-    uintptr_t p = 0;
-    do {
-        p = a.allocPage();
-        //std::cout << "Page 0x" << std::hex << p << std::dec << std::endl;
-        ++count;
-        if (p) {
-            allocated.insert(p);
-        }
-    }while(p);
-
-    std::cout << "Allocated " << std::dec << count << " pages" << std::endl;
+#include <vector>
+#include <set>
 
-    while(allocated.size() > 0) {
-        a.freePage(*allocated.begin());
-        allocated.erase(*allocated.begin());
-    }
-}
+using namespace s2e;
 
-void testBlockAllocator(unsigned blockSizePo2)
+static void *testThread(void *)
 {
-    std::set<uintptr_t> allocated;
-
-    PageAllocator pa;
-    BlockAllocator ba(&pa, blockSizePo2);
-
-
-    unsigned count=0;
-    uintptr_t p = 0;
-
-    do {
-        p = ba.alloc();
-        //std::cout << "Block 0x" << std::hex << p << std::dec << std::endl;
-        ++count;
-
-
-        assert(allocated.find(p) == allocated.end());
-        if (p) {
-            try {
-            allocated.insert(p);
-        }catch(std::exception &e) {
-            break;
+    std::vector<uint64_t*> v;
+    for (unsigned round = 0; round < 100; ++round) {
+        for (unsigned i = 0; i < 10000; ++i) {
+            uint64_t *p = new uint64_t[(i % 32) + 1];
+            p[0] = (uintptr_t) p;
+            v.push_back(p);
         }
+        for (unsigned i = 0; i < v.size(); ++i) {
+            assert(v[i][0] == (uintptr_t) v[i]);
+            delete [] v[i];
         }
-    }while(p);
-
-    while(allocated.size() > 0) {
-        ba.free(*allocated.begin());
-        allocated.erase(*allocated.begin());
+        v.clear();
     }
-
-    std::cout << "Allocated " << std::dec << count << " blocks" << std::endl;
-
-}
-
-void testRandom(unsigned blockSizePo2)
-{
-
-}
-
-void testMalloc(unsigned blockSizePo2)
-{
-    while(malloc(1<<blockSizePo2))
-        ;
-}
-
-void test()
-{
-    uint8_t *v1 = new uint8_t;
-    uint64_t *v2 = new uint64_t;
-
-    std::cout << "Allocated v1=" << std::hex << (uintptr_t)v1 << std::dec << std::endl;
-    std::cout << "Allocated v2=" << std::hex << (uintptr_t)v2 << std::dec << std::endl;
+    return NULL;
 }
 
 int main(int argc, char **argv)
 {
+    slab_init();
 
-    test();
+    std::set<void*> allocated;
+    for (unsigned i = 1; i <= 1024; ++i) {
+        void *p = operator new(i);
+        assert(allocated.insert(p).second);
+        assert(s_slab->isValid(p) == (i <= SLAB_MAX_SIZE));
+        memset(p, 0xAB, i);
+    }
+    for (std::set<void*>::iterator it = allocated.begin(); it != allocated.end(); ++it) {
+        operator delete(*it);
+    }
 
-#if 0
-    //testPageAllocator();
-    for (unsigned i=3; i<11; ++i) {
-        if (argc > 2) {
-            testMalloc(i);
-        }else {
-            testBlockAllocator(i);
-        }
+    pthread_t threads[8];
+    for (unsigned i = 0; i < 8; ++i) {
+        pthread_create(&threads[i], NULL, testThread, NULL);
     }
-#endif
+    for (unsigned i = 0; i < 8; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    slab_print_stats(std::cout);
 }
 #endif
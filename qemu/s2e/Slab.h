@@ -40,253 +40,195 @@
 
 #include <inttypes.h>
 #include <assert.h>
-#include <memory.h>
+#include <stddef.h>
 
-#include <map>
-#include <vector>
-#include <set>
-
-#include "machine.h"
+#include <ostream>
 
 namespace s2e
 {
 
-#define containing_record(address, type, field) ((type *)( \
-  (uint8_t*)(address) - \
-  (uintptr_t)(&((type *)0)->field)))
-
-
-struct list_t
-{
-    list_t *next;
-    list_t *prev;
-};
-
-static inline void list_init_head(list_t *lh)
-{
-    lh->prev = lh->next = lh;
-}
-
-#define list_empty(head) ((head)->next == (head))
-
-static inline void list_remove_entry(list_t *entry)
-{
-    list_t *prev;
-    list_t *next;
-
-    next = entry->next;
-    prev = entry->prev;
-    prev->next = next;
-    next->prev = prev;
-}
-
-static inline void list_insert_head(list_t *list_head, list_t* entry)
-{
-    list_t *next;
+/**
+ * Size-class allocator for the small objects that S2E and KLEE allocate
+ * in large numbers (e.g., expressions).
+ *
+ * Memory is obtained from the OS in regions of SLAB_REGION_SIZE bytes
+ * aligned on their size. Each region serves a single size class, and a
+ * two-level map from region number to size class tells in O(1) whether
+ * an address belongs to the allocator, without touching the address.
+ *
+ * Each thread caches free blocks of each class in a magazine. Threads
+ * only take the lock of a class to refill or drain their magazine.
+ */
 
-    next = list_head->next;
-    entry->next = next;
-    entry->prev = list_head;
-    next->prev = entry;
-    list_head->next = entry;
-}
+#define SLAB_REGION_BITS 20
+#define SLAB_REGION_SIZE (1 << SLAB_REGION_BITS)
 
-static inline void list_insert_tail(list_t* list_head, list_t* entry)
-{
-    list_t* prev;
+//Blocks are 8-byte aligned, up to SLAB_MAX_SIZE bytes
+#define SLAB_MAX_SIZE 256
+#define SLAB_CLASS_COUNT 9
 
-    prev = list_head->prev;
-    entry->next = list_head;
-    entry->prev = prev;
-    prev->next = entry;
-    list_head->prev = entry;
-}
+#define SLAB_MAGAZINE_SIZE 64
 
-static inline list_t* list_remove_tail(list_t* list_head)
+class SlabSpinLock
 {
-    list_t* prev;
-    list_t* entry;
-
-    entry = list_head->prev;
-    prev = entry->prev;
-    list_head->prev = prev;
-    prev->next = list_head;
-    return entry;
-}
+private:
+    volatile int m_locked;
 
+public:
+    SlabSpinLock() : m_locked(0) {}
 
-//Allocates chunks of 256KB from the system
-#define REGION_SIZE (256*1024)
-class PageAllocator
-{
-private:
-    struct RegCmp {
-        bool operator() (uintptr_t r1, uintptr_t r2) const {
-            return r1 + REGION_SIZE <= r2;
+    void lock() {
+        while (__sync_lock_test_and_set(&m_locked, 1)) {
+            while (m_locked)
+                ;
         }
-    };
+    }
 
-    //region offset to bitmap
-    typedef std::map<uintptr_t, uintptr_t, RegCmp> RegionMap;
-    typedef std::set<uintptr_t, RegCmp> RegionSet;
-    RegionMap m_regions;
-    RegionSet m_busyRegions;
+    void unlock() {
+        __sync_lock_release(&m_locked);
+    }
+};
 
+/** Maps region numbers to size classes */
+class SlabRegionMap
+{
 private:
-    inline uintptr_t getRegionSize() const {
-        return REGION_SIZE;
-    }
+    //48-bit addresses: 12 bits for the root, 16 bits for the leaves
+    static const unsigned LeafBits = 16;
+    static const unsigned RootBits = 48 - SLAB_REGION_BITS - LeafBits;
 
-    uintptr_t osAlloc();
-    void osFree(uintptr_t region);
+    uint8_t *volatile m_root[1 << RootBits];
+    SlabSpinLock m_lock;
 
 public:
-    PageAllocator();
-    ~PageAllocator();
-
-    uintptr_t allocPage();
-    void freePage(uintptr_t page);
+    SlabRegionMap();
+
+    /** Returns the size class of the address plus one, or 0 */
+    inline unsigned get(uintptr_t addr) const {
+        uintptr_t region = addr >> SLAB_REGION_BITS;
+        uintptr_t root = region >> LeafBits;
+        if (root >= (1 << RootBits)) {
+            return 0;
+        }
 
-    uintptr_t getPageSize() const {
-        return 0x1000;
+        const uint8_t *leaf = m_root[root];
+        if (!leaf) {
+            return 0;
+        }
+        return leaf[region & ((1 << LeafBits) - 1)];
     }
 
-    bool belongsToUs(uintptr_t addr) const;
+    bool set(uintptr_t regionBase, unsigned value);
 };
 
-
-#define BLOCK_HDR_SIGNATURE 0x11AABB00
-
-//This is 128 bytes long
-struct BlockAllocatorHdr
+struct SlabClassStats
 {
-    list_t link;
-    uint32_t signature;
-    uint32_t freeCount;
-    uint64_t mask[8]; //Max 512 blocks of 8 bytes per page
-    uint8_t padding[40];
-
-    void init(BlockAllocatorHdr *a, uint32_t count) {
-        a->freeCount = count;
-        memset(a->mask, (unsigned)-1, sizeof(a->mask));
-    }
-
-    inline unsigned findFree(unsigned maxBlocks) const{
-        assert(freeCount > 0);
-        unsigned c = maxBlocks/(sizeof(mask[0])*8);
-        if (maxBlocks%(sizeof(mask[0])*8)) {
-            c++;
-        }
-        //std::cout << std::dec << freeCount << std::endl;
-        unsigned i = 0;
-        do {
-            if (mask[i]) {
-                uint64_t index = 0;
-                int r = bit_scan_forward_64(&index, mask[i]);
-                assert(r);
-                return index + i * sizeof(mask[0])*8;
-            }
-            i++;
-        }while(i<c);
-        assert(false);
-        return 0;
-    }
-
-    inline bool isFree(unsigned b) {
-        uint64_t d = b / (sizeof(mask[0])*8);
-        uint64_t r = b % (sizeof(mask[0])*8);
-        return mask[d] & (1LL << r);
-    }
+    uint64_t regions;
+    uint64_t allocations;
+    uint64_t frees;
+};
 
-    inline void alloc(unsigned b) {
-        assert(freeCount > 0);
-        assert(isFree(b));
+class SlabAllocator
+{
+private:
+    struct FreeBlock {
+        FreeBlock *next;
+    };
 
-        uint64_t d = b / (sizeof(mask[0])*8);
-        uint64_t r = b % (sizeof(mask[0])*8);
+    struct SizeClass {
+        SlabSpinLock lock;
+        unsigned blockSize;
 
-        mask[d] &= ~(1LL << r);
-        freeCount--;
-    }
+        FreeBlock *freeList;
+        uint64_t freeCount;
 
-    inline void free(unsigned b) {
-        assert(!isFree(b));
+        //Bump allocation in the last region
+        uintptr_t current;
+        uintptr_t end;
 
-        uint64_t d = b / (sizeof(mask[0])*8);
-        uint64_t r = b % (sizeof(mask[0])*8);
+        SlabClassStats stats;
+    };
 
-        mask[d] |= (1LL << r);
+    struct Magazine {
+        void *blocks[SLAB_MAGAZINE_SIZE];
+        unsigned count;
 
-        freeCount++;
-    }
+        //Not yet accounted in the class statistics
+        uint64_t allocations;
+        uint64_t frees;
+    };
 
-}__attribute__((packed));
+    SlabRegionMap m_regions;
+    SizeClass m_classes[SLAB_CLASS_COUNT];
 
+    //Size class of each size, in 8-byte units
+    uint8_t m_sizeToClass[SLAB_MAX_SIZE / 8 + 1];
 
-class BlockAllocator
-{
-private:
-    list_t m_totallyFreeList;
-    list_t m_freeList;
-    list_t m_busyList;
+    static __thread Magazine t_magazines[SLAB_CLASS_COUNT];
 
-    PageAllocator *m_pa;
-    uintptr_t m_pageSize;
-    uintptr_t m_blockSize;
-    uintptr_t m_blocksPerPage;
+    uintptr_t osAlloc();
+    void refill(unsigned cls, Magazine *mag);
+    void drain(unsigned cls, Magazine *mag, unsigned count);
+    void flushStats(unsigned cls, Magazine *mag);
 
-    uint64_t m_freePagesCount;
-    uint64_t m_busyPagesCount;
-    uint64_t m_freeBlocksCount;
+public:
+    SlabAllocator();
 
-    uint64_t m_allocatedBlocksCount;
-    uint8_t m_magic;
+    inline void *alloc(size_t size) {
+        if (!size || size > SLAB_MAX_SIZE) {
+            return NULL;
+        }
 
-public:
-    BlockAllocator(PageAllocator *pa, unsigned blockSizePo2, uint8_t magic = 0);
+        unsigned cls = m_sizeToClass[(size + 7) / 8];
+        Magazine *mag = &t_magazines[cls];
+        if (!mag->count) {
+            refill(cls, mag);
+            if (!mag->count) {
+                return NULL;
+            }
+        }
 
-    ~BlockAllocator()
-    {
-        //Not necessary to free anything, the page allocator will do it
+        ++mag->allocations;
+        return mag->blocks[--mag->count];
     }
 
-    uintptr_t expand();
-    void shrink();
+    /** Returns false if the address was not allocated by us */
+    inline bool free(void *p) {
+        unsigned cls = m_regions.get((uintptr_t) p);
+        if (!cls) {
+            return false;
+        }
 
-    uintptr_t alloc();
-    void free(uintptr_t b);
+        --cls;
+        Magazine *mag = &t_magazines[cls];
+        if (mag->count == SLAB_MAGAZINE_SIZE) {
+            drain(cls, mag, SLAB_MAGAZINE_SIZE / 2);
+        }
 
-    uint64_t getAllocatedBlocksCount() const {
-        return m_allocatedBlocksCount;
+        ++mag->frees;
+        mag->blocks[mag->count++] = p;
+        return true;
     }
-};
-
 
-class SlabAllocator
-{
-private:
-    PageAllocator *m_pa;
-    BlockAllocator **m_bas;
+    bool isValid(const void *p) const {
+        return m_regions.get((uintptr_t) p) != 0;
+    }
 
-    unsigned m_minPo2, m_maxPo2;
+    /** Returns the blocks cached by the calling thread to the classes */
+    void flushThreadCache();
 
-    BlockAllocator *getSlab(uintptr_t addr) const;
-    unsigned log(size_t s) const;
-public:
-    SlabAllocator(unsigned minPo2, unsigned maxPo2);
-    ~SlabAllocator();
+    void lockAll();
+    void unlockAll();
 
-    uintptr_t alloc(size_t s);
-    bool free(uintptr_t addr);
-    bool isValid(uintptr_t addr) const;
+    void printStats(std::ostream &os);
+};
 
-    void printStats(std::ostream &os) const;
+void slab_print_stats(std::ostream &os);
 
-    const PageAllocator *getPageAllocator() const {
-        return m_pa;
-    }
-};
+}
 
+extern "C" {
+void slab_init();
 }
 
 
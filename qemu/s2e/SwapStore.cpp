@@ -0,0 +1,295 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#include "config-host.h"
+#include "SwapStore.h"
+
+#include <algorithm>
+#include <cassert>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef CONFIG_WIN32
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace s2e {
+
+SwapStore::SwapStore(const std::string &directory, unsigned blockSize,
+                     uint64_t chunkSize)
+{
+    m_directory = directory;
+    m_blockSize = blockSize;
+    m_chunkSize = chunkSize;
+    m_pageSize = 0;
+    m_fd = -1;
+    m_forkFd = -1;
+    m_lastChunkUsed = 0;
+}
+
+#if defined(CONFIG_WIN32)
+
+SwapStore::~SwapStore() {}
+bool SwapStore::initialize() { return false; }
+int SwapStore::createFile() { return -1; }
+bool SwapStore::addChunk() { return false; }
+bool SwapStore::isInStore(const uint8_t *block) const { return false; }
+uint8_t *SwapStore::allocate(unsigned size) { return NULL; }
+bool SwapStore::release(uint8_t *store, unsigned size) { return false; }
+uint64_t SwapStore::swapOut(std::vector<const uint8_t*> &keep) { return 0; }
+bool SwapStore::prepareFork() { return true; }
+void SwapStore::completeFork(bool useCopy) {}
+
+#else
+
+SwapStore::~SwapStore()
+{
+    for (unsigned i = 0; i < m_chunks.size(); ++i) {
+        munmap(m_chunks[i], m_chunkSize);
+    }
+
+    if (m_forkFd >= 0) {
+        close(m_forkFd);
+    }
+
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+/** The file is unlinked right away, it only lives as long as its mappings */
+int SwapStore::createFile()
+{
+    std::string path = m_directory + "/s2e-swap-XXXXXX";
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back(0);
+
+    int fd = mkstemp(&name[0]);
+    if (fd < 0) {
+        fprintf(stderr, "SwapStore: could not create %s (%s)\n",
+                path.c_str(), strerror(errno));
+        return -1;
+    }
+
+    unlink(&name[0]);
+    return fd;
+}
+
+bool SwapStore::initialize()
+{
+    m_pageSize = getpagesize();
+    if (!m_blockSize || m_pageSize % m_blockSize || m_chunkSize % m_pageSize) {
+        fprintf(stderr, "SwapStore: blocks of %u bytes are not supported\n",
+                m_blockSize);
+        return false;
+    }
+
+    m_fd = createFile();
+    return m_fd >= 0;
+}
+
+bool SwapStore::addChunk()
+{
+    uint64_t offset = m_chunks.size() * m_chunkSize;
+
+    if (ftruncate(m_fd, offset + m_chunkSize) < 0) {
+        return false;
+    }
+
+    void *chunk = mmap(NULL, m_chunkSize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, m_fd, offset);
+    if (chunk == MAP_FAILED) {
+        return false;
+    }
+
+    m_chunkIndex[(uint8_t*) chunk] = m_chunks.size();
+    m_chunks.push_back((uint8_t*) chunk);
+    m_lastChunkUsed = 0;
+    return true;
+}
+
+bool SwapStore::isInStore(const uint8_t *block) const
+{
+    std::map<uint8_t*, unsigned>::const_iterator it =
+            m_chunkIndex.upper_bound(const_cast<uint8_t*>(block));
+
+    if (it == m_chunkIndex.begin()) {
+        return false;
+    }
+
+    --it;
+    return block < (*it).first + m_chunkSize;
+}
+
+uint8_t *SwapStore::allocate(unsigned size)
+{
+    if (size != m_blockSize) {
+        return NULL;
+    }
+
+    if (!m_freeBlocks.empty()) {
+        uint8_t *block = m_freeBlocks.back();
+        m_freeBlocks.pop_back();
+        return block;
+    }
+
+    if (m_chunks.empty() || (m_lastChunkUsed + 1) * m_blockSize > m_chunkSize) {
+        if (!addChunk()) {
+            return NULL;
+        }
+    }
+
+    return m_chunks.back() + m_blockSize * m_lastChunkUsed++;
+}
+
+bool SwapStore::release(uint8_t *store, unsigned size)
+{
+    if (size != m_blockSize || !isInStore(store)) {
+        return false;
+    }
+
+    m_freeBlocks.push_back(store);
+    return true;
+}
+
+uint64_t SwapStore::swapOut(std::vector<const uint8_t*> &keep)
+{
+    std::sort(keep.begin(), keep.end());
+
+    uint64_t released = 0;
+
+    std::map<uint8_t*, unsigned>::iterator it;
+    for (it = m_chunkIndex.begin(); it != m_chunkIndex.end(); ++it) {
+        uint8_t *start = (*it).first;
+        uint8_t *end = start + m_chunkSize;
+
+        std::vector<const uint8_t*>::iterator kit =
+                std::lower_bound(keep.begin(), keep.end(), start);
+
+        for (; kit != keep.end() && *kit < end; ++kit) {
+            uint8_t *page = (uint8_t*) ((uintptr_t) *kit & ~(uintptr_t) (m_pageSize - 1));
+            if (page < start) {
+                continue;
+            }
+
+            if (page > start) {
+                madvise(start, page - start, MADV_DONTNEED);
+                released += page - start;
+            }
+            start = page + m_pageSize;
+        }
+
+        if (start < end) {
+            madvise(start, end - start, MADV_DONTNEED);
+            released += end - start;
+        }
+    }
+
+#ifdef CONFIG_LINUX
+    //Start writing the dropped pages back, so that the kernel
+    //can reclaim them without waiting for the flusher threads.
+    sync_file_range(m_fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+
+    return released;
+}
+
+bool SwapStore::prepareFork()
+{
+    assert(m_forkFd < 0);
+
+    int fd = createFile();
+    if (fd < 0) {
+        return false;
+    }
+
+    uint64_t size = getSize();
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return false;
+    }
+
+    std::vector<uint8_t> buffer(1024 * 1024);
+    for (uint64_t offset = 0; offset < size; offset += buffer.size()) {
+        size_t count = std::min((uint64_t) buffer.size(), size - offset);
+        if (pread(m_fd, &buffer[0], count, offset) != (ssize_t) count ||
+            pwrite(fd, &buffer[0], count, offset) != (ssize_t) count) {
+            fprintf(stderr, "SwapStore: could not copy the swap file (%s)\n",
+                    strerror(errno));
+            close(fd);
+            return false;
+        }
+    }
+
+    m_forkFd = fd;
+    return true;
+}
+
+void SwapStore::completeFork(bool useCopy)
+{
+    if (m_forkFd < 0) {
+        return;
+    }
+
+    if (!useCopy) {
+        close(m_forkFd);
+        m_forkFd = -1;
+        return;
+    }
+
+    //The parent keeps the original file, the child remaps the copy at the same addresses
+    for (unsigned i = 0; i < m_chunks.size(); ++i) {
+        void *chunk = mmap(m_chunks[i], m_chunkSize, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_FIXED, m_forkFd, i * m_chunkSize);
+        if (chunk != m_chunks[i]) {
+            fprintf(stderr, "SwapStore: could not remap the swap file (%s)\n",
+                    strerror(errno));
+            exit(-1);
+        }
+    }
+
+    close(m_fd);
+    m_fd = m_forkFd;
+    m_forkFd = -1;
+}
+
+#endif
+
+}
@@ -0,0 +1,114 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2E_SWAPSTORE_H
+#define S2E_SWAPSTORE_H
+
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include <klee/Memory.h>
+
+namespace s2e {
+
+/**
+ *  Allocates the concrete stores of memory objects from a file that is
+ *  mapped in memory. The pages that only idle states use can then be
+ *  dropped from RAM: the kernel writes them back to the file and pages
+ *  them in again when a resumed state accesses them.
+ */
+class SwapStore : public klee::ConcreteStoreAllocator {
+private:
+    std::string m_directory;
+    unsigned m_blockSize;
+    uint64_t m_chunkSize;
+    unsigned m_pageSize;
+
+    int m_fd;
+
+    /** Copy of the file that the child of a process fork moves to */
+    int m_forkFd;
+
+    /** Mapped chunks, in file order */
+    std::vector<uint8_t*> m_chunks;
+
+    /** Chunk base address to chunk index */
+    std::map<uint8_t*, unsigned> m_chunkIndex;
+
+    /** Number of blocks handed out from the last chunk */
+    uint64_t m_lastChunkUsed;
+
+    std::vector<uint8_t*> m_freeBlocks;
+
+    int createFile();
+    bool addChunk();
+    bool isInStore(const uint8_t *block) const;
+
+public:
+    SwapStore(const std::string &directory, unsigned blockSize,
+              uint64_t chunkSize);
+    ~SwapStore();
+
+    bool initialize();
+
+    virtual uint8_t *allocate(unsigned size);
+    virtual bool release(uint8_t *store, unsigned size);
+
+    /**
+     * Drops from RAM all the pages of the store, except those that
+     * contain one of the blocks in keep. The vector gets sorted.
+     * Returns the number of bytes that were released.
+     */
+    uint64_t swapOut(std::vector<const uint8_t*> &keep);
+
+    /**
+     * The mapping is shared with forked processes. prepareFork() copies
+     * the file before the fork. After the fork, the child must call
+     * completeFork(true) to move to the copy before it does anything else,
+     * the parent calls completeFork(false) and keeps the original file.
+     */
+    bool prepareFork();
+    void completeFork(bool useCopy);
+
+    uint64_t getSize() const {
+        return m_chunks.size() * m_chunkSize;
+    }
+};
+
+}
+
+#endif
@@ -97,6 +97,8 @@ void s2e_print_apic(CPUArchState *env);
 /* Functions from CorePlugin.cpp */
 
 void s2e_tcg_execution_handler(void* signal, uint64_t pc);
+void s2e_tcg_execution_handler1(void* functor, uint64_t pc);
+void s2e_tcg_execution_handler2(void* functor1, void* functor2, uint64_t pc);
 void s2e_tcg_custom_instruction_handler(uint64_t arg);
 
 /** Called by the translator when a custom instruction is detected */
@@ -256,6 +258,17 @@ void s2e_tb_free(struct S2E* s2e, struct TranslationBlock *tb);
     in order to update tb->s2e_tb->llvm_function */
 void s2e_set_tb_function(struct S2E* s2e, struct TranslationBlock *tb);
 
+/** Store in pointers up to max host addresses that the generated code
+    of the TB embeds (the TB itself and its execution signals).
+    Returns the total number of such addresses. */
+unsigned s2e_tb_get_host_pointers(struct TranslationBlock *tb,
+                                  uint64_t *pointers, unsigned max);
+
+/** Generate LLVM code for one of the TBs queued for speculative
+    translation. Called while the CPU is idle.
+    Returns non-zero if there may be more TBs to translate. */
+int s2e_translate_speculative_tb(struct S2E* s2e);
+
 void s2e_flush_tb_cache(void);
 void s2e_flush_tlb_cache(void);
 void s2e_flush_tlb_cache_page(void *objectState, int mmu_idx, int index);
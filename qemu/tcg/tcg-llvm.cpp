@@ -87,6 +87,22 @@ static void *qemu_st_helpers[5] = {
 #include <llvm/Support/DynamicLibrary.h>
 #include <llvm/Support/raw_ostream.h>
 
+#ifdef CONFIG_S2E
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/system_error.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include <map>
+#include <set>
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <iostream>
 #include <sstream>
 
@@ -111,6 +127,21 @@ extern "C" {
 
 using namespace llvm;
 
+#ifdef CONFIG_S2E
+extern "C" {
+unsigned s2e_tb_get_host_pointers(struct TranslationBlock *tb,
+                                  uint64_t *pointers, unsigned max);
+}
+
+namespace {
+    cl::opt<std::string>
+    TranslationCacheDir("llvm-translation-cache",
+            cl::desc("Directory where optimized LLVM code of translation"
+                     " blocks is kept across runs (empty=off)"),
+            cl::init(""));
+}
+#endif
+
 class TJITMemoryManager;
 
 struct TCGLLVMContextPrivate {
@@ -127,6 +158,12 @@ struct TCGLLVMContextPrivate {
     /* Function pass manager (used for optimizing the code) */
     FunctionPassManager *m_functionPassManager;
 
+    /* Cheap pipeline that is run on every new TB when tiered
+       optimization is enabled. Hot TBs are later optimized
+       with m_functionPassManager. */
+    FunctionPassManager *m_fastPassManager;
+    bool m_tieredOptimization;
+
 #ifdef CONFIG_S2E
     /* Declaration of a wrapper function for helpers */
     Function *m_helperTraceMemoryAccess;
@@ -161,6 +198,26 @@ struct TCGLLVMContextPrivate {
 
     BasicBlock* m_labels[TCG_MAX_LABELS];
 
+#ifdef CONFIG_S2E
+    /* Persistent translation cache. Generated functions embed the
+       addresses of the TB and of its execution signals, which change
+       from run to run. These pointers are normalized in the cache key
+       and relocated when a cached function is loaded. */
+    struct CacheEntryInfo {
+        std::string key;
+        std::vector<uint64_t> pointers;
+    };
+
+    bool m_cacheInitialized;
+    uint64_t m_cacheBuildId;
+
+    /* Functions waiting to be optimized before being cached */
+    std::map<Function*, CacheEntryInfo> m_pendingCacheEntries;
+
+    /* Functions loaded from the cache (already optimized) */
+    std::set<Function*> m_cachedFunctions;
+#endif
+
 public:
     TCGLLVMContextPrivate();
     ~TCGLLVMContextPrivate();
@@ -176,6 +233,10 @@ public:
         return m_functionPassManager;
     }
 
+    void setTieredOptimization(bool enabled) {
+        m_tieredOptimization = enabled;
+    }
+
     /* Shortcuts */
     llvm::Type* intType(int w) { return IntegerType::get(m_context, w); }
     llvm::Type* intPtrType(int w) { return PointerType::get(intType(w), 0); }
@@ -262,6 +323,29 @@ public:
     int generateOperation(int opc, const TCGArg *args);
 
     void generateCode(TCGContext *s, TranslationBlock *tb);
+
+#ifdef CONFIG_S2E
+    bool isCacheEnabled();
+    std::string computeCacheKey(TranslationBlock *tb,
+                                const std::vector<uint64_t> &pointers);
+    std::string getCachePath(const std::string &key) const;
+    Function* getOrCreateDeclaration(Function *decl);
+    Function* loadCachedFunction(const std::string &key,
+                                 const std::vector<uint64_t> &pointers,
+                                 const std::string &name);
+    void storeCachedFunction(Function *f);
+
+    bool isCachedFunction(Function *f) const {
+        return m_cachedFunctions.count(f);
+    }
+
+    void forgetFunction(Function *f) {
+        m_pendingCacheEntries.erase(f);
+        m_cachedFunctions.erase(f);
+    }
+
+    Function* createOptimizedFunction(Function *f);
+#endif
 };
 
 /* Custom JITMemoryManager in order to capture the size of
@@ -352,8 +436,12 @@ public:
 };
 
 TCGLLVMContextPrivate::TCGLLVMContextPrivate()
-    : m_context(getGlobalContext()), m_builder(m_context), m_tbCount(0),
+    : m_context(getGlobalContext()), m_builder(m_context),
+      m_tieredOptimization(false), m_tbCount(0),
       m_tcgContext(NULL), m_tbFunction(NULL)
+#ifdef CONFIG_S2E
+      , m_cacheInitialized(false), m_cacheBuildId(0)
+#endif
 {
     std::memset(m_values, 0, sizeof(m_values));
     std::memset(m_memValuesPtr, 0, sizeof(m_memValuesPtr));
@@ -389,11 +477,22 @@ TCGLLVMContextPrivate::TCGLLVMContextPrivate()
     //m_functionPassManager->add(new SelectRemovalPass());
 
     m_functionPassManager->doInitialization();
+
+    m_fastPassManager = new FunctionPassManager(m_module);
+    m_fastPassManager->add(
+            new DataLayout(*m_executionEngine->getDataLayout()));
+
+    m_fastPassManager->add(createPromoteMemoryToRegisterPass());
+    m_fastPassManager->add(createEarlyCSEPass());
+    m_fastPassManager->add(createCFGSimplificationPass());
+
+    m_fastPassManager->doInitialization();
 }
 
 TCGLLVMContextPrivate::~TCGLLVMContextPrivate()
 {
     delete m_functionPassManager;
+    delete m_fastPassManager;
 
     // the following line will also delete
     // m_moduleProvider, m_module and all its functions
@@ -1330,6 +1429,30 @@ void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
     std::ostringstream fName;
     fName << "tcg-llvm-tb-" << (m_tbCount++) << "-" << std::hex << tb->pc;
 
+    m_tcgContext = s;
+
+#ifdef CONFIG_S2E
+    std::string cacheKey;
+    std::vector<uint64_t> cachePointers;
+    if (isCacheEnabled()) {
+        unsigned count = s2e_tb_get_host_pointers(tb, NULL, 0);
+        cachePointers.resize(count);
+        if (count) {
+            s2e_tb_get_host_pointers(tb, &cachePointers[0], count);
+        }
+
+        cacheKey = computeCacheKey(tb, cachePointers);
+        m_tbFunction = loadCachedFunction(cacheKey, cachePointers, fName.str());
+        if (m_tbFunction) {
+            m_cachedFunctions.insert(m_tbFunction);
+            tb->llvm_function = m_tbFunction;
+            tb->llvm_tc_ptr = 0;
+            tb->llvm_tc_end = 0;
+            return;
+        }
+    }
+#endif
+
     /*
     if(m_tbFunction)
         m_tbFunction->eraseFromParent();
@@ -1344,8 +1467,6 @@ void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
             "entry", m_tbFunction);
     m_builder.SetInsertPoint(basicBlock);
 
-    m_tcgContext = s;
-
     /* Prepare globals and temps information */
     initGlobalsAndLocalTemps();
 
@@ -1400,11 +1521,21 @@ void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
     verifyFunction(*m_tbFunction);
 #endif
 
-    //KLEE will optimize the function later
-    //m_functionPassManager->run(*m_tbFunction);
+    //KLEE will optimize the function later, unless the TB is cold
+    if (m_tieredOptimization) {
+        m_fastPassManager->run(*m_tbFunction);
+    }
 
     tb->llvm_function = m_tbFunction;
 
+#ifdef CONFIG_S2E
+    if (!cacheKey.empty()) {
+        CacheEntryInfo &info = m_pendingCacheEntries[m_tbFunction];
+        info.key = cacheKey;
+        info.pointers = cachePointers;
+    }
+#endif
+
     if(execute_llvm || qemu_loglevel_mask(CPU_LOG_LLVM_ASM)) {
         tb->llvm_tc_ptr = (uint8_t*)
                 m_executionEngine->getPointerToFunction(m_tbFunction);
@@ -1434,6 +1565,411 @@ void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
     }
 }
 
+#ifdef CONFIG_S2E
+
+/****************************************/
+/* Persistent cache of translated code  */
+
+static inline void cacheHashMix(uint64_t &h1, uint64_t &h2, uint64_t v)
+{
+    h1 = (h1 ^ v) * 0x100000001b3ULL;
+    h2 = (h2 + v) * 0x9e3779b97f4a7c15ULL;
+    h2 ^= h2 >> 29;
+}
+
+static void cacheHashString(uint64_t &h1, uint64_t &h2, const char *str)
+{
+    for (; *str; ++str) {
+        cacheHashMix(h1, h2, (uint8_t) *str);
+    }
+    cacheHashMix(h1, h2, 0);
+}
+
+bool TCGLLVMContextPrivate::isCacheEnabled()
+{
+    if (TranslationCacheDir.empty() || execute_llvm) {
+        return false;
+    }
+
+    if (m_cacheInitialized) {
+        return m_cacheBuildId != 0;
+    }
+
+    m_cacheInitialized = true;
+
+    if (mkdir(TranslationCacheDir.c_str(), 0755) < 0 && errno != EEXIST) {
+        llvm::errs() << "Could not create translation cache directory "
+                     << TranslationCacheDir << '\n';
+        return false;
+    }
+
+    /* Cached code is only valid for the binary that generated it */
+    uint64_t h1 = 0xcbf29ce484222325ULL, h2 = 0;
+    cacheHashString(h1, h2, __DATE__ " " __TIME__);
+    struct stat st;
+    if (stat("/proc/self/exe", &st) == 0) {
+        cacheHashMix(h1, h2, st.st_size);
+        cacheHashMix(h1, h2, st.st_mtime);
+    }
+    m_cacheBuildId = (h1 ^ h2) | 1;
+    return true;
+}
+
+typedef std::map<uint64_t, unsigned> CachePointerIndex;
+
+static void buildPointerIndex(const std::vector<uint64_t> &pointers,
+                              CachePointerIndex &index)
+{
+    for (unsigned i = 0; i < pointers.size(); ++i) {
+        if (pointers[i]) {
+            index.insert(std::make_pair(pointers[i], i));
+        }
+    }
+}
+
+/* Host pointers may carry tags in their low bits, e.g., gen_goto_tb
+   emits exit_tb(tb + n). Values in [ptr, ptr+3] are therefore matched
+   as the index of ptr plus an offset. */
+static bool lookupPointer(const CachePointerIndex &index, uint64_t value,
+                          unsigned *pointer, unsigned *offset)
+{
+    CachePointerIndex::const_iterator it = index.upper_bound(value);
+    if (it == index.begin()) {
+        return false;
+    }
+    --it;
+    if (value - (*it).first > 3) {
+        return false;
+    }
+    *pointer = (*it).second;
+    *offset = value - (*it).first;
+    return true;
+}
+
+/* The key is computed over the TCG ops of the block, which capture the
+   guest code, the CPU mode flags and the instrumentation added by plugins.
+   Host pointers are replaced by their index, so that the same block
+   gets the same key in every run. */
+std::string TCGLLVMContextPrivate::computeCacheKey(TranslationBlock *tb,
+                                        const std::vector<uint64_t> &pointers)
+{
+    CachePointerIndex pointerIndex;
+    buildPointerIndex(pointers, pointerIndex);
+
+    uint64_t h1 = 0xcbf29ce484222325ULL ^ m_cacheBuildId;
+    uint64_t h2 = m_cacheBuildId;
+    cacheHashMix(h1, h2, tb->flags);
+    cacheHashMix(h1, h2, tb->cflags);
+
+    const TCGArg *args = gen_opparam_buf;
+    for (int opc_index = 0; ; ++opc_index) {
+        int opc = gen_opc_buf[opc_index];
+        if (opc == INDEX_op_end) {
+            break;
+        }
+
+        TCGOpDef &def = tcg_op_defs[opc];
+        int nb_args = def.nb_args;
+        if (opc == INDEX_op_call) {
+            nb_args = (args[0] >> 16) + (args[0] & 0xffff) + def.nb_cargs + 1;
+        } else if (opc == INDEX_op_nopn) {
+            nb_args = args[0];
+        }
+
+        bool isMovi = opc == INDEX_op_movi_i32 || opc == INDEX_op_movi_i64;
+
+        cacheHashMix(h1, h2, opc);
+        for (int i = 0; i < nb_args; ++i) {
+            unsigned pointer, offset;
+            const char *helperName = NULL;
+            if (lookupPointer(pointerIndex, args[i], &pointer, &offset)) {
+                cacheHashMix(h1, h2, (uint64_t) -1);
+                cacheHashMix(h1, h2, pointer);
+                cacheHashMix(h1, h2, offset);
+            } else if (isMovi && i == 1 && args[i] &&
+                       (helperName = tcg_helper_get_name(m_tcgContext,
+                                                         (void*) args[i]))) {
+                /* Helper addresses change between runs of a PIE binary */
+                cacheHashString(h1, h2, helperName);
+            } else {
+                cacheHashMix(h1, h2, args[i]);
+            }
+        }
+
+        args += nb_args;
+    }
+
+    char key[33];
+    snprintf(key, sizeof(key), "%016" PRIx64 "%016" PRIx64, h1, h2);
+    return key;
+}
+
+std::string TCGLLVMContextPrivate::getCachePath(const std::string &key) const
+{
+    return TranslationCacheDir + "/" + key + ".bc";
+}
+
+/* Find the function of the main module that corresponds to the
+   given declaration of a cached module */
+Function* TCGLLVMContextPrivate::getOrCreateDeclaration(Function *decl)
+{
+    const std::string name = decl->getName();
+    Function *f = m_module->getFunction(name);
+    if (f) {
+        return f->getFunctionType() == decl->getFunctionType() ? f : NULL;
+    }
+
+    if (decl->isIntrinsic()) {
+        return Function::Create(decl->getFunctionType(),
+                                Function::ExternalLinkage, name, m_module);
+    }
+
+    /* Native helpers are declared on first use by generateOperation */
+    if (name.compare(0, 7, "helper_") != 0) {
+        return NULL;
+    }
+
+    for (int i = 0; i < m_tcgContext->nb_helpers; ++i) {
+        const TCGHelperInfo &info = m_tcgContext->helpers[i];
+        if (info.name && name.compare(7, std::string::npos, info.name) == 0) {
+            f = Function::Create(decl->getFunctionType(),
+                                 Function::PrivateLinkage, name, m_module);
+            m_executionEngine->addGlobalMapping(f, (void*) info.func);
+            sys::DynamicLibrary::AddSymbol(name, (void*) info.func);
+            return f;
+        }
+    }
+
+    return NULL;
+}
+
+Function* TCGLLVMContextPrivate::loadCachedFunction(const std::string &key,
+                                        const std::vector<uint64_t> &pointers,
+                                        const std::string &name)
+{
+    OwningPtr<MemoryBuffer> buffer;
+    if (MemoryBuffer::getFile(getCachePath(key), buffer)) {
+        return NULL;
+    }
+
+    std::string error;
+    Module *cached = ParseBitcodeFile(buffer.get(), m_context, &error);
+    if (!cached) {
+        return NULL;
+    }
+
+    Function *result = NULL;
+    Function *cachedFunction = cached->getFunction("tb");
+    NamedMDNode *md = cached->getNamedMetadata("tcg-llvm.pointers");
+    MDNode *savedPointers = md && md->getNumOperands() == 1 ?
+                            md->getOperand(0) : NULL;
+
+    std::vector<uint64_t> oldPointers;
+    ValueToValueMapTy vmap;
+    bool ok = cachedFunction && !cachedFunction->isDeclaration() &&
+              savedPointers &&
+              savedPointers->getNumOperands() == pointers.size();
+
+    for (unsigned i = 0; ok && i < pointers.size(); ++i) {
+        ConstantInt *ci = dyn_cast<ConstantInt>(savedPointers->getOperand(i));
+        ok = ci != NULL;
+        if (ok) {
+            oldPointers.push_back(ci->getZExtValue());
+        }
+    }
+
+    CachePointerIndex relocations;
+    buildPointerIndex(oldPointers, relocations);
+
+    for (Module::iterator it = cached->begin(); ok && it != cached->end(); ++it) {
+        if (&*it == cachedFunction) {
+            continue;
+        }
+        Function *f = getOrCreateDeclaration(&*it);
+        ok = f != NULL;
+        vmap[&*it] = f;
+    }
+
+    if (ok) {
+        result = Function::Create(cachedFunction->getFunctionType(),
+                                  Function::PrivateLinkage, name, m_module);
+
+        Function::arg_iterator dst = result->arg_begin();
+        for (Function::arg_iterator src = cachedFunction->arg_begin(),
+             se = cachedFunction->arg_end(); src != se; ++src, ++dst) {
+            vmap[&*src] = &*dst;
+        }
+
+        SmallVector<ReturnInst*, 8> returns;
+        CloneFunctionInto(result, cachedFunction, vmap, true, returns);
+
+        /* Relocate the TB and signal pointers */
+        for (Function::iterator bb = result->begin(); bb != result->end(); ++bb) {
+            for (BasicBlock::iterator ii = bb->begin(); ii != bb->end(); ++ii) {
+                for (unsigned i = 0; i < ii->getNumOperands(); ++i) {
+                    ConstantInt *ci = dyn_cast<ConstantInt>(ii->getOperand(i));
+                    if (!ci || ci->getBitWidth() != 64) {
+                        continue;
+                    }
+                    unsigned pointer, offset;
+                    if (lookupPointer(relocations, ci->getZExtValue(),
+                                      &pointer, &offset)) {
+                        ii->setOperand(i, ConstantInt::get(ci->getType(),
+                                                pointers[pointer] + offset));
+                    }
+                }
+            }
+        }
+    }
+
+    delete cached;
+    return result;
+}
+
+static bool constantUsesPointer(const Constant *c,
+                                const CachePointerIndex &pointers)
+{
+    if (const ConstantInt *ci = dyn_cast<ConstantInt>(c)) {
+        unsigned pointer, offset;
+        return ci->getBitWidth() == 64 &&
+               lookupPointer(pointers, ci->getZExtValue(), &pointer, &offset);
+    }
+
+    for (unsigned i = 0; i < c->getNumOperands(); ++i) {
+        const Constant *op = dyn_cast<Constant>(c->getOperand(i));
+        if (op && !isa<GlobalValue>(op) && constantUsesPointer(op, pointers)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void collectReferencedFunctions(const Value *v, std::set<Function*> &functions)
+{
+    if (const Function *f = dyn_cast<Function>(v)) {
+        functions.insert(const_cast<Function*>(f));
+    } else if (const ConstantExpr *ce = dyn_cast<ConstantExpr>(v)) {
+        for (unsigned i = 0; i < ce->getNumOperands(); ++i) {
+            collectReferencedFunctions(ce->getOperand(i), functions);
+        }
+    }
+}
+
+/* Called once the function has been optimized by KLEE */
+void TCGLLVMContextPrivate::storeCachedFunction(Function *f)
+{
+    std::map<Function*, CacheEntryInfo>::iterator pit =
+            m_pendingCacheEntries.find(f);
+    if (pit == m_pendingCacheEntries.end()) {
+        return;
+    }
+
+    CacheEntryInfo info = pit->second;
+    m_pendingCacheEntries.erase(pit);
+
+    /* Pointers can only be relocated if they appear as plain operands.
+       Code that references global variables is not cached either. */
+    CachePointerIndex pointers;
+    buildPointerIndex(info.pointers, pointers);
+    std::set<Function*> functions;
+    for (Function::iterator bb = f->begin(); bb != f->end(); ++bb) {
+        for (BasicBlock::iterator ii = bb->begin(); ii != bb->end(); ++ii) {
+            for (unsigned i = 0; i < ii->getNumOperands(); ++i) {
+                const Value *op = ii->getOperand(i);
+                if (isa<GlobalVariable>(op) || isa<GlobalAlias>(op)) {
+                    return;
+                }
+                if (isa<ConstantExpr>(op)) {
+                    if (constantUsesPointer(cast<Constant>(op), pointers)) {
+                        return;
+                    }
+                }
+                collectReferencedFunctions(op, functions);
+            }
+        }
+    }
+
+    Module *cached = new Module("tcg-llvm-cache", m_context);
+    cached->setDataLayout(m_module->getDataLayout());
+    cached->setTargetTriple(m_module->getTargetTriple());
+
+    ValueToValueMapTy vmap;
+    for (std::set<Function*>::iterator it = functions.begin();
+         it != functions.end(); ++it) {
+        vmap[*it] = Function::Create((*it)->getFunctionType(),
+                                     Function::ExternalLinkage,
+                                     (*it)->getName(), cached);
+    }
+
+    Function *cachedFunction = Function::Create(f->getFunctionType(),
+            Function::ExternalLinkage, "tb", cached);
+    Function::arg_iterator dst = cachedFunction->arg_begin();
+    for (Function::arg_iterator src = f->arg_begin(), se = f->arg_end();
+         src != se; ++src, ++dst) {
+        vmap[&*src] = &*dst;
+    }
+
+    SmallVector<ReturnInst*, 8> returns;
+    CloneFunctionInto(cachedFunction, f, vmap, true, returns);
+
+    std::vector<Value*> savedPointers;
+    for (unsigned i = 0; i < info.pointers.size(); ++i) {
+        savedPointers.push_back(ConstantInt::get(intType(64), info.pointers[i]));
+    }
+    cached->getOrInsertNamedMetadata("tcg-llvm.pointers")->addOperand(
+            MDNode::get(m_context, savedPointers));
+
+    /* Several S2E instances may share the cache directory */
+    std::string path = getCachePath(info.key);
+    std::ostringstream tmpPath;
+    tmpPath << path << ".tmp" << getpid();
+
+    std::string error;
+    {
+        raw_fd_ostream os(tmpPath.str().c_str(), error, raw_fd_ostream::F_Binary);
+        if (error.empty()) {
+            WriteBitcodeToFile(cached, os);
+            os.close();
+            if (os.has_error()) {
+                os.clear_error();
+                error = "write error";
+            }
+        }
+    }
+
+    if (!error.empty() || rename(tmpPath.str().c_str(), path.c_str()) < 0) {
+        unlink(tmpPath.str().c_str());
+    }
+
+    delete cached;
+}
+
+
+/* Returns a copy of the function of a hot TB optimized with the
+   full pipeline. The original function is left untouched because
+   suspended states may still be executing it. */
+Function* TCGLLVMContextPrivate::createOptimizedFunction(Function *f)
+{
+    ValueToValueMapTy vmap;
+    Function *optimized = CloneFunction(f, vmap, false);
+    optimized->setName(f->getName() + "-opt");
+    m_module->getFunctionList().push_back(optimized);
+
+    m_functionPassManager->run(*optimized);
+
+    /* Cache the optimized version instead of the original one */
+    std::map<Function*, CacheEntryInfo>::iterator it =
+            m_pendingCacheEntries.find(f);
+    if (it != m_pendingCacheEntries.end()) {
+        m_pendingCacheEntries[optimized] = it->second;
+        m_pendingCacheEntries.erase(it);
+    }
+
+    return optimized;
+}
+
+#endif
+
 /***********************************/
 /* External interface for C++ code */
 
@@ -1479,6 +2015,33 @@ void TCGLLVMContext::initializeHelpers()
 }
 #endif
 
+#ifdef CONFIG_S2E
+bool TCGLLVMContext::isCachedFunction(llvm::Function *f) const
+{
+    return m_private->isCachedFunction(f);
+}
+
+void TCGLLVMContext::storeInCache(llvm::Function *f)
+{
+    m_private->storeCachedFunction(f);
+}
+
+void TCGLLVMContext::forgetFunction(llvm::Function *f)
+{
+    m_private->forgetFunction(f);
+}
+
+void TCGLLVMContext::setTieredOptimization(bool enabled)
+{
+    m_private->setTieredOptimization(enabled);
+}
+
+llvm::Function* TCGLLVMContext::createOptimizedFunction(llvm::Function *f)
+{
+    return m_private->createOptimizedFunction(f);
+}
+#endif
+
 void TCGLLVMContext::generateCode(TCGContext *s, TranslationBlock *tb)
 {
     assert(tb->tcg_llvm_context == NULL);
@@ -1519,6 +2082,9 @@ void tcg_llvm_tb_alloc(TranslationBlock *tb)
 void tcg_llvm_tb_free(TranslationBlock *tb)
 {
     if(tb->llvm_function) {
+#ifdef CONFIG_S2E
+        tcg_llvm_ctx->forgetFunction(tb->llvm_function);
+#endif
         tb->llvm_function->eraseFromParent();
     }
 }
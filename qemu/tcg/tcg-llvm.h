@@ -130,6 +130,23 @@ public:
 #ifdef CONFIG_S2E
     /** Called after linking all helper libraries */
     void initializeHelpers();
+
+    /** Returns true if the function was loaded from the translation
+        cache and therefore does not need to be optimized again */
+    bool isCachedFunction(llvm::Function *f) const;
+
+    /** Save the (optimized) function of a TB in the translation cache */
+    void storeInCache(llvm::Function *f);
+
+    /** Must be called before the function of a TB is deleted */
+    void forgetFunction(llvm::Function *f);
+
+    /** Run only a cheap pipeline on new TBs. Hot TBs must then be
+        recompiled with createOptimizedFunction() */
+    void setTieredOptimization(bool enabled);
+
+    /** Return an optimized copy of the function of a TB */
+    llvm::Function* createOptimizedFunction(llvm::Function *f);
 #endif
 
     void generateCode(struct TCGContext *s,
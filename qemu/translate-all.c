@@ -251,4 +251,57 @@ int cpu_gen_llvm(CPUArchState *env, TranslationBlock *tb)
     return 0;
 }
 
+/* Returns non-zero if the code page at vaddr is in the TLB and
+   still maps to the given physical page */
+static int tb_code_page_mapped(CPUArchState *env, target_ulong vaddr,
+                               tb_page_addr_t page_addr)
+{
+    int mmu_idx, page_index;
+
+    vaddr &= TARGET_PAGE_MASK;
+    mmu_idx = cpu_mmu_index(env);
+    page_index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    if (env->tlb_table[mmu_idx][page_index].addr_code != vaddr) {
+        return 0;
+    }
+
+    return get_page_addr_code(env, vaddr) == page_addr;
+}
+
+/** Generates LLVM code for an already translated TB outside of the
+    CPU loop. The TB is only translated if all its code pages are in
+    the TLB, so that fetching the code cannot fault and modify the guest
+    state. Returns non-zero if the TB was translated. */
+int cpu_gen_llvm_speculative(CPUArchState *env, TranslationBlock *tb)
+{
+    s2e_jmp_buf saved_jmp_env;
+
+    if (tb->llvm_function) {
+        return 0;
+    }
+
+    if (!tb_code_page_mapped(env, tb->pc, tb->page_addr[0])) {
+        return 0;
+    }
+
+    if (tb->page_addr[1] != -1 &&
+        !tb_code_page_mapped(env, tb->pc + TARGET_PAGE_SIZE,
+                             tb->page_addr[1])) {
+        return 0;
+    }
+
+    /* Plugins may exit the CPU loop from translation callbacks.
+       The CPU loop's jump buffer is restored on both paths. */
+    memcpy(saved_jmp_env, env->jmp_env, sizeof(env->jmp_env));
+
+    if (s2e_setjmp(env->jmp_env) != 0) {
+        memcpy(env->jmp_env, saved_jmp_env, sizeof(env->jmp_env));
+        return 0;
+    }
+
+    cpu_gen_llvm(env, tb);
+    memcpy(env->jmp_env, saved_jmp_env, sizeof(env->jmp_env));
+    return 1;
+}
+
 #endif
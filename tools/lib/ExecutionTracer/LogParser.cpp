@@ -35,6 +35,8 @@
 
 #include <iostream>
 #include <cassert>
+#include <string.h>
+#include <zlib.h>
 #include "LogParser.h"
 
 #ifdef _WIN32
@@ -45,6 +47,7 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <pthread.h>
 
 
 
@@ -89,6 +92,9 @@ LogParser::LogParser():LogEvents()
 {
     m_cachedProcessor = NULL;
     m_cachedState = NULL;
+    m_itemCount = 0;
+    m_currentChunk = 0;
+    m_inflatedChunk = (unsigned) -1;
 }
 
 LogParser::~LogParser()
@@ -110,22 +116,99 @@ LogParser::~LogParser()
 }
 
 
-bool LogParser::parse(const std::vector<std::string> fileNames)
+namespace {
+
+struct ScanContext {
+    void *files;
+    unsigned count;
+    unsigned next;
+#ifndef _WIN32
+    pthread_mutex_t lock;
+#endif
+};
+
+}
+
+bool LogParser::parse(const std::vector<std::string> fileNames, unsigned jobs)
 {
-    std::vector<std::string>::const_iterator it;
-    for (it = fileNames.begin(); it != fileNames.end(); ++it) {
-        if (!parse(*it)) {
-            std::cerr << *it << " is incomplete" << std::endl;
+    std::vector<ParsedFile> files(fileNames.size());
+    for (unsigned i = 0; i < fileNames.size(); ++i) {
+        files[i].fileName = fileNames[i];
+    }
+
+    ScanContext context;
+    context.files = &files;
+    context.count = files.size();
+    context.next = 0;
+
+#ifdef _WIN32
+    scanWorker(&context);
+#else
+    if (!jobs) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? cpus : 1;
+    }
+
+    if (jobs > files.size()) {
+        jobs = files.size();
+    }
+
+    pthread_mutex_init(&context.lock, NULL);
+
+    //The calling thread is one of the workers
+    std::vector<pthread_t> threads;
+    for (unsigned i = 1; i < jobs; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, scanWorker, &context)) {
+            break;
+        }
+        threads.push_back(thread);
+    }
+
+    scanWorker(&context);
+
+    for (unsigned i = 0; i < threads.size(); ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&context.lock);
+#endif
+
+    for (unsigned i = 0; i < files.size(); ++i) {
+        if (!mergeFile(files[i])) {
+            std::cerr << files[i].fileName << " is incomplete" << std::endl;
         }
     }
     return true;
 }
 
-
-bool LogParser::parse(const std::string &fileName)
+void *LogParser::scanWorker(void *c)
 {
-    LogFile element;
+    ScanContext *context = static_cast<ScanContext*>(c);
+    std::vector<ParsedFile> &files = *static_cast<std::vector<ParsedFile>*>(context->files);
+
+    while (true) {
+        unsigned index;
+#ifndef _WIN32
+        pthread_mutex_lock(&context->lock);
+#endif
+        index = context->next++;
+#ifndef _WIN32
+        pthread_mutex_unlock(&context->lock);
+#endif
+
+        if (index >= context->count) {
+            break;
+        }
+
+        scanFile(files[index]);
+    }
 
+    return NULL;
+}
+
+bool LogParser::mapFile(const std::string &fileName, LogFile &element)
+{
 #ifdef _WIN32
     element.m_hFile = CreateFile(fileName.c_str(), GENERIC_READ,
                               FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
@@ -165,13 +248,15 @@ bool LogParser::parse(const std::string &fileName)
     off_t fileSize = lseek(file, 0, SEEK_END);
     if (fileSize == (off_t) -1) {
         std::cerr << "Could not get log file size" << std::endl;
+        close(file);
         return false;
     }
 
     element.m_File = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, file, 0);
-    if (!element.m_File) {
+    close(file);
+    if (element.m_File == MAP_FAILED) {
         std::cerr << "Could not map the log file in memory" << std::endl;
-        close(file);
+        element.m_File = NULL;
         return false;
     }
 
@@ -179,9 +264,45 @@ bool LogParser::parse(const std::string &fileName)
 
 #endif
 
+    return true;
+}
+
+bool LogParser::parse(const std::string &fileName)
+{
+    ParsedFile pf;
+    pf.fileName = fileName;
+    scanFile(pf);
+    return mergeFile(pf);
+}
+
+void LogParser::scanFile(ParsedFile &pf)
+{
+    pf.complete = false;
+    pf.compressed = false;
+    pf.mapped = mapFile(pf.fileName, pf.file);
+    if (!pf.mapped) {
+        return;
+    }
+
+    const s2e::plugins::ExecutionTraceFileHeader *hdr =
+            (const s2e::plugins::ExecutionTraceFileHeader *)pf.file.m_File;
 
+    if (pf.file.m_size >= sizeof(*hdr) && hdr->magic == EXECTRACE_COMPRESSED_MAGIC) {
+        pf.compressed = true;
+        scanCompressed(pf);
+    } else {
+        scanFlat(pf);
+    }
+}
+
+//Records the address of each item and splits the trace into runs
+void LogParser::scanFlat(ParsedFile &pf)
+{
+    LogFile &element = pf.file;
     uint64_t currentOffset = 0;
-    unsigned currentItem = m_ItemAddresses.size();
+    unsigned currentItem = 0;
+
+    pf.complete = true;
 
     uint8_t *buffer = (uint8_t*)element.m_File;
 
@@ -192,7 +313,18 @@ bool LogParser::parse(const std::string &fileName)
 
         if (currentOffset + sizeof(s2e::plugins::ExecutionTraceItemHeader) > element.m_size) {
             std::cerr << "LogParser: Could not read header " << std::endl;
-            return false;
+            pf.complete = false;
+            break;
+        }
+
+        /* A memory-mapped trace that was not closed ends with the zeroed
+           tail of its last segment. No item has an all-zero header, because
+           module load items always have a payload. */
+        static const s2e::plugins::ExecutionTraceItemHeader zeroHeader = {};
+        if (!memcmp(hdr, &zeroHeader, sizeof(*hdr))) {
+            std::cerr << "LogParser: Trace ends with zeros at offset " << currentOffset << std::endl;
+            pf.complete = false;
+            break;
         }
 
         buffer += sizeof(*hdr);
@@ -200,37 +332,242 @@ bool LogParser::parse(const std::string &fileName)
         if (hdr->size > 0) {
             if (currentOffset + hdr->size > element.m_size) {
                 std::cerr << "LogParser: Could not read payload " << std::endl;
-                return false;
+                pf.complete = false;
+                break;
             }
         }
 
 #ifdef DEBUG_PB
-        std::cout << fileName <<  " item=" << currentItem << " buffer="   << (void*)buffer <<
+        std::cout << pf.fileName <<  " item=" << currentItem << " buffer="   << (void*)buffer <<
                      " ts=" << hdr->timeStamp <<  " offset=" << currentOffset << std::endl;
 #endif
-        processItem(currentItem, *hdr, buffer);
+        bool fork = hdr->type == s2e::plugins::TRACE_FORK;
+        if (fork || pf.runs.empty() || pf.runs.back().fork ||
+            pf.runs.back().stateId != hdr->stateId) {
+            ItemRun run;
+            run.firstItem = currentItem;
+            run.itemCount = 0;
+            run.stateId = hdr->stateId;
+            run.fork = fork;
+            pf.runs.push_back(run);
+        }
+        ++pf.runs.back().itemCount;
+
         buffer+=hdr->size;
 
-        m_ItemAddresses.push_back(currentOffset + (uint8_t*)element.m_File);
+        pf.addresses.push_back(currentOffset + (uint8_t*)element.m_File);
 
         currentOffset += sizeof(s2e::plugins::ExecutionTraceItemHeader)  + hdr->size;
 
         ++currentItem;
     }
+}
 
-    m_files.push_back(element);
-    //fclose(file);
+/**
+ *  Read the chunk descriptors of a compressed trace. They come from the
+ *  index at the end of the file. Traces that were not closed properly
+ *  have no index, in which case the descriptors are collected by walking
+ *  the chunks.
+ */
+bool LogParser::readChunkIndex(LogFile &element,
+                               std::vector<s2e::plugins::ExecutionTraceChunkIndexEntry> &index)
+{
+    const uint8_t *base = (const uint8_t*)element.m_File;
+    const s2e::plugins::ExecutionTraceFileHeader *hdr =
+            (const s2e::plugins::ExecutionTraceFileHeader *)base;
+
+    if (hdr->indexOffset) {
+        uint64_t size = (uint64_t) hdr->chunkCount * sizeof(s2e::plugins::ExecutionTraceChunkIndexEntry);
+        if (hdr->indexOffset + size <= element.m_size) {
+            const s2e::plugins::ExecutionTraceChunkIndexEntry *entries =
+                    (const s2e::plugins::ExecutionTraceChunkIndexEntry *)(base + hdr->indexOffset);
+            index.assign(entries, entries + hdr->chunkCount);
+            return true;
+        }
+        std::cerr << "LogParser: The chunk index is truncated" << std::endl;
+    }
+
+    uint64_t offset = sizeof(*hdr);
+    while (offset + sizeof(s2e::plugins::ExecutionTraceChunk) <= element.m_size) {
+        s2e::plugins::ExecutionTraceChunkIndexEntry entry;
+        memcpy(&entry.chunk, base + offset, sizeof(entry.chunk));
+        entry.offset = offset + sizeof(entry.chunk);
+
+        if (!entry.chunk.itemCount ||
+            entry.offset + entry.chunk.compressedSize > element.m_size) {
+            break;
+        }
+
+        index.push_back(entry);
+        offset = entry.offset + entry.chunk.compressedSize;
+    }
+
+    std::cerr << "LogParser: No chunk index, recovered " << index.size() << " chunks" << std::endl;
+    return false;
+}
+
+void LogParser::scanCompressed(ParsedFile &pf)
+{
+    pf.complete = readChunkIndex(pf.file, pf.index);
+
+    unsigned currentItem = 0;
+    std::vector<s2e::plugins::ExecutionTraceChunkIndexEntry>::const_iterator it;
+    for (it = pf.index.begin(); it != pf.index.end(); ++it) {
+        ItemRun run;
+        run.firstItem = currentItem;
+        run.itemCount = (*it).chunk.itemCount;
+        run.stateId = (*it).chunk.stateId;
+        run.fork = (*it).chunk.typeMask & (1 << s2e::plugins::TRACE_FORK);
+        pf.runs.push_back(run);
+        currentItem += run.itemCount;
+    }
+}
+
+//Registers the items of a scanned file and emits the parsing events
+bool LogParser::mergeFile(ParsedFile &pf)
+{
+    if (!pf.mapped) {
+        return false;
+    }
+
+    m_files.push_back(pf.file);
+
+    unsigned base = m_itemCount;
+
+    if (pf.compressed) {
+        std::vector<s2e::plugins::ExecutionTraceChunkIndexEntry>::const_iterator it;
+        for (it = pf.index.begin(); it != pf.index.end(); ++it) {
+            TraceChunk chunk;
+            chunk.firstItem = m_itemCount;
+            chunk.itemCount = (*it).chunk.itemCount;
+            chunk.fileIndex = m_files.size() - 1;
+            chunk.compressed = true;
+            chunk.addressBase = 0;
+            chunk.info = (*it).chunk;
+            chunk.offset = (*it).offset;
+
+            m_chunks.push_back(chunk);
+            m_itemCount += chunk.itemCount;
+        }
+    } else {
+        TraceChunk chunk;
+        chunk.firstItem = m_itemCount;
+        chunk.itemCount = pf.addresses.size();
+        chunk.fileIndex = m_files.size() - 1;
+        chunk.compressed = false;
+        chunk.addressBase = m_ItemAddresses.size();
+        chunk.offset = 0;
+
+        m_chunks.push_back(chunk);
+        m_itemCount += chunk.itemCount;
+        m_ItemAddresses.insert(m_ItemAddresses.end(), pf.addresses.begin(), pf.addresses.end());
+    }
+
+    bool emitRanges = !onItemRange.empty();
+
+    std::vector<ItemRun>::const_iterator it;
+    for (it = pf.runs.begin(); it != pf.runs.end(); ++it) {
+        const ItemRun &run = *it;
+        unsigned first = base + run.firstItem;
+
+        if (emitRanges && !run.fork) {
+            if (run.itemCount) {
+                onItemRange.emit(first, first + run.itemCount - 1, run.stateId);
+            }
+            continue;
+        }
+
+        for (unsigned i = first; i < first + run.itemCount; ++i) {
+            s2e::plugins::ExecutionTraceItemHeader hdr;
+            void *data;
+            if (!getItem(i, hdr, &data)) {
+                std::cerr << "LogParser: Could not read item " << i << std::endl;
+                return false;
+            }
+            processItem(i, hdr, data);
+        }
+    }
+
+    return pf.complete;
+}
+
+bool LogParser::inflateChunk(unsigned chunkIndex)
+{
+    if (m_inflatedChunk == chunkIndex) {
+        return true;
+    }
+
+    const TraceChunk &chunk = m_chunks[chunkIndex];
+    const LogFile &file = m_files[chunk.fileIndex];
+
+    m_inflatedChunk = (unsigned) -1;
+    m_chunkItemOffsets.clear();
+    m_chunkData.resize(chunk.info.uncompressedSize);
+
+    uLongf size = chunk.info.uncompressedSize;
+    if (!size || uncompress(&m_chunkData[0], &size,
+                            (const Bytef*) file.m_File + chunk.offset,
+                            chunk.info.compressedSize) != Z_OK) {
+        return false;
+    }
+
+    uint64_t offset = 0;
+    while (offset + sizeof(s2e::plugins::ExecutionTraceItemHeader) <= size) {
+        const s2e::plugins::ExecutionTraceItemHeader *hdr =
+                (const s2e::plugins::ExecutionTraceItemHeader *)&m_chunkData[offset];
+        m_chunkItemOffsets.push_back(offset);
+        offset += sizeof(*hdr) + hdr->size;
+    }
+
+    if (offset != size || m_chunkItemOffsets.size() != chunk.itemCount) {
+        return false;
+    }
+
+    m_inflatedChunk = chunkIndex;
     return true;
 }
 
+unsigned LogParser::findChunk(unsigned item)
+{
+    const TraceChunk &current = m_chunks[m_currentChunk];
+    if (item >= current.firstItem && item - current.firstItem < current.itemCount) {
+        return m_currentChunk;
+    }
+
+    //Chunks are sorted by their first item
+    unsigned lo = 0, hi = m_chunks.size();
+    while (hi - lo > 1) {
+        unsigned mid = (lo + hi) / 2;
+        if (m_chunks[mid].firstItem <= item) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    m_currentChunk = lo;
+    return lo;
+}
+
 bool LogParser::getItem(unsigned index, s2e::plugins::ExecutionTraceItemHeader &hdr, void **data)
 {
-    if (index >= m_ItemAddresses.size() ) {
+    if (index >= m_itemCount) {
         assert(false);
         return false;
     }
 
-    uint8_t *buffer = m_ItemAddresses[index];
+    const TraceChunk &chunk = m_chunks[findChunk(index)];
+    uint8_t *buffer;
+
+    if (chunk.compressed) {
+        if (!inflateChunk(m_currentChunk)) {
+            return false;
+        }
+        buffer = &m_chunkData[m_chunkItemOffsets[index - chunk.firstItem]];
+    } else {
+        buffer = m_ItemAddresses[chunk.addressBase + index - chunk.firstItem];
+    }
+
     hdr = *(s2e::plugins::ExecutionTraceItemHeader*)buffer;
 
     *data = NULL;
@@ -118,8 +118,67 @@ private:
 
     typedef std::vector<LogFile> LogFiles;
 
+    /**
+     *  Consecutive items of a trace. Flat traces form a single chunk whose
+     *  item addresses are kept in m_ItemAddresses. Compressed traces have
+     *  one chunk per compressed block, which is inflated on demand.
+     */
+    struct TraceChunk {
+        unsigned firstItem;
+        unsigned itemCount;
+        unsigned fileIndex;
+        bool compressed;
+        unsigned addressBase;
+        s2e::plugins::ExecutionTraceChunk info;
+        uint64_t offset;
+    };
+
+    typedef std::vector<TraceChunk> TraceChunks;
+
     LogFiles m_files;
+    TraceChunks m_chunks;
     std::vector<uint8_t*> m_ItemAddresses;
+    unsigned m_itemCount;
+
+    //The last chunk that was looked up and the inflated compressed chunk
+    unsigned m_currentChunk;
+    unsigned m_inflatedChunk;
+    std::vector<uint8_t> m_chunkData;
+    std::vector<uint32_t> m_chunkItemOffsets;
+
+    //Consecutive items of one state. Forks are always in a run of their own.
+    struct ItemRun {
+        unsigned firstItem;
+        unsigned itemCount;
+        uint32_t stateId;
+        bool fork;
+    };
+
+    /**
+     *  Result of scanning one trace file. Files are scanned in parallel
+     *  and merged in the order in which they were given, which keeps the
+     *  item numbering and the order of the events deterministic.
+     */
+    struct ParsedFile {
+        std::string fileName;
+        LogFile file;
+        bool mapped;
+        bool complete;
+        bool compressed;
+        std::vector<uint8_t*> addresses;
+        std::vector<s2e::plugins::ExecutionTraceChunkIndexEntry> index;
+        std::vector<ItemRun> runs;
+    };
+
+    static bool mapFile(const std::string &fileName, LogFile &file);
+    static void scanFile(ParsedFile &pf);
+    static void scanFlat(ParsedFile &pf);
+    static void scanCompressed(ParsedFile &pf);
+    static bool readChunkIndex(LogFile &file, std::vector<s2e::plugins::ExecutionTraceChunkIndexEntry> &index);
+    static void *scanWorker(void *context);
+    bool mergeFile(ParsedFile &pf);
+    bool inflateChunk(unsigned chunkIndex);
+    unsigned findChunk(unsigned item);
 
     ItemProcessors m_ItemProcessors;
     void *m_cachedProcessor;
@@ -132,10 +191,30 @@ public:
     LogParser();
     virtual ~LogParser();
 
-    bool parse(const std::vector<std::string> fileNames);
+    /**
+     *  Parses the given trace files with the given number of threads
+     *  (0 for one per CPU). Only the scanning of the files is parallel,
+     *  the item events are emitted serially in the order of the files.
+     */
+    bool parse(const std::vector<std::string> fileNames, unsigned jobs = 1);
     bool parse(const std::string &file);
     bool getItem(unsigned index, s2e::plugins::ExecutionTraceItemHeader &hdr, void **data);
 
+    /**
+     *  Emitted while parsing for each run of consecutive items of one state
+     *  that does not contain forks, with the first and last item indexes
+     *  and the state id of the run. When this signal has subscribers, the
+     *  items of these runs are not passed to onEachItem and the chunks of
+     *  compressed traces are not inflated: they can be read later with
+     *  getItem. For compressed traces, the data returned by
+     *  getItem remains valid until the next call to getItem.
+     */
+    sigc::signal<void,
+        unsigned,
+        unsigned,
+        uint32_t
+    >onItemRange;
+
     virtual ItemProcessorState* getState(void *processor, ItemProcessorStateFactory f);
     virtual ItemProcessorState* getState(void *processor, uint32_t pathId);
     virtual void getPaths(PathSet &s);
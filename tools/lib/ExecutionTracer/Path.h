@@ -149,6 +149,11 @@ private:
     StateToSegments m_Leaves;
     LogParser *m_Parser;
     sigc::connection m_connection;
+    sigc::connection m_rangeConnection;
+
+    void appendItems(unsigned firstIndex, unsigned lastIndex, uint32_t stateId);
+
+    void onItemRange(unsigned firstIndex, unsigned lastIndex, uint32_t stateId);
 
     void onItem(unsigned traceIndex,
                 const s2e::plugins::ExecutionTraceItemHeader &hdr,
@@ -120,6 +120,10 @@ PathBuilder::PathBuilder(LogParser *log)
             sigc::mem_fun(*this, &PathBuilder::onItem)
     );
 
+    m_rangeConnection = log->onItemRange.connect(
+            sigc::mem_fun(*this, &PathBuilder::onItemRange)
+    );
+
     m_Root = new PathSegment(NULL, 0, 0);
     m_CurrentSegment = m_Root;
     m_Leaves[0].push_back(m_CurrentSegment);
@@ -128,6 +132,7 @@ PathBuilder::PathBuilder(LogParser *log)
 PathBuilder::~PathBuilder()
 {
     m_connection.disconnect();
+    m_rangeConnection.disconnect();
 
     StateToSegments::iterator it;
 
@@ -141,23 +146,19 @@ PathBuilder::~PathBuilder()
     }
 }
 
-void PathBuilder::onItem(unsigned traceIndex,
-            const s2e::plugins::ExecutionTraceItemHeader &hdr,
-            void *item)
+//Appends the given range of trace items to the current segment of the state
+void PathBuilder::appendItems(unsigned firstIndex, unsigned lastIndex, uint32_t stateId)
 {
     assert(m_CurrentSegment);
-#ifdef DEBUG_PB
-    std::cout << "PB: ID=" << (unsigned)hdr.stateId << " T=" << (unsigned)hdr.type << std::endl;
-#endif
 
-    if (hdr.stateId != m_CurrentSegment->getStateId()) {
+    if (stateId != m_CurrentSegment->getStateId()) {
         //Lookup the current state
-        StateToSegments::iterator it = m_Leaves.find(hdr.stateId);
+        StateToSegments::iterator it = m_Leaves.find(stateId);
 
         //There must have been a fork that generated the state
         if (it == m_Leaves.end()) {
             std::cout << "Encountered a state id that was not forked before " <<
-                    (int) hdr.stateId << std::endl;
+                    (int) stateId << std::endl;
             assert(false);
         }
 
@@ -174,16 +175,16 @@ void PathBuilder::onItem(unsigned traceIndex,
 
 
         //Check that the segment really belongs to us
-        assert(m_CurrentSegment->getStateId() == hdr.stateId);
+        assert(m_CurrentSegment->getStateId() == stateId);
 
         //Since we have just switched to a new state, we must start a new fragment
-        m_CurrentSegment->appendFragment(PathFragment(traceIndex, traceIndex));
+        m_CurrentSegment->appendFragment(PathFragment(firstIndex, firstIndex));
 
         //m_CurrentSegment->print(std::cout);
     }
 
     ///////////////////////////
-    assert(m_CurrentSegment->getStateId() == hdr.stateId);
+    assert(m_CurrentSegment->getStateId() == stateId);
 
     //Extend the current segment with a fragment
     //Note that forks are the last items in each fragment
@@ -191,15 +192,35 @@ void PathBuilder::onItem(unsigned traceIndex,
         #ifdef DEBUG_PB
         std::cout << "Creating new fragment for segment " << m_CurrentSegment->getStateId() << std::endl;
         #endif
-        m_CurrentSegment->appendFragment(PathFragment(traceIndex, traceIndex));
+        m_CurrentSegment->appendFragment(PathFragment(firstIndex, lastIndex));
     }else
     {
-        m_CurrentSegment->expandLastFragment(traceIndex);
+        m_CurrentSegment->expandLastFragment(lastIndex);
     }
 
     #ifdef DEBUG_PB
     m_CurrentSegment->print(std::cout);
     #endif
+}
+
+void PathBuilder::onItemRange(unsigned firstIndex, unsigned lastIndex, uint32_t stateId)
+{
+#ifdef DEBUG_PB
+    std::cout << "PB: ID=" << stateId << " range=" << firstIndex << "-" << lastIndex << std::endl;
+#endif
+
+    appendItems(firstIndex, lastIndex, stateId);
+}
+
+void PathBuilder::onItem(unsigned traceIndex,
+            const s2e::plugins::ExecutionTraceItemHeader &hdr,
+            void *item)
+{
+#ifdef DEBUG_PB
+    std::cout << "PB: ID=" << (unsigned)hdr.stateId << " T=" << (unsigned)hdr.type << std::endl;
+#endif
+
+    appendItems(traceIndex, traceIndex, hdr.stateId);
 
     ///////////////////////////
     if (hdr.type == s2e::plugins::TRACE_FORK) {
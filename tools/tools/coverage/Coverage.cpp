@@ -77,6 +77,9 @@ ModDir("moddir", cl::desc("Directory containing binary modules, the basic block
 cl::opt<bool>
     Compact("compact", cl::desc("Do not display non-covered blocks"), cl::init(false));
 
+cl::opt<unsigned>
+    Jobs("jobs", cl::desc("Number of threads that parse the trace files (0=one per CPU)"), cl::init(0));
+
 
 //cl::opt<std::string>
 //    CovType("covtype", cl::desc("Coverage type"), cl::init("basicblock"));
@@ -534,7 +537,7 @@ CoverageTool::~CoverageTool()
 void CoverageTool::flatTrace()
 {
     PathBuilder pb(&m_parser);
-    m_parser.parse(TraceFiles);
+    m_parser.parse(TraceFiles, Jobs);
 
     ModuleCache mc(&pb);
     Coverage cov(&m_binaries, &mc, &pb);
@@ -70,6 +70,9 @@ cl::opt<std::string>
 cl::list<std::string>
     ModDir("moddir", cl::desc("Directory containing the binary modules"));
 
+cl::opt<unsigned>
+    Jobs("jobs", cl::desc("Number of threads that parse the trace files (0=one per CPU)"), cl::init(0));
+
 }
 
 namespace s2etools
@@ -285,7 +288,7 @@ int main(int argc, char **argv)
 
     LogParser parser;
     PathBuilder pb(&parser);
-    parser.parse(TraceFiles);
+    parser.parse(TraceFiles, Jobs);
 
     ModuleCache mc(&pb);
     ForkProfiler fp(&library, &mc, &pb);
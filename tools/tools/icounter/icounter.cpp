@@ -71,6 +71,9 @@ cl::opt<std::string>
 cl::list<std::string>
     ModPath("modpath", cl::desc("Path to modules"));
 
+cl::opt<unsigned>
+    Jobs("jobs", cl::desc("Number of threads that parse the trace files (0=one per CPU)"), cl::init(0));
+
 }
 
 
@@ -121,7 +124,7 @@ int main(int argc, char **argv)
 
     LogParser parser;
     PathBuilder pb(&parser);
-    parser.parse(TraceFiles);
+    parser.parse(TraceFiles, Jobs);
 
     ModuleCache mc(&pb);
 
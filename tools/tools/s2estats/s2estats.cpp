@@ -0,0 +1,184 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#define __STDC_FORMAT_MACROS 1
+
+#include "llvm/Support/CommandLine.h"
+
+#include <s2e/S2EStatsRecord.h>
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+#include <iostream>
+#include <vector>
+
+using namespace llvm;
+using namespace s2e;
+
+namespace {
+
+cl::list<std::string>
+    StatsFiles(cl::Positional, cl::value_desc("run.stats.bin"), cl::OneOrMore,
+               cl::desc("Binary statistics files written with -binary-stats"));
+
+cl::opt<bool>
+    Histograms("histograms", cl::desc("Print the latency histograms of the last record of each file"),
+               cl::init(false));
+
+}
+
+struct StatsColumn {
+    const char *name;
+    size_t offset;
+    unsigned size;
+};
+
+#define COLUMN(field) { #field, offsetof(S2EStatsRecord, field), sizeof(((S2EStatsRecord*)0)->field) }
+
+static const StatsColumn s_columns[] = {
+    COLUMN(wallTime), COLUMN(userTime),
+    COLUMN(stateCount), COLUMN(currentStateId),
+    COLUMN(queries), COLUMN(queryConstructs),
+    COLUMN(translationBlocks), COLUMN(translationBlocksConcrete), COLUMN(translationBlocksKlee),
+    COLUMN(cpuInstructions), COLUMN(cpuInstructionsConcrete), COLUMN(cpuInstructionsKlee),
+    COLUMN(concreteModeTime), COLUMN(symbolicModeTime),
+    COLUMN(queryTime), COLUMN(solverTime), COLUMN(cexCacheTime),
+    COLUMN(forkTime), COLUMN(resolveTime), COLUMN(stateSwitchTime),
+    COLUMN(stateTranslationBlocksConcrete), COLUMN(stateTranslationBlocksSymbolic),
+    COLUMN(stateInstructionsSymbolic), COLUMN(stateInstructions),
+    COLUMN(memoryUsage), COLUMN(residentMemoryUsage)
+};
+
+static uint64_t getColumn(const S2EStatsRecord &r, const StatsColumn &c)
+{
+    const uint8_t *p = (const uint8_t*) &r + c.offset;
+    if (c.size == sizeof(uint32_t)) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static void printHistograms(const S2EStatsRecord &r)
+{
+    printf("# Latency histograms (usec): bucket solver fork switch\n");
+    for (unsigned i = 0; i < S2E_STATS_HISTOGRAM_BUCKETS; ++i) {
+        uint64_t low = i == 0 ? 0 : (1ULL << i);
+        uint64_t high = (2ULL << i) - 1;
+        printf("# %" PRIu64 "-", low);
+        if (i == S2E_STATS_HISTOGRAM_BUCKETS - 1) {
+            printf("inf");
+        } else {
+            printf("%" PRIu64, high);
+        }
+        printf(" %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+               r.solverTimeHistogram[i], r.forkTimeHistogram[i],
+               r.stateSwitchTimeHistogram[i]);
+    }
+}
+
+static bool processFile(const std::string &fileName)
+{
+    FILE *fp = fopen(fileName.c_str(), "rb");
+    if (!fp) {
+        std::cerr << "Could not open " << fileName << '\n';
+        return false;
+    }
+
+    S2EStatsFileHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != S2E_STATS_MAGIC) {
+        std::cerr << fileName << " is not a binary statistics file\n";
+        fclose(fp);
+        return false;
+    }
+
+    if (hdr.version != S2E_STATS_VERSION ||
+        hdr.histogramBuckets != S2E_STATS_HISTOGRAM_BUCKETS ||
+        hdr.recordSize < sizeof(S2EStatsRecord)) {
+        std::cerr << fileName << " has an unsupported version (" << hdr.version << ")\n";
+        fclose(fp);
+        return false;
+    }
+
+    printf("# %s: process %u, pid %" PRIu64 ", started at %" PRIu64 "\n",
+           fileName.c_str(), hdr.processIndex, hdr.pid, hdr.startTime);
+
+    //Newer versions may append fields to the records
+    std::vector<uint8_t> buffer(hdr.recordSize);
+    S2EStatsRecord r;
+    bool hasRecords = false;
+
+    while (fread(&buffer[0], hdr.recordSize, 1, fp) == 1) {
+        memcpy(&r, &buffer[0], sizeof(r));
+        hasRecords = true;
+
+        printf("%u", hdr.processIndex);
+        for (unsigned i = 0; i < sizeof(s_columns) / sizeof(s_columns[0]); ++i) {
+            printf(",%" PRIu64, getColumn(r, s_columns[i]));
+        }
+        printf("\n");
+    }
+
+    if (Histograms && hasRecords) {
+        printHistograms(r);
+    }
+
+    fclose(fp);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    cl::ParseCommandLineOptions(argc, (char**) argv, " s2estats");
+
+    printf("processIndex");
+    for (unsigned i = 0; i < sizeof(s_columns) / sizeof(s_columns[0]); ++i) {
+        printf(",%s", s_columns[i].name);
+    }
+    printf("\n");
+
+    bool ok = true;
+    for (unsigned i = 0; i < StatsFiles.size(); ++i) {
+        ok &= processFile(StatsFiles[i]);
+    }
+
+    return ok ? 0 : 1;
+}